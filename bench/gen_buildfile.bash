@@ -0,0 +1,196 @@
+#!/bin/bash
+
+# mariebuild benchmark project generator.
+# Generates a synthetic project consisting of a build.mb file, empty source
+# files and nothing else. Every "compile" uses bench/stubcc.bash.
+#
+# Usage: gen_buildfile.bash -d DIR [-n ELEMENTS] [-t TARGETS] [-r RULES]
+#                           [-j JOBS] [-p] [-S]
+#
+#   -d DIR       Directory to generate the project in
+#   -n ELEMENTS  Number of source elements (default 1000)
+#   -t TARGETS   Length of the required_targets chain (default 16)
+#   -r RULES     Number of singular c_rules the link rule fans out to, the
+#                elements are distributed evenly across them (default 8)
+#   -j JOBS      max_procs of the singular c_rules (default 8, max 255), 0
+#                leaves it to mariebuild's default
+#   -p           Pin the jobs to CPUs (pin_jobs)
+#   -S           Run every compile through the shell (direct_exec false)
+
+SCRIPT_DIR="$(cd "$(dirname "${BASH_SOURCE[0]}")" && pwd)"
+
+DIR=""
+ELEMENTS=1000
+TARGETS=16
+RULES=8
+JOBS=8
+PIN_JOBS=false
+DIRECT_EXEC=true
+
+while getopts "d:n:t:r:j:pS" opt; do
+	case "$opt" in
+		d) DIR="$OPTARG";;
+		n) ELEMENTS="$OPTARG";;
+		t) TARGETS="$OPTARG";;
+		r) RULES="$OPTARG";;
+		j) JOBS="$OPTARG";;
+		p) PIN_JOBS=true;;
+		S) DIRECT_EXEC=false;;
+		*) exit 1;;
+	esac
+done
+
+if [ -z "$DIR" ]; then
+	echo "gen_buildfile: missing -d DIR" >&2
+	exit 1
+fi
+
+if [ "$JOBS" -gt 255 ]; then
+	JOBS=255
+fi
+
+# elements are spread over directories of 1000 files each
+function element_name() {
+	echo "d$(($1 / 1000))/f$1"
+}
+
+# print a mcfg list body for all elements where (index % RULES) == $1, or
+# every element if $1 is empty.
+function element_list() {
+	seq 0 $((ELEMENTS - 1)) | awk -v rules="$RULES" -v rule="$1" '
+		rule == "" || $1 % rules == rule {
+			if (n++ > 0) printf ",\n"
+			printf "      \047d%d/f%d\047", int($1 / 1000), $1
+		}
+		END { printf "\n" }'
+}
+
+function gen_sources() {
+	mkdir -p "$DIR/src"
+	for ((d = 0; d <= (ELEMENTS - 1) / 1000; d++)); do
+		mkdir -p "$DIR/src/d$d"
+	done
+
+	seq 0 $((ELEMENTS - 1)) |
+		awk -v dir="$DIR/src" '{ printf "%s/d%d/f%d.c\n", dir, int($1 / 1000), $1 }' |
+		xargs touch
+}
+
+function gen_config() {
+	cat <<-MB
+	sector config
+	  section bench
+	    str cc '$SCRIPT_DIR/stubcc.bash'
+	  end
+
+	  section files
+	MB
+
+	echo "    list str sources"
+	element_list ""
+	for ((r = 0; r < RULES; r++)); do
+		echo "    list str sources_$r"
+		element_list "$r"
+	done
+
+	cat <<-MB
+	  end
+
+	  section mariebuild
+	    str build_type 'incremental'
+	    bool pin_jobs $PIN_JOBS
+	    list str targets 'bench'
+	    str default 'bench'
+	  end
+	end
+
+	MB
+}
+
+function gen_targets() {
+	echo "sector targets"
+
+	cat <<-MB
+	  section bench
+	    str target_objdir 'out/obj/'
+	    list str required_targets 'chain_0'
+	    list str c_rules 'link'
+	  end
+	MB
+
+	for ((t = 0; t < TARGETS; t++)); do
+		echo "  section chain_$t"
+		if [ $((t + 1)) -lt "$TARGETS" ]; then
+			echo "    list str required_targets 'chain_$((t + 1))'"
+		fi
+		echo "  end"
+	done
+
+	echo "end"
+	echo ""
+}
+
+function gen_c_rules() {
+	echo "sector c_rules"
+
+	local required=""
+	for ((r = 0; r < RULES; r++)); do
+		if [ -n "$required" ]; then
+			required="$required, "
+		fi
+		required="$required'compile_$r'"
+	done
+
+	cat <<-MB
+	  section link
+	    list str c_rules $required
+	    str exec_mode 'unify'
+	    str build_type 'incremental'
+	    str input_src '/config/files/sources'
+	    str input_format '\$(%target_objdir%)\$(%element%).o'
+	    str output_format 'out/bench.bin'
+	    ; the input list can be larger than ARG_MAX, so this only uses builtins
+	    str exec '#!/bin/sh
+	    printf "%s\\n" \$(%input%) > \$(%output%)
+	    '
+	  end
+	MB
+
+	local max_procs=""
+	if [ "$JOBS" -gt 0 ]; then
+		max_procs="u8 max_procs $JOBS"
+	fi
+
+	for ((r = 0; r < RULES; r++)); do
+		cat <<-MB
+		  section compile_$r
+		    str exec_mode 'singular'
+		    bool parallel true
+		    bool direct_exec $DIRECT_EXEC
+		    $max_procs
+		    str input_src '/config/files/sources_$r'
+		    str output_src '/config/files/sources_$r'
+		    str input_format 'src/\$(%element%).c'
+		    str output_format '\$(%target_objdir%)\$(%element%).o'
+		    str exec '#!/bin/sh
+		    \$(/config/bench/cc) -o \$(%output%) \$(%input%)
+		    '
+		  end
+		MB
+	done
+
+	echo "end"
+}
+
+mkdir -p "$DIR" || exit
+gen_sources || exit
+
+{
+	echo "; generated by bench/gen_buildfile.bash"
+	echo "; elements=$ELEMENTS targets=$TARGETS rules=$RULES jobs=$JOBS"
+	echo "; pin_jobs=$PIN_JOBS direct_exec=$DIRECT_EXEC"
+	echo ""
+	gen_config
+	gen_targets
+	gen_c_rules
+} > "$DIR/build.mb"
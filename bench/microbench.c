@@ -0,0 +1,681 @@
+/* microbench.c ; mariebuild microbenchmarks for internal primitives
+ *
+ * Every benchmark is run for a number of warmup samples which are thrown
+ * away, followed by the measured samples. Each sample times a batch of
+ * iterations and records the mean time of one iteration within that batch,
+ * the median, p99 and median absolute deviation (MAD) are then computed over
+ * the samples.
+ *
+ * Results can be saved and later be used as a baseline. A difference to the
+ * baseline is only reported as significant if it is larger than the given
+ * threshold and larger than three times the MAD of either run.
+ *
+ * Copyright (c) 2025, Marie Eckert
+ * Licensend under the BSD 3-Clause License.
+ */
+
+#define _XOPEN_SOURCE 700
+#define _POSIX_C_SOURCE 200809L
+
+#include <errno.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <argp.h>
+#include <unistd.h>
+
+#include "actions.h"
+#include "board.h"
+#include "c_rule.h"
+#include "cptrlist.h"
+#include "executor.h"
+#include "logging.h"
+#include "mcfg.h"
+#include "mcfg_format.h"
+#include "mcfg_util.h"
+#include "stats.h"
+#include "stringutil.h"
+#include "workers.h"
+#include "xmem.h"
+
+#define MICROBENCH_FORMAT_VERSION 1
+
+#define LIST_ITEMS 1000
+#define APPEND_PIECES 64
+
+typedef struct benchmark {
+	const char *name;
+
+	/* iterations per sample and samples, scaled by the -n option */
+	size_t batch;
+	size_t samples;
+
+	bool (*setup)(void);
+	void (*run)(void);
+	void (*teardown)(void);
+} benchmark_t;
+
+typedef struct result {
+	char *name;
+	double median;
+	double p99;
+	double mad;
+} result_t;
+
+typedef struct microbench_args {
+	char *filter;
+	char *save;
+	char *baseline;
+	double scale;
+	size_t warmup;
+	double threshold;
+} microbench_args_t;
+
+/******** benchmark fixtures ********/
+
+static char *list_items[LIST_ITEMS];
+static CPtrList find_list;
+
+static char tmp_dir[] = "/tmp/mb_microbench.XXXXXX";
+static char older_file[64];
+static char newer_file[64];
+
+static char board_file[] = "/tmp/mb_microbench_board.XXXXXX";
+
+static char parent_dir[] = "/tmp/mb_microbench_dirs.XXXXXX";
+static char parent_output[96];
+
+static mcfg_file_t format_file;
+static char *format_template;
+static mcfg_path_t format_pathrel = {
+	.absolute = true,
+	.dynfield_path = false,
+
+	.sector = "c_rules",
+	.section = "main",
+	.field = ""};
+
+static char *script;
+
+/* a shortened version of mariebuild's own build file, the exec field is the
+ * template used by the main rule. */
+static char buildfile[] =
+	"sector config\n"
+	"  section files\n"
+	"    str build_root 'build/'\n"
+	"    str debug_dir '$(/config/files/build_root)debug/'\n"
+	"    str obj_dir 'obj/'\n"
+	"  end\n"
+	"  section tools\n"
+	"    str cc 'clang'\n"
+	"    str cflags '-std=c17 -pedantic-errors -Wall -Wextra -Werror'\n"
+	"  end\n"
+	"end\n"
+	"sector targets\n"
+	"  section debug\n"
+	"    str target_cflags '-ggdb -Iinclude/ -Isrc/'\n"
+	"  end\n"
+	"end\n"
+	"sector c_rules\n"
+	"  section main\n"
+	"    str exec '#!/bin/bash\n"
+	"    if ! [ -d \"\\$(dirname $(%output%))\" ]; then\n"
+	"      mkdir -p \\$(dirname $(%output%))\n"
+	"    fi\n"
+	"    COMMAND=\"$(/config/tools/cc) $(/config/tools/cflags) "
+	"$(%target_cflags%) -c $(%input%) -o $(%output%)\"\n"
+	"    printf \"  $COMMAND\\\\n\"\n"
+	"    $COMMAND\n"
+	"    '\n"
+	"  end\n"
+	"end\n";
+
+static bool setup_list(void) {
+	for (size_t ix = 0; ix < LIST_ITEMS; ix++) {
+		char name[32];
+		snprintf(name, sizeof(name), "src/element_%zu.c", ix);
+		list_items[ix] = strdup(name);
+	}
+
+	return true;
+}
+
+static void teardown_list(void) {
+	for (size_t ix = 0; ix < LIST_ITEMS; ix++) {
+		XFREE(list_items[ix]);
+	}
+}
+
+static void run_cptrlist_append(void) {
+	CPtrList list;
+	cptrlist_init(&list, 8, 8);
+
+	for (size_t ix = 0; ix < LIST_ITEMS; ix++) {
+		cptrlist_append(&list, list_items[ix]);
+	}
+
+	/* the items are owned by list_items */
+	free(list.items);
+}
+
+static bool setup_cptrlist_find(void) {
+	setup_list();
+	cptrlist_init(&find_list, LIST_ITEMS, 8);
+	for (size_t ix = 0; ix < LIST_ITEMS; ix++) {
+		cptrlist_append(&find_list, list_items[ix]);
+	}
+
+	return true;
+}
+
+static void run_cptrlist_find(void) {
+	/* worst case, the last item */
+	cptrlist_find(
+		&find_list, list_items[LIST_ITEMS - 1], &string_cptrlist_search);
+}
+
+static void teardown_cptrlist_find(void) {
+	free(find_list.items);
+	teardown_list();
+}
+
+static void run_append_str(void) {
+	size_t size = 16;
+	char *dest = XMALLOC(size);
+	size_t wix = 0;
+
+	for (size_t ix = 0; ix < APPEND_PIECES; ix++) {
+		wix = _append_str(
+			&dest, wix, &size, "build/debug/obj/some_directory/element.o");
+		_append_char(&dest, wix, &size, ' ');
+		wix++;
+	}
+
+	_append_char(&dest, wix, &size, 0);
+	XFREE(dest);
+}
+
+static bool _write_file(const char *path) {
+	FILE *file = fopen(path, "w");
+	if (file == NULL) {
+		fprintf(stderr, "failed to create \"%s\": %s\n", path, strerror(errno));
+		return false;
+	}
+
+	fclose(file);
+	return true;
+}
+
+static bool setup_is_file_newer(void) {
+	if (mkdtemp(tmp_dir) == NULL) {
+		fprintf(stderr, "mkdtemp failed: %s\n", strerror(errno));
+		return false;
+	}
+
+	snprintf(older_file, sizeof(older_file), "%s/older", tmp_dir);
+	snprintf(newer_file, sizeof(newer_file), "%s/newer", tmp_dir);
+
+	return _write_file(older_file) && _write_file(newer_file);
+}
+
+static void run_is_file_newer(void) {
+	is_file_newer(newer_file, older_file);
+}
+
+static void teardown_is_file_newer(void) {
+	remove(older_file);
+	remove(newer_file);
+	rmdir(tmp_dir);
+}
+
+static bool setup_ensure_parent_dir(void) {
+	if (mkdtemp(parent_dir) == NULL) {
+		fprintf(stderr, "mkdtemp failed: %s\n", strerror(errno));
+		return false;
+	}
+
+	/* only the first call creates the directories, the others hit the cache */
+	snprintf(parent_output, sizeof(parent_output), "%s/a/b/out.o", parent_dir);
+	return true;
+}
+
+static void run_ensure_parent_dir(void) {
+	mb_ensure_parent_dir(parent_output);
+}
+
+static void teardown_ensure_parent_dir(void) {
+	char path[96];
+	snprintf(path, sizeof(path), "%s/a/b", parent_dir);
+	rmdir(path);
+	snprintf(path, sizeof(path), "%s/a", parent_dir);
+	rmdir(path);
+	rmdir(parent_dir);
+	mb_actions_free();
+}
+
+static bool setup_board(void) {
+	int fd = mkstemp(board_file);
+	if (fd < 0) {
+		fprintf(stderr, "mkstemp failed: %s\n", strerror(errno));
+		return false;
+	}
+	close(fd);
+
+	return mb_board_open(board_file);
+}
+
+/* a job going through the board the way the events of a build publish it */
+static void run_board_job(void) {
+	mb_board_job_queued();
+	mb_board_job_spawned("main", "executor", 4242);
+	mb_board_job_finished(4242, 0);
+}
+
+static void teardown_board(void) {
+	mb_board_close(0);
+	remove(board_file);
+}
+
+static bool _add_dynfield(char *name, char *value) {
+	mcfg_err_t err = mcfg_add_dynfield(
+		&format_file, TYPE_STRING, strdup(name), strdup(value),
+		strlen(value) + 1);
+
+	return err == MCFG_OK;
+}
+
+static bool setup_format(void) {
+	mcfg_parse_result_t res = mcfg_parse(buildfile);
+	if (res.err != MCFG_OK) {
+		fprintf(stderr, "failed to parse benchmark buildfile: %d\n", res.err);
+		return false;
+	}
+
+	format_file = res.value;
+
+	mcfg_field_t *field_exec = mcfg_get_field(
+		mcfg_get_section(mcfg_get_sector(&format_file, "c_rules"), "main"),
+		"exec");
+	if (field_exec == NULL) {
+		return false;
+	}
+
+	format_template = mcfg_data_as_string(*field_exec);
+
+	mcfg_field_t *target_cflags = mcfg_get_field(
+		mcfg_get_section(mcfg_get_sector(&format_file, "targets"), "debug"),
+		"target_cflags");
+
+	return _add_dynfield("element", "executor") &&
+		   _add_dynfield("input", "src/executor.c") &&
+		   _add_dynfield("output", "build/debug/obj/executor.o") &&
+		   _add_dynfield(
+			   "target_cflags", mcfg_data_as_string(*target_cflags));
+}
+
+static void run_format(void) {
+	mcfg_fmt_res_t res = mcfg_format_field_embeds_str(
+		format_template, format_file, format_pathrel);
+	if (res.err == MCFG_FMT_OK) {
+		XFREE(res.formatted);
+	}
+}
+
+static void teardown_format(void) {
+	mcfg_free_file(format_file);
+}
+
+static bool setup_script(void) {
+	size_t size = 16;
+	script = XMALLOC(size);
+	size_t wix = _append_str(&script, 0, &size, "#!/bin/sh\n");
+
+	/* roughly the size of a formatted compile script */
+	for (size_t ix = 0; ix < 16; ix++) {
+		wix = _append_str(
+			&script, wix, &size,
+			"# some line of a script, padded to 64 characters.........\n");
+	}
+
+	wix = _append_str(&script, wix, &size, "true\n");
+	_append_char(&script, wix, &size, 0);
+
+	return true;
+}
+
+static void run_prepare_exec(void) {
+	char *name = "microbench";
+	if (_prepare_exec(script, &name) != 0) {
+		return;
+	}
+
+	remove(name);
+	XFREE(name);
+}
+
+static void run_mb_exec(void) {
+	mb_exec(script, "microbench", NULL, NULL);
+}
+
+static bool setup_direct_script(void) {
+	/* a single simple command is run without a shell */
+	script = strdup("#!/bin/sh\ntrue\n");
+	return script != NULL;
+}
+
+static void run_mb_exec_worker(void) {
+	const exec_options_t options = {
+		.weight = 1,
+		.cpu = -1,
+		.shell_workers = true,
+	};
+
+	mb_exec(script, "microbench", NULL, &options);
+}
+
+static void teardown_script(void) {
+	XFREE(script);
+}
+
+static void teardown_worker_script(void) {
+	mb_workers_stop();
+	XFREE(script);
+}
+
+static benchmark_t benchmarks[] = {
+	{"cptrlist_append", 100, 101, &setup_list, &run_cptrlist_append,
+	 &teardown_list},
+	{"cptrlist_find", 100, 101, &setup_cptrlist_find, &run_cptrlist_find,
+	 &teardown_cptrlist_find},
+	{"_append_str", 1000, 101, NULL, &run_append_str, NULL},
+	{"is_file_newer", 1000, 101, &setup_is_file_newer, &run_is_file_newer,
+	 &teardown_is_file_newer},
+	{"mcfg_format_field_embeds_str", 1000, 101, &setup_format, &run_format,
+	 &teardown_format},
+	{"mb_ensure_parent_dir", 1000, 101, &setup_ensure_parent_dir,
+	 &run_ensure_parent_dir, &teardown_ensure_parent_dir},
+	{"mb_board_job", 1000, 101, &setup_board, &run_board_job,
+	 &teardown_board},
+	{"_prepare_exec", 100, 101, &setup_script, &run_prepare_exec,
+	 &teardown_script},
+	{"mb_exec", 1, 101, &setup_script, &run_mb_exec, &teardown_script},
+	{"mb_exec_direct", 1, 101, &setup_direct_script, &run_mb_exec,
+	 &teardown_script},
+	{"mb_exec_worker", 1, 101, &setup_script, &run_mb_exec_worker,
+	 &teardown_worker_script},
+};
+
+#define BENCHMARK_COUNT (sizeof(benchmarks) / sizeof(benchmarks[0]))
+
+/******** statistics ********/
+
+static int _compare_double(const void *a, const void *b) {
+	double da = *(const double *)a;
+	double db = *(const double *)b;
+	return (da > db) - (da < db);
+}
+
+/* samples has to be sorted */
+static double _percentile(const double *samples, size_t count, double pct) {
+	size_t ix = (size_t)(pct * (double)(count - 1) + 0.5);
+	return samples[ix < count ? ix : count - 1];
+}
+
+static bool run_benchmark(
+	benchmark_t *bench,
+	microbench_args_t *args,
+	result_t *result) {
+	size_t samples = (size_t)((double)bench->samples * args->scale);
+	if (samples < 5) {
+		samples = 5;
+	}
+
+	if (bench->setup != NULL && !bench->setup()) {
+		fprintf(stderr, "setup for %s failed!\n", bench->name);
+		return false;
+	}
+
+	double *times = XCALLOC(samples, sizeof(*times));
+
+	for (size_t sample = 0; sample < args->warmup + samples; sample++) {
+		uint64_t begin = mb_stats_now();
+		for (size_t it = 0; it < bench->batch; it++) {
+			bench->run();
+		}
+		uint64_t elapsed = mb_stats_now() - begin;
+
+		if (sample >= args->warmup) {
+			times[sample - args->warmup] =
+				(double)elapsed / (double)bench->batch;
+		}
+	}
+
+	if (bench->teardown != NULL) {
+		bench->teardown();
+	}
+
+	qsort(times, samples, sizeof(*times), &_compare_double);
+	result->median = _percentile(times, samples, 0.5);
+	result->p99 = _percentile(times, samples, 0.99);
+
+	/* median absolute deviation */
+	for (size_t ix = 0; ix < samples; ix++) {
+		double dev = times[ix] - result->median;
+		times[ix] = dev < 0 ? -dev : dev;
+	}
+	qsort(times, samples, sizeof(*times), &_compare_double);
+	result->mad = _percentile(times, samples, 0.5);
+
+	result->name = strdup(bench->name);
+
+	XFREE(times);
+	return true;
+}
+
+/******** baselines ********/
+
+static bool save_results(const char *path, result_t *results, size_t count) {
+	FILE *file = fopen(path, "w");
+	if (file == NULL) {
+		fprintf(stderr, "failed to open \"%s\": %s\n", path, strerror(errno));
+		return false;
+	}
+
+	fprintf(file, "mb_microbench %d\n", MICROBENCH_FORMAT_VERSION);
+	for (size_t ix = 0; ix < count; ix++) {
+		fprintf(
+			file, "%s\t%.3f\t%.3f\t%.3f\n", results[ix].name,
+			results[ix].median, results[ix].p99, results[ix].mad);
+	}
+
+	fclose(file);
+	return true;
+}
+
+static size_t load_results(const char *path, result_t **results) {
+	FILE *file = fopen(path, "r");
+	if (file == NULL) {
+		fprintf(stderr, "failed to open \"%s\": %s\n", path, strerror(errno));
+		return 0;
+	}
+
+	int version = 0;
+	if (fscanf(file, "mb_microbench %d\n", &version) != 1 ||
+		version != MICROBENCH_FORMAT_VERSION) {
+		fprintf(stderr, "\"%s\" is not a microbenchmark baseline\n", path);
+		fclose(file);
+		return 0;
+	}
+
+	size_t count = 0;
+	*results = XCALLOC(BENCHMARK_COUNT, sizeof(**results));
+
+	char name[128];
+	result_t res;
+	while (count < BENCHMARK_COUNT &&
+		   fscanf(
+			   file, "%127s\t%lf\t%lf\t%lf\n", name, &res.median, &res.p99,
+			   &res.mad) == 4) {
+		res.name = strdup(name);
+		(*results)[count++] = res;
+	}
+
+	fclose(file);
+	return count;
+}
+
+static bool compare_results(
+	result_t *results,
+	size_t count,
+	result_t *baseline,
+	size_t baseline_count,
+	double threshold) {
+	bool regressed = false;
+
+	printf(
+		"\n%-30s %12s %12s %9s\n", "benchmark", "base (ns)", "now (ns)",
+		"change");
+
+	for (size_t ix = 0; ix < count; ix++) {
+		result_t *base = NULL;
+		for (size_t bix = 0; bix < baseline_count; bix++) {
+			if (strcmp(baseline[bix].name, results[ix].name) == 0) {
+				base = &baseline[bix];
+				break;
+			}
+		}
+
+		if (base == NULL || base->median <= 0) {
+			printf("%-30s %12s\n", results[ix].name, "(no baseline)");
+			continue;
+		}
+
+		double diff = results[ix].median - base->median;
+		double change = diff / base->median * 100.0;
+		double noise = 3 * (results[ix].mad > base->mad ? results[ix].mad
+														: base->mad);
+
+		const char *verdict = "";
+		if ((diff < 0 ? -diff : diff) > noise &&
+			(change < 0 ? -change : change) > threshold) {
+			verdict = diff > 0 ? "  REGRESSION" : "  improvement";
+			regressed = regressed || diff > 0;
+		}
+
+		printf(
+			"%-30s %12.1f %12.1f %+8.1f%%%s\n", results[ix].name,
+			base->median, results[ix].median, change, verdict);
+	}
+
+	return !regressed;
+}
+
+/******** argument parsing ********/
+
+const char *argp_program_bug_address =
+	"https://github.com/FelixEcker/mariebuild/issues";
+static const char description[] =
+	"Microbenchmarks for mariebuild's internal primitives";
+
+static struct argp_option options[] = {
+	{"filter", 'f', "NAME", 0, "Only run benchmarks containing NAME", 0},
+	{"scale", 'n', "FACTOR", 0, "Scale the number of samples by FACTOR", 0},
+	{"warmup", 'w', "SAMPLES", 0, "Warmup samples per benchmark (default 10)",
+	 0},
+	{"save", 's', "FILE", 0, "Save the results to FILE", 0},
+	{"baseline", 'b', "FILE", 0, "Compare the results against FILE", 0},
+	{"threshold", 't', "PCT", 0,
+	 "Minimum change in percent to be reported as significant (default 5)", 0},
+	{0, 0, 0, 0, 0, 0}};
+
+static error_t parse_opt(int key, char *arg, struct argp_state *state) {
+	microbench_args_t *args = state->input;
+	switch (key) {
+		case 'f':
+			args->filter = arg;
+			break;
+		case 'n':
+			args->scale = strtod(arg, NULL);
+			break;
+		case 'w':
+			args->warmup = strtoul(arg, NULL, 10);
+			break;
+		case 's':
+			args->save = arg;
+			break;
+		case 'b':
+			args->baseline = arg;
+			break;
+		case 't':
+			args->threshold = strtod(arg, NULL);
+			break;
+		default:
+			return ARGP_ERR_UNKNOWN;
+	}
+
+	return 0;
+}
+
+static struct argp argp = {options, parse_opt, "", description,
+						   NULL,	NULL,	   NULL};
+
+int main(int argc, char **argv) {
+	microbench_args_t args = {
+		.filter = NULL,
+		.save = NULL,
+		.baseline = NULL,
+		.scale = 1.0,
+		.warmup = 10,
+		.threshold = 5.0,
+	};
+
+	argp_parse(&argp, argc, argv, 0, 0, &args);
+
+	mb_log_level = LOG_ERROR;
+
+	result_t results[BENCHMARK_COUNT];
+	size_t count = 0;
+
+	printf(
+		"%-30s %12s %12s %12s\n", "benchmark", "median (ns)", "p99 (ns)",
+		"mad (ns)");
+
+	for (size_t ix = 0; ix < BENCHMARK_COUNT; ix++) {
+		if (args.filter != NULL &&
+			strstr(benchmarks[ix].name, args.filter) == NULL) {
+			continue;
+		}
+
+		if (!run_benchmark(&benchmarks[ix], &args, &results[count])) {
+			return 1;
+		}
+
+		printf(
+			"%-30s %12.1f %12.1f %12.1f\n", results[count].name,
+			results[count].median, results[count].p99, results[count].mad);
+		fflush(stdout);
+		count++;
+	}
+
+	if (args.save != NULL && !save_results(args.save, results, count)) {
+		return 1;
+	}
+
+	if (args.baseline == NULL) {
+		return 0;
+	}
+
+	result_t *baseline = NULL;
+	size_t baseline_count = load_results(args.baseline, &baseline);
+	if (baseline_count == 0) {
+		return 1;
+	}
+
+	return compare_results(
+			   results, count, baseline, baseline_count, args.threshold)
+			   ? 0
+			   : 2;
+}
@@ -0,0 +1,171 @@
+#!/bin/bash
+
+# mariebuild end-to-end benchmark harness.
+# For every size a synthetic project is generated (see gen_buildfile.bash) and
+# the wall time of a full build, a no-op incremental build and a rebuild after
+# touching a single source is measured. Results are written as JSON.
+#
+# Usage: run.bash [-m MB] [-s SIZES] [-t TARGETS] [-r RULES] [-j JOBS] [-p]
+#                 [-S] [-w WORKDIR] [-o OUTPUT] [-- MB_ARGS...]
+#
+#   -m MB       mariebuild binary to benchmark (default: mb from PATH)
+#   -s SIZES    Space separated element counts (default: "1000 10000 100000")
+#   -t TARGETS  Length of the required_targets chain (default 16)
+#   -r RULES    Number of singular c_rules (default 8)
+#   -j JOBS     max_procs of the singular c_rules (default: number of CPUs),
+#               0 leaves it to mariebuild's default
+#   -p          Pin the jobs to CPUs (pin_jobs)
+#   -S          Run every compile through the shell (direct_exec false)
+#   -w WORKDIR  Where to generate the projects (default: a new mktemp dir)
+#   -o OUTPUT   Write the JSON results to OUTPUT instead of stdout
+#   MB_ARGS     Additional arguments passed to every mb invocation
+#
+# Setting STUBCC_SLEEP makes every stub compile sleep for that many seconds,
+# setting STUBCC_WORK makes it hash that many bytes (e.g. "64M") to keep a CPU
+# busy.
+
+SCRIPT_DIR="$(cd "$(dirname "${BASH_SOURCE[0]}")" && pwd)"
+
+MB="mb"
+SIZES="1000 10000 100000"
+TARGETS=16
+RULES=8
+JOBS="$(getconf _NPROCESSORS_ONLN 2> /dev/null || echo 4)"
+WORKDIR=""
+OUTPUT=""
+PIN_ARGS=()
+PINNED=false
+SHELL_ARGS=()
+DIRECT_EXEC=true
+
+while getopts "m:s:t:r:j:pSw:o:" opt; do
+	case "$opt" in
+		m) MB="$OPTARG";;
+		s) SIZES="$OPTARG";;
+		t) TARGETS="$OPTARG";;
+		r) RULES="$OPTARG";;
+		j) JOBS="$OPTARG";;
+		p) PIN_ARGS=(-p); PINNED=true;;
+		S) SHELL_ARGS=(-S); DIRECT_EXEC=false;;
+		w) WORKDIR="$OPTARG";;
+		o) OUTPUT="$OPTARG";;
+		*) exit 1;;
+	esac
+done
+shift $((OPTIND - 1))
+MB_ARGS=("$@")
+
+# max_procs is an u8
+if [ "$JOBS" -gt 255 ]; then
+	JOBS=255
+fi
+
+# resolve relative paths before changing directories
+if [[ "$MB" == */* ]]; then
+	MB="$(cd "$(dirname "$MB")" && pwd)/$(basename "$MB")"
+fi
+
+if ! command -v "$MB" > /dev/null; then
+	echo "run.bash: mariebuild binary \"$MB\" not found" >&2
+	exit 1
+fi
+
+if [ -z "$WORKDIR" ]; then
+	WORKDIR="$(mktemp -d -t mb_bench.XXXXXX)" || exit
+	CLEANUP_WORKDIR=1
+fi
+
+function now_ns() {
+	# %N is not supported everywhere, fall back to python
+	local ns
+	ns="$(date +%s%N)"
+	if [[ "$ns" == *N ]]; then
+		ns="$(python3 -c 'import time; print(time.time_ns())')"
+	fi
+	echo "$ns"
+}
+
+# run mb in the current directory and print the wall time in milliseconds
+function timed_mb() {
+	local start end
+	start="$(now_ns)"
+	"$MB" -n -v 3 "${MB_ARGS[@]}" >> mb.log 2>&1
+	local status=$?
+	end="$(now_ns)"
+
+	if [ $status -ne 0 ]; then
+		echo "run.bash: mb failed with status $status, see $(pwd)/mb.log" >&2
+		exit 1
+	fi
+
+	echo $(((end - start) / 1000000))
+}
+
+function bench_size() {
+	local elements="$1"
+	local dir="$WORKDIR/n$elements"
+
+	echo "==> generating project with $elements elements" >&2
+	rm -rf "$dir"
+	bash "$SCRIPT_DIR/gen_buildfile.bash" -d "$dir" -n "$elements" \
+		-t "$TARGETS" -r "$RULES" -j "$JOBS" "${PIN_ARGS[@]}" \
+		"${SHELL_ARGS[@]}" || exit
+
+	(
+		cd "$dir" || exit
+
+		echo "==> full build ($elements elements)" >&2
+		local full
+		full="$(timed_mb)" || exit
+
+		echo "==> no-op build ($elements elements)" >&2
+		local noop
+		noop="$(timed_mb)" || exit
+
+		# mariebuild compares timestamps with a resolution of one second
+		sleep 1
+		touch "src/d0/f0.c"
+
+		echo "==> single-file-touch build ($elements elements)" >&2
+		local touched
+		touched="$(timed_mb)" || exit
+
+		printf '    {"elements": %d, "targets": %d, "rules": %d, ' \
+			"$elements" "$TARGETS" "$RULES"
+		printf '"jobs": %d, "full_ms": %d, "noop_ms": %d, "touch_ms": %d}' \
+			"$JOBS" "$full" "$noop" "$touched"
+	)
+}
+
+function run() {
+	printf '{\n  "version": 1,\n'
+	printf '  "mb": "%s",\n' "$("$MB" --version 2> /dev/null | head -n 1)"
+	printf '  "stubcc_sleep": "%s",\n' "${STUBCC_SLEEP:-0}"
+	printf '  "stubcc_work": "%s",\n' "${STUBCC_WORK:-0}"
+	printf '  "pinned": %s,\n' "$PINNED"
+	printf '  "direct_exec": %s,\n' "$DIRECT_EXEC"
+	printf '  "results": [\n'
+
+	local first=1
+	for size in $SIZES; do
+		if [ $first -eq 0 ]; then
+			printf ',\n'
+		fi
+		first=0
+
+		bench_size "$size" || exit
+	done
+
+	printf '\n  ]\n}\n'
+}
+
+if [ -n "$OUTPUT" ]; then
+	run > "$OUTPUT" || exit
+	echo "==> results written to $OUTPUT" >&2
+else
+	run || exit
+fi
+
+if [ -n "$CLEANUP_WORKDIR" ]; then
+	rm -rf "$WORKDIR"
+fi
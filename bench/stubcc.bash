@@ -0,0 +1,36 @@
+#!/bin/bash
+
+# mariebuild benchmark stub "compiler".
+# Usage: stubcc.bash -o OUTPUT [INPUT...]
+#
+# Does not look at its inputs at all, it only (optionally) sleeps for
+# STUBCC_SLEEP seconds, burns CPU hashing STUBCC_WORK bytes (e.g. "64M") and
+# then creates/touches OUTPUT.
+
+OUTPUT=""
+while [ $# -gt 0 ]; do
+	case "$1" in
+		-o) OUTPUT="$2"; shift 2;;
+		*) shift;;
+	esac
+done
+
+if [ -z "$OUTPUT" ]; then
+	echo "stubcc: missing -o" >&2
+	exit 1
+fi
+
+if [ -n "$STUBCC_SLEEP" ] && [ "$STUBCC_SLEEP" != "0" ]; then
+	sleep "$STUBCC_SLEEP"
+fi
+
+if [ -n "$STUBCC_WORK" ] && [ "$STUBCC_WORK" != "0" ]; then
+	head -c "$STUBCC_WORK" /dev/zero | sha256sum > /dev/null
+fi
+
+OUTDIR="$(dirname "$OUTPUT")"
+if ! [ -d "$OUTDIR" ]; then
+	mkdir -p "$OUTDIR"
+fi
+
+touch "$OUTPUT"
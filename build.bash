@@ -13,7 +13,7 @@ CC="clang"
 BASE_CFLAGS="-std=c17 -pedantic-errors -Wall -Wextra -Werror -Wno-gnu-statement-expression -Iinclude/ -Isrc/"
 DEBUG_CFLAGS="-ggdb -DDEFAULT_LOG_LEVEL=LOG_DEBUG"
 RELEASE_CFLAGS="-Oz"
-LDFLAGS="-lm -Llib/ -lmcfg_2"
+LDFLAGS="-lm -lpthread -Llib/ -lmcfg_2"
 
 BIN_NAME="mb"
 
@@ -49,7 +49,7 @@ function build_objs() {
 }
 
 function build() {
-	OBJECTS=("stringutil cptrlist signals logging types executor c_rule target build main")
+	OBJECTS=("stringutil cptrlist signals stats events history restat accounting pools admission topology workers jobserver actions capture progress board logging types executor c_rule target build main")
 
 	echo "==> Compiling Sources for \"$BIN_DEST\""
 	build_objs "${OBJECTS[@]}"
@@ -0,0 +1,210 @@
+/* accounting.c ; mariebuild per c_rule and target resource accounting
+ *
+ * Every job reaped by the executor is accounted to the innermost c_rule and
+ * target running at the time, jobs of a target's exec field only count
+ * towards the target. Nested targets and c_rules (required_targets, c_rules
+ * of c_rules) are tracked on a stack, so a job is only ever accounted to the
+ * c_rule and target which actually ran it.
+ *
+ * Copyright (c) 2025, Marie Eckert
+ * Licensend under the BSD 3-Clause License.
+ */
+
+#define _XOPEN_SOURCE 700
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+
+#include <sys/resource.h>
+
+#include "accounting.h"
+#include "cptrlist.h"
+#include "logging.h"
+#include "stats.h"
+#include "stringutil.h"
+#include "xmem.h"
+
+typedef struct usage_total {
+	char *name;
+
+	size_t jobs;
+
+	uint64_t wall_ns;
+	int64_t utime_us;
+	int64_t stime_us;
+
+	/* the largest max RSS of any single job */
+	int64_t maxrss_kb;
+
+	int64_t inblock;
+	int64_t oublock;
+	int64_t nvcsw;
+	int64_t nivcsw;
+} usage_total_t;
+
+static bool initialised = false;
+
+/* names are owned by the callers of the enter functions */
+static CPtrList target_stack;
+static CPtrList c_rule_stack;
+
+/* usage_total_t in order of first use */
+static CPtrList target_totals;
+static CPtrList c_rule_totals;
+
+static void _init(void) {
+	if (initialised) {
+		return;
+	}
+
+	cptrlist_init(&target_stack, 4, 4);
+	cptrlist_init(&c_rule_stack, 4, 4);
+	cptrlist_init(&target_totals, 8, 8);
+	cptrlist_init(&c_rule_totals, 8, 8);
+	initialised = true;
+}
+
+void mb_accounting_enter_target(const char *name) {
+	_init();
+	cptrlist_append(&target_stack, (void *)name);
+}
+
+void mb_accounting_leave_target(void) {
+	if (initialised && target_stack.size > 0) {
+		target_stack.size--;
+	}
+}
+
+void mb_accounting_enter_c_rule(const char *name) {
+	_init();
+	cptrlist_append(&c_rule_stack, (void *)name);
+}
+
+void mb_accounting_leave_c_rule(void) {
+	if (initialised && c_rule_stack.size > 0) {
+		c_rule_stack.size--;
+	}
+}
+
+static usage_total_t *_get_total(CPtrList *totals, const char *name) {
+	for (size_t ix = 0; ix < totals->size; ix++) {
+		usage_total_t *total = totals->items[ix];
+		if (strcmp(total->name, name) == 0) {
+			return total;
+		}
+	}
+
+	usage_total_t *total = XCALLOC(1, sizeof(usage_total_t));
+	total->name = strdup(name);
+	cptrlist_append(totals, total);
+
+	return total;
+}
+
+static int64_t _timeval_us(struct timeval tv) {
+	return (int64_t)tv.tv_sec * 1000000 + tv.tv_usec;
+}
+
+static void
+_add_job(usage_total_t *total, uint64_t wall_ns, const struct rusage *usage) {
+	total->jobs++;
+	total->wall_ns += wall_ns;
+
+	if (usage == NULL) {
+		return;
+	}
+
+	total->utime_us += _timeval_us(usage->ru_utime);
+	total->stime_us += _timeval_us(usage->ru_stime);
+
+	int64_t maxrss_kb = mb_rusage_maxrss_kb(usage);
+	if (maxrss_kb > total->maxrss_kb) {
+		total->maxrss_kb = maxrss_kb;
+	}
+
+	total->inblock += usage->ru_inblock;
+	total->oublock += usage->ru_oublock;
+	total->nvcsw += usage->ru_nvcsw;
+	total->nivcsw += usage->ru_nivcsw;
+}
+
+void mb_accounting_record(uint64_t wall_ns, const struct rusage *usage) {
+	_init();
+
+	if (c_rule_stack.size > 0) {
+		char *c_rule = c_rule_stack.items[c_rule_stack.size - 1];
+		_add_job(_get_total(&c_rule_totals, c_rule), wall_ns, usage);
+	}
+
+	if (target_stack.size > 0) {
+		char *target = target_stack.items[target_stack.size - 1];
+		_add_job(_get_total(&target_totals, target), wall_ns, usage);
+	}
+}
+
+static void _print_totals(const char *kind, CPtrList *totals) {
+	mb_logf_noprefix(
+		LOG_STEPS, "  %-18s %5s %8s %8s %7s %5s %7s %7s %7s %7s %7s\n", kind,
+		"jobs", "wall s", "user s", "sys s", "cpu%", "rss MiB", "in blk",
+		"out blk", "vcsw", "ivcsw");
+
+	for (size_t ix = 0; ix < totals->size; ix++) {
+		usage_total_t *total = totals->items[ix];
+
+		/* cpu time relative to wall time, ~100% is cpu bound, much less is
+		 * waiting on I/O (or other processes) */
+		double cpu = 0;
+		if (total->wall_ns > 0) {
+			cpu = (double)(total->utime_us + total->stime_us) * 1000 /
+				  (double)total->wall_ns * 100;
+		}
+
+		mb_logf_noprefix(
+			LOG_STEPS,
+			"  %-18s %5zu %8.2f %8.2f %7.2f %5.0f %7.1f %7lld %7lld %7lld "
+			"%7lld\n",
+			total->name, total->jobs, (double)total->wall_ns / 1e9,
+			(double)total->utime_us / 1e6, (double)total->stime_us / 1e6, cpu,
+			(double)total->maxrss_kb / 1024, (long long)total->inblock,
+			(long long)total->oublock, (long long)total->nvcsw,
+			(long long)total->nivcsw);
+	}
+}
+
+void mb_accounting_print(void) {
+	if (!initialised || (c_rule_totals.size == 0 && target_totals.size == 0)) {
+		return;
+	}
+
+	mb_logf(LOG_STEPS, "resource usage of jobs (rss is the largest job):\n");
+	if (c_rule_totals.size > 0) {
+		_print_totals("c_rule", &c_rule_totals);
+	}
+
+	if (target_totals.size > 0) {
+		_print_totals("target", &target_totals);
+	}
+}
+
+static void _free_totals(CPtrList *totals) {
+	for (size_t ix = 0; ix < totals->size; ix++) {
+		usage_total_t *total = totals->items[ix];
+		XFREE(total->name);
+	}
+
+	cptrlist_destroy(totals);
+}
+
+void mb_accounting_free(void) {
+	if (!initialised) {
+		return;
+	}
+
+	free(target_stack.items);
+	free(c_rule_stack.items);
+	_free_totals(&target_totals);
+	_free_totals(&c_rule_totals);
+	initialised = false;
+}
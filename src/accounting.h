@@ -0,0 +1,41 @@
+/* accounting.h ; mariebuild per c_rule and target resource accounting header
+ *
+ * Copyright (c) 2025, Marie Eckert
+ * Licensend under the BSD 3-Clause License.
+ */
+
+#ifndef ACCOUNTING_H
+#define ACCOUNTING_H
+
+#include <stdint.h>
+
+#include <sys/resource.h>
+
+/**
+ * @brief Mark the start of a target, jobs finished until the matching
+ * mb_accounting_leave_target call are accounted to it.
+ */
+void mb_accounting_enter_target(const char *name);
+void mb_accounting_leave_target(void);
+
+/**
+ * @brief Mark the start of a c_rule, jobs finished until the matching
+ * mb_accounting_leave_c_rule call are accounted to it.
+ */
+void mb_accounting_enter_c_rule(const char *name);
+void mb_accounting_leave_c_rule(void);
+
+/**
+ * @brief Account a finished job to the innermost c_rule and target.
+ * @param usage The resource usage of the job, may be NULL
+ */
+void mb_accounting_record(uint64_t wall_ns, const struct rusage *usage);
+
+/**
+ * @brief Log the resource usage summed up per c_rule and per target.
+ */
+void mb_accounting_print(void);
+
+void mb_accounting_free(void);
+
+#endif /* #ifndef ACCOUNTING_H */
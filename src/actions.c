@@ -0,0 +1,540 @@
+/* actions.c ; mariebuild builtin filesystem actions
+ *
+ * Builtin actions do what small shell scripts would otherwise do for a build
+ * (creating directories, removing trees, copying files, ...) without starting
+ * a process. They are listed in the actions field of c_rules and targets:
+ *
+ *   mkdir_p DIR...         create directories and their parents
+ *   remove_tree PATH...    remove files or directories recursively
+ *   copy SRC DST           copy a file, reflinked where supported
+ *   symlink TARGET LINK    create or replace a symbolic link
+ *   touch FILE...          create files or update their modification time
+ *   write_file FILE WORD...  write the words and a newline to a file
+ *
+ * Copyright (c) 2025, Marie Eckert
+ * Licensend under the BSD 3-Clause License.
+ */
+
+#define _XOPEN_SOURCE 700
+#define _POSIX_C_SOURCE 200809L
+
+#include <errno.h>
+#include <ftw.h>
+#include <limits.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#ifdef __linux__
+#include <linux/fs.h>
+#include <sys/ioctl.h>
+#endif
+
+#include "actions.h"
+#include "executor.h"
+#include "logging.h"
+#include "mcfg.h"
+#include "mcfg_format.h"
+#include "mcfg_util.h"
+#include "stats.h"
+#include "xmem.h"
+
+#define ACTIONS_COPY_SIZE (64 * 1024)
+
+#define ACTIONS_INITIAL_TABLE_SIZE 64
+
+/* amount of arguments without a maximum */
+#define ARGS_ANY ((size_t)-1)
+
+/******** directory cache ********/
+
+/* open addressing hash set of directories known to exist, NULL is empty */
+static char **known_dirs = NULL;
+static size_t known_dir_count = 0;
+static size_t known_dirs_size = 0;
+
+static uint64_t _hash_path(const char *path) {
+	/* FNV-1a */
+	uint64_t hash = 0xcbf29ce484222325ull;
+	for (const char *chr = path; *chr != 0; chr++) {
+		hash = (hash ^ (unsigned char)*chr) * 0x100000001b3ull;
+	}
+
+	return hash;
+}
+
+static char **_find_dir_slot(const char *path) {
+	size_t mask = known_dirs_size - 1;
+	size_t slot = _hash_path(path) & mask;
+
+	while (known_dirs[slot] != NULL && strcmp(known_dirs[slot], path) != 0) {
+		slot = (slot + 1) & mask;
+	}
+
+	return &known_dirs[slot];
+}
+
+static bool _dir_known(const char *path) {
+	return known_dir_count > 0 && *_find_dir_slot(path) != NULL;
+}
+
+static void _remember_dir(const char *path) {
+	/* keep the load factor below 1/2 */
+	if ((known_dir_count + 1) * 2 > known_dirs_size) {
+		char **old = known_dirs;
+		size_t old_size = known_dirs_size;
+
+		known_dirs_size = old_size == 0 ? ACTIONS_INITIAL_TABLE_SIZE
+										: old_size * 2;
+		known_dirs = XCALLOC(known_dirs_size, sizeof(char *));
+
+		for (size_t ix = 0; ix < old_size; ix++) {
+			if (old[ix] != NULL) {
+				*_find_dir_slot(old[ix]) = old[ix];
+			}
+		}
+
+		if (old != NULL) {
+			XFREE(old);
+		}
+	}
+
+	char **slot = _find_dir_slot(path);
+	if (*slot == NULL) {
+		*slot = strdup(path);
+		known_dir_count++;
+	}
+}
+
+/**
+ * @brief Forget all known directories, used whenever something is removed.
+ */
+static void _forget_dirs(void) {
+	for (size_t ix = 0; ix < known_dirs_size; ix++) {
+		if (known_dirs[ix] != NULL) {
+			XFREE(known_dirs[ix]);
+			known_dirs[ix] = NULL;
+		}
+	}
+
+	known_dir_count = 0;
+}
+
+/******** actions ********/
+
+/**
+ * @brief Create a directory and all of its parents.
+ * @return Success?
+ */
+static bool _mkdir_p(const char *owner, const char *dir) {
+	if (_dir_known(dir)) {
+		return true;
+	}
+
+	size_t len = strlen(dir);
+	char *path = XMALLOC(len + 1);
+	memcpy(path, dir, len + 1);
+
+	bool ok = true;
+	for (size_t ix = 1; ix <= len && ok; ix++) {
+		if (path[ix] != '/' && path[ix] != 0) {
+			continue;
+		}
+
+		char separator = path[ix];
+		path[ix] = 0;
+
+		struct stat st;
+		if (mkdir(path, 0777) != 0) {
+			if (errno != EEXIST) {
+				ok = false;
+			} else if (stat(path, &st) != 0 || !S_ISDIR(st.st_mode)) {
+				errno = ENOTDIR;
+				ok = false;
+			}
+		}
+
+		path[ix] = separator;
+	}
+
+	if (ok) {
+		_remember_dir(dir);
+	} else {
+		mb_logf(
+			LOG_ERROR, "%s: mkdir_p \"%s\": %s\n", owner, dir,
+			strerror(errno));
+	}
+
+	XFREE(path);
+	return ok;
+}
+
+static int _remove_entry(
+	const char *path,
+	const struct stat *st,
+	int type,
+	struct FTW *ftw) {
+	(void)st;
+	(void)ftw;
+
+	int res = type == FTW_DP ? rmdir(path) : unlink(path);
+	return res != 0 && errno != ENOENT ? -1 : 0;
+}
+
+static bool _remove_tree(const char *owner, const char *path) {
+	_forget_dirs();
+
+	struct stat st;
+	if (lstat(path, &st) != 0 && errno == ENOENT) {
+		return true;
+	}
+
+	if (nftw(path, _remove_entry, 16, FTW_DEPTH | FTW_PHYS) != 0) {
+		mb_logf(
+			LOG_ERROR, "%s: remove_tree \"%s\": %s\n", owner, path,
+			strerror(errno));
+		return false;
+	}
+
+	return true;
+}
+
+/**
+ * @brief Copy the content of one file descriptor to another, sharing the
+ * extents of the file if the filesystem supports it.
+ */
+static bool _copy_fd(int src_fd, int dst_fd) {
+#ifdef FICLONE
+	if (ioctl(dst_fd, FICLONE, src_fd) == 0) {
+		return true;
+	}
+#endif
+
+	char *buffer = XMALLOC(ACTIONS_COPY_SIZE);
+	bool ok = true;
+
+	ssize_t res;
+	while ((res = read(src_fd, buffer, ACTIONS_COPY_SIZE)) != 0) {
+		if (res < 0) {
+			if (errno == EINTR) {
+				continue;
+			}
+			ok = false;
+			break;
+		}
+
+		for (ssize_t written = 0; written < res;) {
+			ssize_t wres = write(dst_fd, buffer + written, res - written);
+			if (wres < 0 && errno != EINTR) {
+				ok = false;
+				break;
+			}
+			written += wres < 0 ? 0 : wres;
+		}
+
+		if (!ok) {
+			break;
+		}
+	}
+
+	XFREE(buffer);
+	return ok;
+}
+
+static bool _copy(const char *owner, const char *src, const char *dst) {
+	int src_fd = open(src, O_RDONLY);
+	if (src_fd < 0) {
+		mb_logf(
+			LOG_ERROR, "%s: copy \"%s\": %s\n", owner, src, strerror(errno));
+		return false;
+	}
+
+	struct stat st;
+	int dst_fd = -1;
+	if (fstat(src_fd, &st) == 0) {
+		dst_fd =
+			open(dst, O_WRONLY | O_CREAT | O_TRUNC, st.st_mode & 07777);
+	}
+
+	bool ok = dst_fd >= 0 && _copy_fd(src_fd, dst_fd) &&
+			  fchmod(dst_fd, st.st_mode & 07777) == 0;
+	if (!ok) {
+		mb_logf(
+			LOG_ERROR, "%s: copy \"%s\" to \"%s\": %s\n", owner, src, dst,
+			strerror(errno));
+	}
+
+	if (dst_fd >= 0 && close(dst_fd) != 0) {
+		ok = false;
+	}
+	close(src_fd);
+	return ok;
+}
+
+static bool _symlink(const char *owner, const char *target, const char *link) {
+	char current[PATH_MAX];
+	ssize_t len = readlink(link, current, sizeof(current) - 1);
+	if (len >= 0) {
+		current[len] = 0;
+		if (strcmp(current, target) == 0) {
+			return true;
+		}
+	}
+
+	if ((unlink(link) != 0 && errno != ENOENT) || symlink(target, link) != 0) {
+		mb_logf(
+			LOG_ERROR, "%s: symlink \"%s\": %s\n", owner, link,
+			strerror(errno));
+		return false;
+	}
+
+	return true;
+}
+
+static bool _touch(const char *owner, const char *path) {
+	int fd = open(path, O_WRONLY | O_CREAT, 0666);
+	if (fd < 0 || futimens(fd, NULL) != 0) {
+		mb_logf(
+			LOG_ERROR, "%s: touch \"%s\": %s\n", owner, path, strerror(errno));
+		if (fd >= 0) {
+			close(fd);
+		}
+		return false;
+	}
+
+	close(fd);
+	return true;
+}
+
+/**
+ * @brief Check if a file already has the given content.
+ */
+static bool _has_content(const char *path, const char *content, size_t len) {
+	struct stat st;
+	if (stat(path, &st) != 0 || (size_t)st.st_size != len) {
+		return false;
+	}
+
+	FILE *file = fopen(path, "r");
+	if (file == NULL) {
+		return false;
+	}
+
+	char *existing = XMALLOC(len + 1);
+	bool same = fread(existing, 1, len, file) == len &&
+				memcmp(existing, content, len) == 0;
+
+	XFREE(existing);
+	fclose(file);
+	return same;
+}
+
+/**
+ * @brief Write words to a file separated by spaces. The file is left
+ * untouched if its content would not change, so rules using it as input do
+ * not rebuild.
+ */
+static bool _write_file(const char *owner, const char *path, char **words) {
+	size_t len = 0;
+	for (char **word = words; *word != NULL; word++) {
+		len += strlen(*word) + 1;
+	}
+
+	char *content = XMALLOC(len + 1);
+	size_t wix = 0;
+	for (char **word = words; *word != NULL; word++) {
+		size_t word_len = strlen(*word);
+		memcpy(&content[wix], *word, word_len);
+		wix += word_len;
+		content[wix++] = word[1] != NULL ? ' ' : '\n';
+	}
+	content[wix] = 0;
+
+	bool ok = true;
+	if (!_has_content(path, content, wix)) {
+		FILE *file = fopen(path, "w");
+		ok = file != NULL && fwrite(content, 1, wix, file) == wix;
+		if (file != NULL && fclose(file) != 0) {
+			ok = false;
+		}
+
+		if (!ok) {
+			mb_logf(
+				LOG_ERROR, "%s: write_file \"%s\": %s\n", owner, path,
+				strerror(errno));
+		}
+	}
+
+	XFREE(content);
+	return ok;
+}
+
+typedef enum action {
+	ACTION_MKDIR_P = 0,
+	ACTION_REMOVE_TREE,
+	ACTION_COPY,
+	ACTION_SYMLINK,
+	ACTION_TOUCH,
+	ACTION_WRITE_FILE,
+	__ACTION_UPPER_BOUND
+} action_t;
+
+static const struct {
+	const char *name;
+	size_t min_args;
+	size_t max_args;
+} actions[__ACTION_UPPER_BOUND] = {
+	[ACTION_MKDIR_P] = {"mkdir_p", 1, ARGS_ANY},
+	[ACTION_REMOVE_TREE] = {"remove_tree", 1, ARGS_ANY},
+	[ACTION_COPY] = {"copy", 2, 2},
+	[ACTION_SYMLINK] = {"symlink", 2, 2},
+	[ACTION_TOUCH] = {"touch", 1, ARGS_ANY},
+	[ACTION_WRITE_FILE] = {"write_file", 1, ARGS_ANY},
+};
+
+bool mb_action_run(const char *owner, char **argv) {
+	size_t argc = 0;
+	while (argv[argc] != NULL) {
+		argc++;
+	}
+
+	if (argc == 0) {
+		return true;
+	}
+
+	action_t action = 0;
+	while (action < __ACTION_UPPER_BOUND &&
+		   strcmp(actions[action].name, argv[0]) != 0) {
+		action++;
+	}
+
+	if (action == __ACTION_UPPER_BOUND) {
+		mb_logf(LOG_ERROR, "%s: unknown action \"%s\"\n", owner, argv[0]);
+		return false;
+	}
+
+	size_t args = argc - 1;
+	if (args < actions[action].min_args || args > actions[action].max_args) {
+		mb_logf(
+			LOG_ERROR, "%s: wrong amount of arguments for action \"%s\"\n",
+			owner, argv[0]);
+		return false;
+	}
+
+	uint64_t stats_begin = mb_stats_begin();
+	bool ok = true;
+
+	switch (action) {
+	case ACTION_MKDIR_P:
+		for (size_t ix = 1; ix < argc && ok; ix++) {
+			ok = _mkdir_p(owner, argv[ix]);
+		}
+		break;
+	case ACTION_REMOVE_TREE:
+		for (size_t ix = 1; ix < argc && ok; ix++) {
+			ok = _remove_tree(owner, argv[ix]);
+		}
+		break;
+	case ACTION_COPY:
+		ok = _copy(owner, argv[1], argv[2]);
+		break;
+	case ACTION_SYMLINK:
+		ok = _symlink(owner, argv[1], argv[2]);
+		break;
+	case ACTION_TOUCH:
+		for (size_t ix = 1; ix < argc && ok; ix++) {
+			ok = _touch(owner, argv[ix]);
+		}
+		break;
+	case ACTION_WRITE_FILE:
+		ok = _write_file(owner, argv[1], &argv[2]);
+		break;
+	case __ACTION_UPPER_BOUND:
+		break;
+	}
+
+	mb_stats_end(STAT_ACTION, stats_begin);
+	return ok;
+}
+
+bool mb_actions_run(
+	mcfg_file_t *file,
+	mcfg_field_t *field,
+	mcfg_path_t pathrel,
+	const char *owner) {
+	if (field->type != TYPE_LIST) {
+		mb_logf(LOG_ERROR, "%s: field \"actions\" should be a list\n", owner);
+		return false;
+	}
+
+	mcfg_list_t *list = mcfg_data_as_list(*field);
+	bool ok = true;
+
+	for (size_t ix = 0; ix < list->field_count && ok; ix++) {
+		char *raw = mcfg_data_to_string(list->fields[ix]);
+		mcfg_fmt_res_t fmt_res = STATS_TIMED(
+			STAT_FORMAT, mcfg_format_field_embeds_str(raw, *file, pathrel));
+		XFREE(raw);
+
+		if (fmt_res.err != MCFG_FMT_OK) {
+			mb_logf(
+				LOG_ERROR,
+				"[actions:format] mcfg_format_field_embeds failed: %d\n",
+				fmt_res.err);
+			return false;
+		}
+
+		char *line = fmt_res.formatted;
+		size_t line_len = strlen(line);
+		char *words = XMALLOC(line_len + 1);
+		char **argv = XMALLOC((line_len / 2 + 2) * sizeof(char *));
+
+		mb_logf(LOG_STEPS, "action: %s\n", line);
+
+		if (mb_split_words(line, true, words, argv) < 0) {
+			mb_logf(LOG_ERROR, "%s: unbalanced quotes in action\n", owner);
+			ok = false;
+		} else {
+			ok = mb_action_run(owner, argv);
+		}
+
+		XFREE(argv);
+		XFREE(words);
+		XFREE(line);
+	}
+
+	return ok;
+}
+
+bool mb_ensure_parent_dir(const char *path) {
+	const char *slash = strrchr(path, '/');
+	if (slash == NULL || slash == path) {
+		return true;
+	}
+
+	size_t len = (size_t)(slash - path);
+	char *dir = XMALLOC(len + 1);
+	memcpy(dir, path, len);
+	dir[len] = 0;
+
+	bool ok = _mkdir_p("mkdir", dir);
+	XFREE(dir);
+	return ok;
+}
+
+void mb_actions_free(void) {
+	_forget_dirs();
+
+	if (known_dirs != NULL) {
+		XFREE(known_dirs);
+	}
+
+	known_dirs = NULL;
+	known_dirs_size = 0;
+}
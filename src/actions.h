@@ -0,0 +1,45 @@
+/* actions.h ; mariebuild builtin filesystem actions header
+ *
+ * Copyright (c) 2025, Marie Eckert
+ * Licensend under the BSD 3-Clause License.
+ */
+
+#ifndef ACTIONS_H
+#define ACTIONS_H
+
+#include <stdbool.h>
+
+#include "mcfg.h"
+#include "mcfg_util.h"
+
+/**
+ * @brief Run the builtin actions listed in the actions field of a c_rule or
+ * target. Every element of the list is formatted and split into words, the
+ * first word names the action and the others are its arguments.
+ * @param owner Name of the c_rule or target, used for logging
+ * @return Success? Running stops at the first action which fails
+ */
+bool mb_actions_run(
+	mcfg_file_t *file,
+	mcfg_field_t *field,
+	mcfg_path_t pathrel,
+	const char *owner);
+
+/**
+ * @brief Run a single builtin action in-process.
+ * @param argv NULL terminated name and arguments of the action
+ * @return Success?
+ */
+bool mb_action_run(const char *owner, char **argv);
+
+/**
+ * @brief Create the parent directory of a path if it does not exist yet.
+ * Directories which were created or found before are remembered, so this is
+ * cheap to call for every output of a rule.
+ * @return Success?
+ */
+bool mb_ensure_parent_dir(const char *path);
+
+void mb_actions_free(void);
+
+#endif /* #ifndef ACTIONS_H */
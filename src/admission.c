@@ -0,0 +1,220 @@
+/* admission.c ; mariebuild load and pressure aware admission control
+ *
+ * Parallel rules stop starting new jobs while the load average per CPU or
+ * the pressure stall information (PSI) of the system exceed the configured
+ * thresholds. PSI is read from the cgroup mariebuild runs in if the cgroup
+ * (v2) exposes it, otherwise from /proc/pressure. Systems without PSI or
+ * /proc/loadavg simply never hit the respective threshold.
+ *
+ * Copyright (c) 2025, Marie Eckert
+ * Licensend under the BSD 3-Clause License.
+ */
+
+#define _XOPEN_SOURCE 700
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <unistd.h>
+
+#include "admission.h"
+#include "logging.h"
+#include "mcfg.h"
+#include "mcfg_util.h"
+#include "stats.h"
+#include "topology.h"
+#include "xmem.h"
+
+/* how often the load and pressure files are read at most */
+#define ADMISSION_SAMPLE_INTERVAL_NS 250000000ull
+
+#define PSI_PATH_SIZE 512
+
+typedef enum pressure {
+	PRESSURE_CPU = 0,
+	PRESSURE_MEMORY,
+	PRESSURE_IO,
+	__PRESSURE_UPPER_BOUND
+} pressure_t;
+
+static const char *pressure_names[__PRESSURE_UPPER_BOUND] = {
+	[PRESSURE_CPU] = "cpu",
+	[PRESSURE_MEMORY] = "memory",
+	[PRESSURE_IO] = "io",
+};
+
+static bool enabled = false;
+
+/* thresholds, < 0 if not configured */
+static double max_load = -1;
+static double max_pressure[__PRESSURE_UPPER_BOUND] = {-1, -1, -1};
+
+static char psi_paths[__PRESSURE_UPPER_BOUND][PSI_PATH_SIZE];
+
+static uint64_t last_sample = 0;
+static bool last_allowed = true;
+
+static void _find_psi_paths(void) {
+	char cgroup[PSI_PATH_SIZE - 32];
+	bool have_cgroup = mb_cgroup_dir(cgroup, sizeof(cgroup));
+
+	for (size_t ix = 0; ix < __PRESSURE_UPPER_BOUND; ix++) {
+		char *path = psi_paths[ix];
+
+		if (have_cgroup) {
+			snprintf(
+				path, PSI_PATH_SIZE, "%s/%s.pressure", cgroup,
+				pressure_names[ix]);
+			if (access(path, R_OK) == 0) {
+				continue;
+			}
+		}
+
+		snprintf(path, PSI_PATH_SIZE, "/proc/pressure/%s", pressure_names[ix]);
+	}
+}
+
+/**
+ * @brief Read the "some avg10" value of a PSI file, the share of the last ten
+ * seconds in which at least one task was stalled on the resource.
+ * @return The value in percent or -1 on error
+ */
+static double _read_pressure(const char *path) {
+	FILE *file = fopen(path, "r");
+	if (file == NULL) {
+		return -1;
+	}
+
+	double avg10 = -1;
+	if (fscanf(file, "some avg10=%lf", &avg10) != 1) {
+		avg10 = -1;
+	}
+
+	fclose(file);
+	return avg10;
+}
+
+/**
+ * @return The 1 minute load average per online CPU or -1 on error
+ */
+static double _read_load(void) {
+	FILE *file = fopen("/proc/loadavg", "r");
+	if (file == NULL) {
+		return -1;
+	}
+
+	double load = -1;
+	if (fscanf(file, "%lf", &load) != 1) {
+		load = -1;
+	}
+
+	fclose(file);
+
+	long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+	if (load < 0 || cpus <= 0) {
+		return -1;
+	}
+
+	return load / (double)cpus;
+}
+
+/**
+ * @brief Read a threshold from the admission section.
+ * @return Success? A missing field is a success.
+ */
+static bool
+_load_threshold(mcfg_section_t *section, char *name, double *threshold) {
+	mcfg_field_t *field = mcfg_get_field(section, name);
+	if (field == NULL) {
+		return true;
+	}
+
+	char *raw = mcfg_data_to_string(*field);
+	char *end;
+	*threshold = strtod(raw, &end);
+	bool ok = end != raw && *end == 0 && *threshold >= 0;
+	XFREE(raw);
+
+	if (!ok) {
+		mb_logf(
+			LOG_ERROR, "/config/admission/%s: invalid threshold\n", name);
+	}
+
+	return ok;
+}
+
+bool mb_admission_load(mcfg_file_t *file) {
+	mcfg_section_t *section =
+		mcfg_get_section(mcfg_get_sector(file, "config"), "admission");
+	if (section == NULL) {
+		return true;
+	}
+
+	if (!_load_threshold(section, "max_load", &max_load) ||
+		!_load_threshold(
+			section, "max_cpu_pressure", &max_pressure[PRESSURE_CPU]) ||
+		!_load_threshold(
+			section, "max_memory_pressure", &max_pressure[PRESSURE_MEMORY]) ||
+		!_load_threshold(
+			section, "max_io_pressure", &max_pressure[PRESSURE_IO])) {
+		return false;
+	}
+
+	_find_psi_paths();
+	enabled = true;
+
+	for (size_t ix = 0; ix < __PRESSURE_UPPER_BOUND; ix++) {
+		if (max_pressure[ix] >= 0) {
+			mb_logf(
+				LOG_DEBUG, "admission: %s pressure from \"%s\"\n",
+				pressure_names[ix], psi_paths[ix]);
+		}
+	}
+
+	return true;
+}
+
+bool mb_admission_allows(void) {
+	if (!enabled) {
+		return true;
+	}
+
+	uint64_t now = mb_stats_now();
+	if (last_sample != 0 && now - last_sample < ADMISSION_SAMPLE_INTERVAL_NS) {
+		return last_allowed;
+	}
+
+	last_sample = now;
+
+	bool allowed = true;
+	if (max_load >= 0) {
+		double load = _read_load();
+		if (load > max_load) {
+			mb_logf(
+				LOG_DEBUG, "admission: load per cpu %.2f over %.2f\n", load,
+				max_load);
+			allowed = false;
+		}
+	}
+
+	for (size_t ix = 0; allowed && ix < __PRESSURE_UPPER_BOUND; ix++) {
+		if (max_pressure[ix] < 0) {
+			continue;
+		}
+
+		double pressure = _read_pressure(psi_paths[ix]);
+		if (pressure > max_pressure[ix]) {
+			mb_logf(
+				LOG_DEBUG, "admission: %s pressure %.2f%% over %.2f%%\n",
+				pressure_names[ix], pressure, max_pressure[ix]);
+			allowed = false;
+		}
+	}
+
+	last_allowed = allowed;
+	return allowed;
+}
@@ -0,0 +1,29 @@
+/* admission.h ; mariebuild load and pressure aware admission control header
+ *
+ * Copyright (c) 2025, Marie Eckert
+ * Licensend under the BSD 3-Clause License.
+ */
+
+#ifndef ADMISSION_H
+#define ADMISSION_H
+
+#include <stdbool.h>
+
+#include "mcfg.h"
+
+/**
+ * @brief Load the thresholds from the /config/admission section. Without the
+ * section admission control is disabled.
+ * @return Success?
+ */
+bool mb_admission_load(mcfg_file_t *file);
+
+/**
+ * @brief Check if the system load and pressure allow starting another job.
+ * The values are sampled at most a few times per second.
+ * @return true if admission control is disabled or all values are below
+ * their thresholds
+ */
+bool mb_admission_allows(void);
+
+#endif /* #ifndef ADMISSION_H */
@@ -0,0 +1,360 @@
+/* board.c ; mariebuild live status board
+ *
+ * Copyright (c) 2025, Marie Eckert
+ * Licensend under the BSD 3-Clause License.
+ */
+
+#define _XOPEN_SOURCE 700
+#define _POSIX_C_SOURCE 200809L
+
+#include <errno.h>
+#include <signal.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+#include <fcntl.h>
+#include <sched.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "board.h"
+#include "logging.h"
+#include "stats.h"
+
+/* interval in which `mb top` redraws the board */
+#define TOP_INTERVAL_NS (500 * 1000 * 1000)
+
+/* Clears the terminal and moves the cursor to the top left */
+#define TOP_CLEAR_SCREEN "\x1b[H\x1b[2J"
+
+/* only mapped and written by the main thread */
+static board_t *board = NULL;
+
+/******** publishing ********/
+
+static void _write_begin(void) {
+	atomic_fetch_add_explicit(&board->seq, 1, memory_order_relaxed);
+	atomic_thread_fence(memory_order_release);
+}
+
+static void _write_end(void) {
+	atomic_fetch_add_explicit(&board->seq, 1, memory_order_release);
+}
+
+static void _copy_name(char *dest, size_t size, const char *src) {
+	snprintf(dest, size, "%s", src == NULL ? "" : src);
+}
+
+bool mb_board_open(const char *path) {
+	int fd = open(path, O_RDWR | O_CREAT, 0644);
+	if (fd < 0) {
+		mb_logf(
+			LOG_DEBUG, "could not open status board \"%s\": %s\n", path,
+			strerror(errno));
+		return false;
+	}
+
+	/* the file is not truncated first, a running `mb top` would fault on
+	 * its mapping */
+	void *mapping = MAP_FAILED;
+	if (ftruncate(fd, sizeof(board_t)) == 0) {
+		mapping = mmap(
+			NULL, sizeof(board_t), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	}
+	close(fd);
+
+	if (mapping == MAP_FAILED) {
+		mb_logf(
+			LOG_DEBUG, "could not map status board \"%s\": %s\n", path,
+			strerror(errno));
+		return false;
+	}
+
+	board = mapping;
+
+	_write_begin();
+	memset(&board->state, 0, sizeof(board->state));
+	board->state.magic = MB_BOARD_MAGIC;
+	board->state.version = MB_BOARD_VERSION;
+	board->state.pid = (int32_t)getpid();
+	board->state.started = mb_stats_now();
+	board->state.slots = 1;
+	_write_end();
+
+	return true;
+}
+
+void mb_board_close(int exit_status) {
+	if (board == NULL) {
+		return;
+	}
+
+	_write_begin();
+	board->state.finished = 1;
+	board->state.exit_status = exit_status;
+	board->state.running = 0;
+	board->state.queued = 0;
+	memset(board->state.jobs, 0, sizeof(board->state.jobs));
+	_write_end();
+
+	munmap(board, sizeof(board_t));
+	board = NULL;
+}
+
+void mb_board_detach(void) {
+	if (board == NULL) {
+		return;
+	}
+
+	munmap(board, sizeof(board_t));
+	board = NULL;
+}
+
+void mb_board_target(const char *target) {
+	if (board == NULL) {
+		return;
+	}
+
+	_write_begin();
+	_copy_name(board->state.target, MB_BOARD_NAME_SIZE, target);
+	_write_end();
+}
+
+void mb_board_c_rule(const char *c_rule) {
+	if (board == NULL) {
+		return;
+	}
+
+	_write_begin();
+	_copy_name(board->state.rule, MB_BOARD_NAME_SIZE, c_rule);
+	board->state.slots = 1;
+	_write_end();
+}
+
+void mb_board_slots(size_t slots) {
+	if (board == NULL) {
+		return;
+	}
+
+	_write_begin();
+	board->state.slots = slots;
+	_write_end();
+}
+
+void mb_board_job_queued(void) {
+	if (board == NULL) {
+		return;
+	}
+
+	_write_begin();
+	board->state.queued++;
+	_write_end();
+}
+
+void mb_board_jobs_batched(size_t count) {
+	if (board == NULL || count < 2) {
+		return;
+	}
+
+	_write_begin();
+	uint64_t merged = count - 1;
+	board->state.queued =
+		board->state.queued > merged ? board->state.queued - merged : 0;
+	_write_end();
+}
+
+void mb_board_job_spawned(const char *rule, const char *element, int pid) {
+	if (board == NULL) {
+		return;
+	}
+
+	board_state_t *state = &board->state;
+
+	_write_begin();
+	if (state->queued > 0) {
+		state->queued--;
+	}
+
+	if (pid > 0) {
+		state->running++;
+		for (size_t ix = 0; ix < MB_BOARD_MAX_JOBS; ix++) {
+			board_job_t *job = &state->jobs[ix];
+			if (job->pid == 0) {
+				job->pid = pid;
+				job->started = mb_stats_now();
+				_copy_name(job->rule, MB_BOARD_NAME_SIZE, rule);
+				_copy_name(job->element, MB_BOARD_ELEMENT_SIZE, element);
+				break;
+			}
+		}
+	}
+	_write_end();
+}
+
+void mb_board_job_finished(int pid, int status) {
+	if (board == NULL) {
+		return;
+	}
+
+	board_state_t *state = &board->state;
+
+	_write_begin();
+	state->completed++;
+	if (status != 0) {
+		state->failed++;
+	}
+
+	/* builtin actions (pid 0) finish without being spawned, jobs which could
+	 * not be started (pid -1) were never running */
+	if (pid == 0 && state->queued > 0) {
+		state->queued--;
+	} else if (pid > 0) {
+		state->running--;
+		for (size_t ix = 0; ix < MB_BOARD_MAX_JOBS; ix++) {
+			if (state->jobs[ix].pid == pid) {
+				state->jobs[ix].pid = 0;
+				break;
+			}
+		}
+	}
+	_write_end();
+}
+
+/******** mb top ********/
+
+/**
+ * @brief Take a consistent copy of the state of a board.
+ */
+static void _snapshot(const board_t *mapped, board_state_t *state) {
+	for (;;) {
+		uint64_t before =
+			atomic_load_explicit(&mapped->seq, memory_order_acquire);
+		if ((before & 1) == 0) {
+			memcpy(state, &mapped->state, sizeof(*state));
+			atomic_thread_fence(memory_order_acquire);
+
+			uint64_t after =
+				atomic_load_explicit(&mapped->seq, memory_order_relaxed);
+			if (before == after) {
+				return;
+			}
+		}
+
+		sched_yield();
+	}
+}
+
+static bool _owner_alive(const board_state_t *state) {
+	return kill(state->pid, 0) == 0 || errno == EPERM;
+}
+
+static double _seconds(uint64_t ns) {
+	return (double)ns / 1e9;
+}
+
+static void _render(const board_state_t *state) {
+	uint64_t now = mb_stats_now();
+	bool alive = _owner_alive(state);
+
+	if (state->finished) {
+		printf(
+			"mariebuild %d: build %s (exit status %d)\n", state->pid,
+			state->exit_status == 0 ? "succeeded" : "failed",
+			state->exit_status);
+	} else if (!alive) {
+		printf(
+			"mariebuild %d: exited without finishing the build\n", state->pid);
+	} else {
+		printf(
+			"mariebuild %d: target \"%s\", c_rule \"%s\", running for %.0fs\n",
+			state->pid, state->target, state->rule,
+			_seconds(now - state->started));
+	}
+
+	uint64_t used =
+		state->running < state->slots ? state->running : state->slots;
+	printf(
+		"jobs: %llu completed, %llu failed, %llu queued, %llu running\n",
+		(unsigned long long)state->completed,
+		(unsigned long long)state->failed, (unsigned long long)state->queued,
+		(unsigned long long)state->running);
+	printf(
+		"slots: %llu of %llu in use (%.0f%%)\n", (unsigned long long)used,
+		(unsigned long long)state->slots,
+		state->slots == 0 ? 0.0 : 100.0 * used / state->slots);
+
+	if (state->running == 0) {
+		return;
+	}
+
+	printf("\n  %8s %10s  %-20s %s\n", "pid", "elapsed", "rule", "element");
+	for (size_t ix = 0; ix < MB_BOARD_MAX_JOBS; ix++) {
+		const board_job_t *job = &state->jobs[ix];
+		if (job->pid == 0) {
+			continue;
+		}
+
+		printf(
+			"  %8d %9.1fs  %-20s %s\n", job->pid, _seconds(now - job->started),
+			job->rule, job->element);
+	}
+}
+
+int mb_board_top(const char *path) {
+	int fd = open(path, O_RDONLY);
+	if (fd < 0) {
+		mb_logf(
+			LOG_ERROR, "no status board at \"%s\": %s\n", path,
+			strerror(errno));
+		return 1;
+	}
+
+	struct stat st;
+	const board_t *mapped = MAP_FAILED;
+	if (fstat(fd, &st) == 0 && (size_t)st.st_size >= sizeof(board_t)) {
+		mapped = mmap(NULL, sizeof(board_t), PROT_READ, MAP_SHARED, fd, 0);
+	}
+	close(fd);
+
+	if (mapped == MAP_FAILED) {
+		mb_logf(LOG_ERROR, "\"%s\" is not a status board\n", path);
+		return 1;
+	}
+
+	board_state_t state;
+	_snapshot(mapped, &state);
+	if (state.magic != MB_BOARD_MAGIC || state.version != MB_BOARD_VERSION) {
+		mb_logf(
+			LOG_ERROR, "\"%s\" is not a status board of this version\n", path);
+		munmap((void *)mapped, sizeof(board_t));
+		return 1;
+	}
+
+	const struct timespec interval = {
+		.tv_sec = 0, .tv_nsec = TOP_INTERVAL_NS};
+	bool refresh = isatty(STDOUT_FILENO);
+
+	for (;;) {
+		if (refresh) {
+			printf(TOP_CLEAR_SCREEN);
+		}
+
+		_render(&state);
+		fflush(stdout);
+
+		if (!refresh || state.finished || !_owner_alive(&state)) {
+			break;
+		}
+
+		nanosleep(&interval, NULL);
+		_snapshot(mapped, &state);
+	}
+
+	munmap((void *)mapped, sizeof(board_t));
+	return 0;
+}
@@ -0,0 +1,115 @@
+/* board.h ; mariebuild live status board header
+ *
+ * Copyright (c) 2025, Marie Eckert
+ * Licensend under the BSD 3-Clause License.
+ */
+
+#ifndef BOARD_H
+#define BOARD_H
+
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#define MB_BOARD_FILE ".mb_status"
+
+/* "mbst" */
+#define MB_BOARD_MAGIC 0x7473626dU
+
+/* Bumped whenever the layout of the board changes */
+#define MB_BOARD_VERSION 1
+
+/* running jobs listed on the board, any further ones are only counted */
+#define MB_BOARD_MAX_JOBS 64
+
+#define MB_BOARD_NAME_SIZE 48
+#define MB_BOARD_ELEMENT_SIZE 80
+
+typedef struct board_job {
+	/* 0 if the slot is unused */
+	int32_t pid;
+	uint32_t reserved;
+
+	/* CLOCK_MONOTONIC, nanoseconds */
+	uint64_t started;
+	char rule[MB_BOARD_NAME_SIZE];
+	char element[MB_BOARD_ELEMENT_SIZE];
+} board_job_t;
+
+typedef struct board_state {
+	uint32_t magic;
+	uint32_t version;
+	int32_t pid;
+
+	/* set once the build is over */
+	int32_t finished;
+	int32_t exit_status;
+	uint32_t reserved;
+
+	/* CLOCK_MONOTONIC, nanoseconds */
+	uint64_t started;
+
+	/* jobs queued but not started yet */
+	uint64_t queued;
+	uint64_t running;
+	uint64_t completed;
+	uint64_t failed;
+
+	/* process slots of the current c_rule */
+	uint64_t slots;
+
+	char target[MB_BOARD_NAME_SIZE];
+	char rule[MB_BOARD_NAME_SIZE];
+
+	board_job_t jobs[MB_BOARD_MAX_JOBS];
+} board_state_t;
+
+/* The layout of the shared memory file. The state is guarded by a seqlock:
+ * seq is odd while mariebuild updates the state, readers copy the state and
+ * retry if seq was odd or changed in the meantime. */
+typedef struct board {
+	_Atomic uint64_t seq;
+	board_state_t state;
+} board_t;
+
+/**
+ * @brief Publish the state of this build in a file which is mapped into
+ * memory. Updating the board never blocks, it only writes to memory.
+ * @return Success? Without a board the build still runs
+ */
+bool mb_board_open(const char *path);
+
+/**
+ * @brief Mark the build as finished and unmap the board. The file is kept,
+ * so `mb top` can show how the last build ended.
+ */
+void mb_board_close(int exit_status);
+
+/**
+ * @brief Unmap the board without marking the build as finished, for forked
+ * children which must not publish on the board of their parent.
+ */
+void mb_board_detach(void);
+
+/* Fed by the events, see events.h */
+void mb_board_target(const char *target);
+void mb_board_c_rule(const char *c_rule);
+void mb_board_job_queued(void);
+void mb_board_jobs_batched(size_t count);
+void mb_board_job_spawned(const char *rule, const char *element, int pid);
+void mb_board_job_finished(int pid, int status);
+
+/**
+ * @brief Set the amount of process slots of the running c_rule.
+ */
+void mb_board_slots(size_t slots);
+
+/**
+ * @brief Show the board of a build, refreshed until the build finished if
+ * stdout is a terminal, once otherwise.
+ * @return 0 on success
+ */
+int mb_board_top(const char *path);
+
+#endif /* #ifndef BOARD_H */
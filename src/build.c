@@ -4,18 +4,46 @@
  * Licensend under the BSD 3-Clause License.
  */
 
+#define _XOPEN_SOURCE 700
+#define _POSIX_C_SOURCE 200809L
+
+#include <errno.h>
+#include <signal.h>
 #include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include <sys/wait.h>
+#include <unistd.h>
 
+#include "accounting.h"
+#include "actions.h"
+#include "admission.h"
+#include "board.h"
 #include "build.h"
+#include "capture.h"
 #include "cptrlist.h"
+#include "events.h"
+#include "history.h"
+#include "jobserver.h"
 #include "logging.h"
 #include "mcfg.h"
 #include "mcfg_util.h"
+#include "pools.h"
+#include "progress.h"
+#include "restat.h"
+#include "signals.h"
+#include "stats.h"
 #include "stringutil.h"
 #include "target.h"
+#include "topology.h"
 #include "types.h"
+#include "workers.h"
 #include "xmem.h"
 
+/* interval in which the target processes are checked for having exited */
+#define TARGET_POLL_NS (10ull * 1000 * 1000)
+
 config_t default_config = {
 	.build_type = BUILD_TYPE_INCREMENTAL,
 	.default_target = "debug",
@@ -113,13 +141,332 @@ config_t mb_load_configuration(mcfg_file_t file, args_t args) {
 	return ret;
 }
 
+/**
+ * @brief Decide if the progress is shown as a status line instead of the full
+ * log. By default it is if stderr is a terminal, unless the output of jobs
+ * goes to the terminal directly or a verbosity below LOG_INFO was asked for.
+ */
+static bool _use_status_line(args_t args) {
+	switch (args.progress_mode) {
+		case PROGRESS_MODE_LINE:
+			return true;
+		case PROGRESS_MODE_PLAIN:
+			return false;
+		default:
+			/* the processes of several targets can not share one line */
+			return args.targets.size <= 1 && mb_progress_supported() &&
+				   args.output_mode != OUTPUT_MODE_LIVE &&
+				   !(args.verbosity_overriden && args.verbosity < LOG_INFO);
+	}
+}
+
+static char *_join_target_names(const CPtrList *targets) {
+	size_t size = 1;
+	for (size_t ix = 0; ix < targets->size; ix++) {
+		size += strlen(targets->items[ix]) + 1;
+	}
+
+	char *names = XCALLOC(size, 1);
+	for (size_t ix = 0; ix < targets->size; ix++) {
+		if (ix > 0) {
+			strcat(names, ",");
+		}
+		strcat(names, targets->items[ix]);
+	}
+
+	return names;
+}
+
+/**
+ * @brief Count in how many of the closures a target appears.
+ */
+static size_t _closure_count(CPtrList *closures, size_t count, char *name) {
+	size_t found = 0;
+	for (size_t ix = 0; ix < count; ix++) {
+		if (cptrlist_find(&closures[ix], name, &string_cptrlist_search) !=
+			-1) {
+			found++;
+		}
+	}
+
+	return found;
+}
+
+/**
+ * @brief Run one of several requested targets in a forked child and exit
+ * with its result. The child writes its own history and accounting.
+ */
+static _Noreturn void _target_child(mcfg_file_t *file, config_t cfg) {
+	setpgid(0, 0);
+	mb_log_after_fork();
+	mb_board_detach();
+
+	int ret = mb_begin_build(file, cfg);
+	mb_workers_stop();
+	mb_history_save(MB_HISTORY_FILE);
+	mb_restat_save(MB_RESTAT_FILE);
+	mb_accounting_print();
+	mb_log_shutdown();
+	_exit(ret);
+}
+
+/**
+ * @brief Terminate the target processes still running and reap them. A
+ * target process cancels its own jobs when it receives SIGTERM, which takes
+ * up to two grace periods, so it is only killed after that.
+ */
+static void _cancel_targets(pid_t *pids, size_t count) {
+	const struct timespec poll_interval = {
+		.tv_sec = 0, .tv_nsec = TARGET_POLL_NS};
+
+	for (size_t ix = 0; ix < count; ix++) {
+		if (pids[ix] > 0) {
+			kill(-pids[ix], SIGTERM);
+		}
+	}
+
+	uint64_t deadline = mb_stats_now() + MB_TARGET_CANCEL_GRACE_NS;
+	for (;;) {
+		size_t running = 0;
+		for (size_t ix = 0; ix < count; ix++) {
+			if (pids[ix] <= 0) {
+				continue;
+			}
+
+			pid_t res = waitpid(pids[ix], NULL, WNOHANG);
+			if (res == 0 || (res < 0 && errno == EINTR)) {
+				running++;
+				continue;
+			}
+
+			mb_unregister_target_group(pids[ix]);
+			pids[ix] = 0;
+		}
+
+		if (running == 0) {
+			return;
+		}
+
+		if (mb_stats_now() >= deadline) {
+			break;
+		}
+
+		nanosleep(&poll_interval, NULL);
+	}
+
+	for (size_t ix = 0; ix < count; ix++) {
+		if (pids[ix] <= 0) {
+			continue;
+		}
+
+		kill(-pids[ix], SIGKILL);
+		while (waitpid(pids[ix], NULL, 0) < 0 && errno == EINTR) {
+		}
+
+		mb_unregister_target_group(pids[ix]);
+		pids[ix] = 0;
+	}
+}
+
+/**
+ * @brief Build several targets at once. Targets required by more than one of
+ * them run first in this process, then every requested target is built by a
+ * forked child, since the target_ fields of a target are global to the build
+ * file. The children draw their jobs beyond the first from one jobserver.
+ * @return The highest exit status of the targets
+ */
+static int _build_targets(
+	mcfg_file_t *file,
+	config_t cfg,
+	const CPtrList *names) {
+	mcfg_sector_t *sector = mcfg_get_sector(file, "targets");
+	CPtrList *closures = XCALLOC(names->size, sizeof(CPtrList));
+	int ret = 0;
+
+	for (size_t ix = 0; ix < names->size; ix++) {
+		cptrlist_init(&closures[ix], 4, 4);
+		mcfg_section_t *target =
+			sector == NULL ? NULL : mcfg_get_section(sector, names->items[ix]);
+		if (target == NULL) {
+			mb_logf(
+				LOG_ERROR, "target \"%s\" is not declared within build file!\n",
+				(char *)names->items[ix]);
+			ret = 1;
+			continue;
+		}
+
+		mb_collect_required_targets(file, target, &closures[ix]);
+	}
+
+	if (ret != 0) {
+		goto exit;
+	}
+
+	/* shared prerequisites run once, before the targets split up */
+	CPtrList history;
+	cptrlist_init(&history, 1, 4);
+	for (size_t ix = 0; ix < names->size && ret == 0; ix++) {
+		for (size_t jx = 0; jx < closures[ix].size; jx++) {
+			char *name = closures[ix].items[jx];
+			if (_closure_count(closures, names->size, name) < 2) {
+				continue;
+			}
+
+			int status = mb_run_target(
+				file, mcfg_get_section(sector, name), &history, cfg);
+			ret = status > ret ? status : ret;
+			if (ret != 0 && !cfg.ignore_failures) {
+				break;
+			}
+		}
+	}
+	cptrlist_destroy(&history);
+
+	if (ret != 0 && !cfg.ignore_failures) {
+		goto exit;
+	}
+
+	/* the children continue from the state written here */
+	mb_history_save(MB_HISTORY_FILE);
+	mb_restat_save(MB_RESTAT_FILE);
+	mb_accounting_print();
+	mb_accounting_free();
+
+	size_t jobs = mb_default_jobs();
+	if (!mb_jobserver_create(jobs > names->size ? jobs - names->size : 0)) {
+		ret = 1;
+		goto exit;
+	}
+
+	pid_t *pids = XCALLOC(names->size, sizeof(pid_t));
+	mb_log_before_fork();
+	for (size_t ix = 0; ix < names->size; ix++) {
+		pids[ix] = fork();
+		if (pids[ix] == 0) {
+			cfg.target = names->items[ix];
+			_target_child(file, cfg);
+		}
+
+		if (pids[ix] > 0) {
+			setpgid(pids[ix], pids[ix]);
+		}
+	}
+	mb_log_after_fork();
+
+	size_t running = 0;
+	for (size_t ix = 0; ix < names->size; ix++) {
+		if (pids[ix] < 0) {
+			mb_logf(
+				LOG_ERROR, "could not fork for target \"%s\"\n",
+				(char *)names->items[ix]);
+			ret = 1;
+			continue;
+		}
+
+		mb_register_target_group(pids[ix]);
+		running++;
+	}
+
+	/* only the target processes are waited for, workers started by the
+	 * shared prerequisites are children of this process as well */
+	const struct timespec poll_interval = {
+		.tv_sec = 0, .tv_nsec = TARGET_POLL_NS};
+	while (running > 0) {
+		bool reaped = false;
+		for (size_t ix = 0; ix < names->size && running > 0; ix++) {
+			if (pids[ix] <= 0) {
+				continue;
+			}
+
+			int status = 0;
+			pid_t res = waitpid(pids[ix], &status, WNOHANG);
+			if (res == 0 || (res < 0 && errno == EINTR)) {
+				continue;
+			}
+
+			reaped = true;
+			mb_unregister_target_group(pids[ix]);
+			pids[ix] = 0;
+			running--;
+
+			int code = res > 0 && WIFEXITED(status) ? WEXITSTATUS(status) : 1;
+			if (code == 0) {
+				mb_logf(
+					LOG_INFO, "target \"%s\" succeeded\n",
+					(char *)names->items[ix]);
+				continue;
+			}
+
+			ret = code > ret ? code : ret;
+			mb_logf(
+				LOG_ERROR, "target \"%s\" failed\n",
+				(char *)names->items[ix]);
+			if (!cfg.ignore_failures) {
+				_cancel_targets(pids, names->size);
+				running = 0;
+			}
+		}
+
+		if (!reaped && running > 0) {
+			nanosleep(&poll_interval, NULL);
+		}
+	}
+
+	XFREE(pids);
+	mb_jobserver_close();
+
+exit:
+	for (size_t ix = 0; ix < names->size; ix++) {
+		cptrlist_destroy(&closures[ix]);
+	}
+	XFREE(closures);
+
+	return ret;
+}
+
 int mb_start(args_t args) {
 	cptrlist_init(&default_config.public_targets, 1, 8);
 	cptrlist_append(&default_config.public_targets, strdup("debug"));
 
+	if (args.report) {
+		return mb_history_report(MB_HISTORY_FILE, args.regression_threshold);
+	}
+
+	if (args.top) {
+		return mb_board_top(MB_BOARD_FILE);
+	}
+
+	mb_stats_enabled = args.stats;
+	mb_output_mode = args.output_mode;
+
+	bool status_line = _use_status_line(args);
+	char *log_file = args.log_file;
+	if (log_file == NULL && status_line) {
+		log_file = MB_LOG_FILE;
+	}
+
+	if (log_file != NULL && !mb_log_open_file(log_file)) {
+		return 1;
+	}
+
+	if (status_line) {
+		mb_progress_enable();
+	}
+
+	if (args.events_file != NULL) {
+		if (!mb_events_open_file(args.events_file)) {
+			return 1;
+		}
+	} else if (args.events_fd >= 0) {
+		if (!mb_events_open_fd(args.events_fd)) {
+			return 1;
+		}
+	}
+
 	mb_log(LOG_DEBUG, "using MCFG/2 " MCFG_2_VERSION "\n");
 
-	mcfg_parse_result_t parse_result = mcfg_parse_from_file(args.buildfile);
+	mcfg_parse_result_t parse_result =
+		STATS_TIMED(STAT_PARSE, mcfg_parse_from_file(args.buildfile));
 	if (parse_result.err != MCFG_OK) {
 		mb_logf(
 			LOG_ERROR, "buildfile parsing failed: %s (%d)\n",
@@ -137,20 +484,56 @@ int mb_start(args_t args) {
 		return 1;
 	}
 
+	if (!mb_pools_load(&file) || !mb_admission_load(&file) ||
+		!mb_topology_load(&file)) {
+		return 1;
+	}
+
 	config_t cfg = mb_load_configuration(file, args);
-	cfg.target = args.target == NULL ? cfg.default_target : args.target;
+	cfg.target = args.targets.size == 0 ? cfg.default_target
+										: args.targets.items[0];
 	cfg.ignore_failures = args.keep_going;
 	cfg.always_force = args.force;
 
-	int return_code = mb_begin_build(&file, cfg);
+	char *target_names = args.targets.size > 1
+							 ? _join_target_names(&args.targets)
+							 : strdup(cfg.target);
+
+	mb_board_open(MB_BOARD_FILE);
+	mb_event_build_start(args.buildfile, target_names);
+
+	int return_code = args.targets.size > 1
+						  ? _build_targets(&file, cfg, &args.targets)
+						  : mb_begin_build(&file, cfg);
+	mb_workers_stop();
+	mb_event_build_end(return_code);
+	mb_board_close(return_code);
+	mb_history_save(MB_HISTORY_FILE);
+	mb_history_release();
+	mb_restat_save(MB_RESTAT_FILE);
+	mb_restat_free();
+	mb_actions_free();
+	mb_targets_free();
+	XFREE(target_names);
+
+	mb_accounting_print();
+	mb_accounting_free();
+
 	if (return_code != 0) {
 		mb_log(LOG_ERROR, "build failed!\n");
 	} else {
 		mb_log(LOG_INFO, "build succeeded!\n");
 	}
 
+	if (args.stats) {
+		mb_stats_print();
+	}
+
 	cptrlist_destroy(&cfg.public_targets);
+	mb_pools_free();
+	mb_topology_free();
 	mcfg_free_file(file);
+	mb_events_close();
 	return return_code;
 }
 
@@ -7,16 +7,26 @@
 #ifndef BUILD_H
 #define BUILD_H
 
+#include "cptrlist.h"
 #include "logging.h"
 #include "mcfg.h"
 #include "types.h"
 
 typedef struct args {
 	char *buildfile;
-	char *target;
+	CPtrList targets; /* heap allocated names, empty for the default */
 	bool force;
 	bool no_splash;
 	bool keep_going; /* they're hot on your heels! */
+	bool stats;
+	int events_fd;
+	char *events_file;
+	bool report;
+	bool top;
+	double regression_threshold;
+	output_mode_t output_mode;
+	progress_mode_t progress_mode;
+	char *log_file;
 	log_level_t verbosity;
 	bool verbosity_overriden; /* helper flag for verbosity */
 } args_t;
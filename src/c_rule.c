@@ -5,36 +5,72 @@
  */
 
 #define _XOPEN_SOURCE 700
-#define _POSIX_C_SOURCE 2
+#define _POSIX_C_SOURCE 200809L
 
 #include <errno.h>
+#include <limits.h>
 #include <stdbool.h>
+#include <stddef.h>
 #include <stdio.h>
 #include <string.h>
+#include <time.h>
 
 #include <sys/stat.h>
 #include <sys/types.h>
 #include <sys/wait.h>
+#include <unistd.h>
 
+#include "accounting.h"
+#include "actions.h"
+#include "admission.h"
+#include "board.h"
 #include "c_rule.h"
+#include "cptrlist.h"
+#include "events.h"
 #include "executor.h"
+#include "history.h"
+#include "jobserver.h"
 #include "logging.h"
 #include "mcfg.h"
 #include "mcfg_format.h"
 #include "mcfg_util.h"
+#include "pools.h"
+#include "restat.h"
+#include "stats.h"
+#include "topology.h"
 #include "types.h"
+#include "workers.h"
 #include "xmem.h"
 
-#define FMT_ERR_CHECK(fmt_res, tag)                                       \
-	do {                                                                  \
-		if (fmt_res.err != MCFG_FMT_OK) {                                 \
-			mb_logf(                                                      \
-				LOG_ERROR,                                                \
-				"[c_rule:%s] mcfg_format_field_embeds failed: %d\n", tag, \
-				fmt_res.err);                                             \
-			return fmt_res.err;                                           \
-		}                                                                 \
-	} while (0)
+/* how long to sleep while a job is only held back by admission control */
+#define ADMISSION_WAIT_NS 10000000
+
+/* how often the last jobs of a rule are checked for a failure to cancel the
+ * others on, also how often running jobs are checked while waiting for a
+ * slot or room in a pool */
+#define FINISH_POLL_NS 1000000
+
+/* appended to a chunk output for the file listing the inputs of the chunk */
+#define CHUNK_MEMBERS_SUFFIX ".inputs"
+
+/* average number of inputs in a unity group if the rule does not set one */
+#define UNITY_DEFAULT_GROUP_SIZE 8
+
+/**
+ * @brief Log the error of a failed format call, the caller cleans up and
+ * returns fmt_res.err.
+ * @return true if formatting failed
+ */
+static bool _fmt_failed(mcfg_fmt_res_t fmt_res, const char *tag) {
+	if (fmt_res.err == MCFG_FMT_OK) {
+		return false;
+	}
+
+	mb_logf(
+		LOG_ERROR, "[c_rule:%s] mcfg_format_field_embeds failed: %d\n", tag,
+		fmt_res.err);
+	return true;
+}
 
 #define ADD_DYNFIELD(file, name)                                             \
 	do {                                                                     \
@@ -56,10 +92,25 @@ struct io_fields {
 	mcfg_field_t *output;
 };
 
+/**
+ * @brief Append a word followed by a space to a string.
+ * @param wix The write index, advanced past the space
+ */
+static void
+_append_word(char **dest, size_t *wix, size_t *dest_size, char *word) {
+	*wix = _append_str(dest, *wix, dest_size, word);
+	_append_char(dest, *wix, dest_size, ' ');
+	(*wix)++;
+}
+
 size_t _size_t_max(size_t a, size_t b) {
 	return a > b ? a : b;
 }
 
+static size_t _size_t_min(size_t a, size_t b) {
+	return a < b ? a : b;
+}
+
 void _append_char(char **dest, size_t wix, size_t *dest_size, char chr) {
 	if (dest == NULL || *dest == NULL) {
 		return;
@@ -92,6 +143,8 @@ size_t _append_str(char **dest, size_t wix, size_t *dest_size, char *src) {
 }
 
 bool is_file_newer(char *file1, char *file2) {
+	uint64_t stats_begin = mb_stats_begin();
+
 	FILE *f_1 = fopen(file1, "r");
 	FILE *f_2 = fopen(file2, "r");
 
@@ -147,6 +200,8 @@ exit:
 		fclose(f_2);
 	}
 
+	mb_stats_end(STAT_FILE_NEWER, stats_begin);
+
 	return f_1_mtime > f_2_mtime;
 }
 
@@ -288,66 +343,177 @@ int mb_run_c_rules(
 /**
  * @brief helper function to find a position within an array of process_t
  * which can be reused for a new process. A position can be reused
- * if the associated process (via process.pid) has exited.
- * The script will be deleted from the system and the location string freed.
+ * if the associated process (via process.pid) has exited, the pool of the
+ * job has room for it, admission control allows another job and, if other
+ * jobs are running, a jobserver token could be taken. Processes are reaped
+ * using mb_reap_process until all of that is the case.
  *
  * @param max_procs The amount of processes in the processes_array.
  * @param process_ix Pointer to the output variable for the reusable slot.
+ * @param options The options of the job which is going to be started, token
+ * is set if a jobserver token was taken for it. The room of the job in its
+ * pool is taken as well, the caller releases both if it does not start it.
  *
- * @return The exit code of the process which freed up the slot
+ * @return The highest exit code of the processes reaped while waiting
  */
 int _find_process_slot(
 	const size_t max_procs,
-	const process_t *processes,
+	process_t *processes,
 	size_t *used_processes,
-	size_t *process_ix) {
-	bool found = false;
-	int exit_status = 0;
-
-	/* previously unused process slot */
-	for (size_t pix = 0; pix < max_procs; pix++) {
-		if (processes[pix].pid == 0) {
-			*process_ix = pix;
+	size_t *process_ix,
+	exec_options_t *options) {
+	uint64_t stats_begin = mb_stats_begin();
+	int ret = 0;
+
+	const struct timespec admission_wait = {
+		.tv_sec = 0, .tv_nsec = ADMISSION_WAIT_NS};
+	const struct timespec poll_interval = {
+		.tv_sec = 0, .tv_nsec = FINISH_POLL_NS};
+
+	for (;;) {
+		size_t running = 0;
+		size_t free_ix = max_procs;
+		for (size_t pix = 0; pix < max_procs; pix++) {
+			if (processes[pix].pid != 0) {
+				running++;
+			} else if (free_ix == max_procs) {
+				free_ix = pix;
+			}
+		}
+
+		/* admission control never stops the first job so the build always
+		 * makes progress */
+		bool admitted = running == 0 || mb_admission_allows();
+
+		/* the pool may be shared with the processes of other targets, so its
+		 * room is taken right away instead of only being checked */
+		bool pool_room = free_ix < max_procs && admitted &&
+						 mb_pool_try_acquire(options->pool, options->weight);
+
+		/* like admission control, the jobserver never stops the first job
+		 * of a process */
+		bool ready = pool_room;
+		bool token_free = true;
+		options->token = false;
+		if (ready && running > 0) {
+			token_free = mb_jobserver_acquire(&options->token);
+			ready = token_free;
+		}
+
+		if (!ready && pool_room) {
+			mb_pool_release(options->pool, options->weight);
+		}
+
+		if (ready) {
+			*process_ix = free_ix;
 			*used_processes += 1;
-			return 0;
+			mb_stats_end(STAT_FIND_SLOT, stats_begin);
+			return ret;
+		}
+
+		/* wait for a process to exit */
+		bool reaped = false;
+		for (size_t pix = 0; pix < max_procs; pix++) {
+			int exit_status;
+			if (mb_reap_process(&processes[pix], false, &exit_status)) {
+				ret = ret > exit_status ? ret : exit_status;
+				reaped = true;
+			}
+		}
+
+		/* nothing but the pressure or other processes to wait for, don't
+		 * spin */
+		if (free_ix < max_procs && (!admitted || !token_free)) {
+			nanosleep(&admission_wait, NULL);
+		} else if (!reaped) {
+			/* every slot is busy or the pool is full, neither changes until
+			 * one of our jobs exits */
+			nanosleep(&poll_interval, NULL);
 		}
 	}
+}
 
-	/* wait for slot to free up */
-	while (!found) {
+/**
+ * @brief Wait for the remaining processes of a rule to exit. Without
+ * --keep-going the first one failing cancels the others instead of waiting
+ * for them to finish.
+ * @param failed Exit status of a job of the rule which already failed, the
+ * others are then cancelled right away
+ * @return The exit status of the last failing process, 0 if none failed
+ */
+static int _finish_processes(
+	process_t *processes,
+	size_t max_procs,
+	bool keep_going,
+	int failed) {
+	const struct timespec poll_interval = {
+		.tv_sec = 0, .tv_nsec = FINISH_POLL_NS};
+	int ret = failed;
+
+	for (;;) {
+		size_t running = 0;
 		for (size_t pix = 0; pix < max_procs; pix++) {
-			int stat = 0;
-			if (waitpid(processes[pix].pid, &stat, WNOHANG) <= 0) {
+			int stat;
+			if (processes[pix].pid == 0) {
 				continue;
 			}
 
-			found = true;
-			exit_status = WEXITSTATUS(stat);
-			if (exit_status != 0) {
-				break;
+			if (!mb_reap_process(&processes[pix], keep_going, &stat)) {
+				running++;
+			} else if (stat != 0) {
+				ret = stat;
 			}
+		}
 
-			mb_remove_script(processes[pix].location);
-			XFREE(processes[pix].location);
-			*process_ix = pix;
-			break;
+		if (ret != 0 && !keep_going) {
+			mb_cancel_processes(processes, max_procs);
+			return ret;
+		}
+
+		if (running == 0) {
+			return ret;
 		}
-	}
 
-	return exit_status;
+		nanosleep(&poll_interval, NULL);
+	}
 }
 
-int run_singular(
-	mcfg_file_t *file,
-	mcfg_section_t *rule,
-	const config_t cfg,
-	build_type_t build_type) {
-	mcfg_field_t *field_exec = mcfg_get_field(rule, "exec");
-	if (field_exec == NULL || field_exec->data == NULL) {
-		mb_log(LOG_ERROR, "c_rule missing field \"exec\"\n");
-		return 1;
+/* An element of a singular rule which has to be built */
+typedef struct job {
+	/* position in the input list, keeps the order of equal cost jobs */
+	size_t index;
+
+	char *raw_in;
+	char *raw_out;
+	char *in;
+	char *out;
+
+	/* estimated duration, only meaningful relative to other jobs */
+	uint64_t cost;
+
+	/* the output before the job ran, only taken for restat rules */
+	restat_snapshot_t before;
+} job_t;
+
+static int _compare_jobs(const void *a, const void *b) {
+	const job_t *ja = a;
+	const job_t *jb = b;
+
+	if (ja->cost != jb->cost) {
+		return ja->cost < jb->cost ? 1 : -1;
 	}
 
+	return (ja->index > jb->index) - (ja->index < jb->index);
+}
+
+/**
+ * @brief Get the input_format and output_format fields of a rule.
+ * @return Success?
+ */
+static bool _get_io_formats(
+	mcfg_section_t *rule,
+	char **input_format,
+	char **output_format) {
 	mcfg_field_t *field_input_format = mcfg_get_field(rule, "input_format");
 	mcfg_field_t *field_output_format = mcfg_get_field(rule, "output_format");
 
@@ -355,7 +521,7 @@ int run_singular(
 		mb_logf(
 			LOG_ERROR, "c_rule missing field \"%s\"!\n",
 			field_input_format == NULL ? "input_format" : "output_format");
-		return 1;
+		return false;
 	} else if (
 		field_input_format->type != TYPE_STRING ||
 		field_output_format->type != TYPE_STRING) {
@@ -363,16 +529,238 @@ int run_singular(
 			LOG_ERROR, "invalid datatype for field \"%s\"! Expected str\n",
 			field_input_format->type != TYPE_STRING ? "input_format"
 													: "output_format");
-		return 1;
+		return false;
 	}
 
-	char *input_format = mcfg_data_as_string(*field_input_format);
-	char *output_format = mcfg_data_as_string(*field_output_format);
+	*input_format = mcfg_data_as_string(*field_input_format);
+	*output_format = mcfg_data_as_string(*field_output_format);
 
-	if (input_format == NULL || output_format == NULL) {
+	if (*input_format == NULL || *output_format == NULL) {
 		mb_logf(
 			LOG_ERROR, "field \"%s\" is missing data!\n",
-			input_format == NULL ? "input_format" : "output_format");
+			*input_format == NULL ? "input_format" : "output_format");
+		return false;
+	}
+
+	return true;
+}
+
+/**
+ * @brief Read the max_procs field of a rule, defaults to mb_default_jobs.
+ * @return Success?
+ */
+static bool _load_max_procs(mcfg_section_t *rule, size_t *max_procs) {
+	*max_procs = mb_default_jobs();
+
+	mcfg_field_t *field_max_procs = mcfg_get_field(rule, "max_procs");
+	if (field_max_procs == NULL) {
+		return true;
+	}
+
+	if (field_max_procs->type != TYPE_U8) {
+		mb_log(LOG_ERROR, "field \"max_procs\" should be of type u8\n");
+		return false;
+	}
+
+	*max_procs = mcfg_data_as_u8(*field_max_procs);
+	if (*max_procs == 0) {
+		mb_log(LOG_ERROR, "field \"max_procs\" has to be at least 1\n");
+		return false;
+	}
+
+	return true;
+}
+
+/**
+ * @brief Join a string field of consecutive jobs into a space separated list.
+ * @param offset The offset of the field in job_t
+ */
+static char *_join_jobs(job_t *jobs, size_t count, size_t offset) {
+	size_t size = 16;
+	size_t wix = 0;
+	char *joined = XMALLOC(size);
+
+	for (size_t ix = 0; ix < count; ix++) {
+		char *str = *(char **)((char *)&jobs[ix] + offset);
+		_append_word(&joined, &wix, &size, str);
+	}
+
+	/* replace the trailing space */
+	_append_char(&joined, wix - 1, &size, 0);
+	return joined;
+}
+
+/**
+ * @brief Read a positive count like chunk_size from a rule.
+ * @param value Output for the count, left untouched if the field is missing
+ * @return Success? A missing field is a success.
+ */
+static bool _load_count(mcfg_section_t *rule, char *name, uint64_t *value) {
+	mcfg_field_t *field = mcfg_get_field(rule, name);
+	if (field == NULL) {
+		return true;
+	}
+
+	char *raw = mcfg_data_to_string(*field);
+	uint64_t count;
+	bool ok = mb_parse_amount(raw, &count) && count > 0;
+	XFREE(raw);
+
+	if (!ok) {
+		mb_logf(LOG_ERROR, "field \"%s\" should be a positive number\n", name);
+		return false;
+	}
+
+	*value = count;
+	return true;
+}
+
+/**
+ * @brief Read the restat field of a rule.
+ * @return Success?
+ */
+static bool _load_restat(mcfg_section_t *rule, bool *restat) {
+	*restat = false;
+
+	mcfg_field_t *field_restat = mcfg_get_field(rule, "restat");
+	if (field_restat == NULL) {
+		return true;
+	}
+
+	if (field_restat->type != TYPE_BOOL) {
+		mb_log(LOG_ERROR, "field \"restat\" should be of type bool\n");
+		return false;
+	}
+
+	*restat = mcfg_data_as_bool(*field_restat);
+	return true;
+}
+
+/**
+ * @brief Read the worker and worker_instances fields of a rule. The worker
+ * command is formatted into the exec options, the amount of instances caps
+ * max_procs.
+ * @param max_procs The amount of processes of the rule, NULL if it runs only
+ * a single job
+ * @return Success? A missing field is a success.
+ */
+static bool _load_worker(
+	mcfg_file_t *file,
+	mcfg_section_t *rule,
+	mcfg_path_t pathrel,
+	exec_options_t *options,
+	size_t *max_procs) {
+	options->worker_command = NULL;
+
+	mcfg_field_t *field_worker = mcfg_get_field(rule, "worker");
+	if (field_worker == NULL) {
+		return true;
+	}
+
+	if (field_worker->type != TYPE_STRING) {
+		mb_log(LOG_ERROR, "field \"worker\" should be of type str\n");
+		return false;
+	}
+
+	uint64_t instances = max_procs != NULL ? *max_procs : 1;
+	if (!_load_count(rule, "worker_instances", &instances)) {
+		return false;
+	}
+
+	mcfg_fmt_res_t fmt_res = STATS_TIMED(
+		STAT_FORMAT, mcfg_format_field_embeds(*field_worker, *file, pathrel));
+	if (_fmt_failed(fmt_res, "worker")) {
+		return false;
+	}
+
+	options->worker_command = fmt_res.formatted;
+	if (max_procs != NULL && instances < *max_procs) {
+		*max_procs = (size_t)instances;
+	}
+
+	return true;
+}
+
+static void _unload_worker(exec_options_t *options) {
+	if (options->worker_command != NULL) {
+		XFREE(options->worker_command);
+	}
+	options->worker_command = NULL;
+}
+
+static uint64_t _file_size(char *path) {
+	struct stat st;
+	if (stat(path, &st) != 0) {
+		return 0;
+	}
+
+	return (uint64_t)st.st_size;
+}
+
+/**
+ * @brief Sort the jobs of a rule so the longest ones are started first, this
+ * keeps a single long job from being the tail of the rule. The duration of a
+ * job is estimated using the median of previous runs from the build history,
+ * jobs without a history are estimated by the size of their input file.
+ */
+static void _order_jobs(const char *rule, job_t *jobs, size_t job_count) {
+	history_t *history = mb_history_previous();
+
+	/* used to convert input sizes into durations */
+	double known_ns = 0;
+	double known_bytes = 0;
+
+	size_t with_history = 0;
+	for (size_t ix = 0; ix < job_count; ix++) {
+		history_entry_t *entry =
+			mb_history_find(history, rule, jobs[ix].raw_in);
+		uint64_t median = entry == NULL ? 0 : mb_history_median_wall(entry);
+
+		if (median == 0) {
+			continue;
+		}
+
+		jobs[ix].cost = median;
+		known_ns += median;
+		known_bytes += _file_size(jobs[ix].in);
+		with_history++;
+	}
+
+	double ns_per_byte = known_bytes > 0 ? known_ns / known_bytes : 1;
+
+	for (size_t ix = 0; ix < job_count; ix++) {
+		if (jobs[ix].cost == 0) {
+			jobs[ix].cost = (uint64_t)(_file_size(jobs[ix].in) * ns_per_byte);
+		}
+	}
+
+	mb_logf(
+		LOG_DEBUG, "ordering %zu jobs longest first, %zu with history\n",
+		job_count, with_history);
+
+	qsort(jobs, job_count, sizeof(job_t), &_compare_jobs);
+}
+
+int run_singular(
+	mcfg_file_t *file,
+	mcfg_section_t *rule,
+	const config_t cfg,
+	build_type_t build_type) {
+	/* builtin actions run before exec, which is optional with them */
+	mcfg_field_t *field_actions = mcfg_get_field(rule, "actions");
+	mcfg_field_t *field_exec = mcfg_get_field(rule, "exec");
+	if (field_exec != NULL && field_exec->data == NULL) {
+		field_exec = NULL;
+	}
+
+	if (field_exec == NULL && field_actions == NULL) {
+		mb_log(LOG_ERROR, "c_rule missing field \"exec\"\n");
+		return 1;
+	}
+
+	char *input_format;
+	char *output_format;
+	if (!_get_io_formats(rule, &input_format, &output_format)) {
 		return 1;
 	}
 
@@ -384,6 +772,8 @@ int run_singular(
 	mcfg_list_t *list_input = mcfg_data_as_list(*io_fields.input);
 	mcfg_list_t *list_output = mcfg_data_as_list(*io_fields.output);
 
+	mb_event_c_rule_elements(rule->name, list_output->field_count);
+
 	mcfg_path_t pathrel = {
 		.absolute = true,
 		.dynfield_path = false,
@@ -401,10 +791,10 @@ int run_singular(
 	mcfg_field_t *dynfield_output = mcfg_get_dynfield(file, "output");
 
 	bool run_parallel = false;
-	size_t max_procs = 4; /* only important if run_parallel is true */
+	/* only important if run_parallel is true */
+	size_t max_procs = 1;
 
 	mcfg_field_t *field_parallel = mcfg_get_field(rule, "parallel");
-	mcfg_field_t *field_max_procs = mcfg_get_field(rule, "max_procs");
 
 	if (field_parallel != NULL) {
 		if (field_parallel->type != TYPE_BOOL) {
@@ -415,94 +805,249 @@ int run_singular(
 		run_parallel = mcfg_data_as_bool(*field_parallel);
 	}
 
-	if (field_max_procs != NULL && run_parallel) {
-		if (field_max_procs->type != TYPE_U8) {
-			mb_log(LOG_ERROR, "field \"max_procs\" should be of type u8\n");
-			return 1;
-		}
+	if (run_parallel && !_load_max_procs(rule, &max_procs)) {
+		return 1;
+	}
 
-		max_procs = mcfg_data_as_u8(*field_max_procs);
+	bool restat;
+	if (!_load_restat(rule, &restat)) {
+		return 1;
 	}
 
-	process_t *processes = NULL;
-	if (run_parallel) {
-		mb_logf(
-			LOG_DEBUG, "running parallel with max procs of %d\n", max_procs);
-		processes = XCALLOC(max_procs, sizeof(*processes));
+	uint64_t batch_size = 1;
+	if (!_load_count(rule, "batch_size", &batch_size)) {
+		return 1;
+	}
+
+	/* actions take single paths, not lists of them */
+	if (field_actions != NULL) {
+		batch_size = 1;
 	}
 
 	/* reused for mcfg_format_field_embeds(_str) calls */
 	mcfg_fmt_res_t fmt_res;
 
 	int ret = 0;
-	size_t used_processes = 0;
+	process_t *processes = NULL;
+	exec_options_t exec_options = {.worker_command = NULL};
 
-	for (size_t ix = 0; ix < list_output->field_count; ix++) {
-		size_t process_ix = used_processes;
+	/* plan: figure out which elements have to be built */
+	job_t *jobs = XMALLOC(
+		_size_t_max(list_output->field_count, 1) * sizeof(job_t));
+	size_t job_count = 0;
 
+	for (size_t ix = 0; ix < list_output->field_count; ix++) {
 		char *raw_in = mcfg_data_to_string(list_input->fields[ix]);
 		char *raw_out = mcfg_data_to_string(list_output->fields[ix]);
 
 		dynfield_element->data = raw_in;
 		dynfield_element->size = strlen(raw_in) + 1;
 
-		fmt_res = mcfg_format_field_embeds_str(input_format, *file, pathrel);
-		FMT_ERR_CHECK(fmt_res, "singular_input_format");
+		fmt_res = STATS_TIMED(
+			STAT_FORMAT,
+			mcfg_format_field_embeds_str(input_format, *file, pathrel));
+		if (_fmt_failed(fmt_res, "singular_input_format")) {
+			XFREE(raw_in);
+			XFREE(raw_out);
+			ret = fmt_res.err;
+			goto exit;
+		}
 
 		char *in = fmt_res.formatted;
 
 		dynfield_element->data = raw_out;
-		dynfield_element->size = strlen(raw_in) + 1;
-
-		fmt_res = mcfg_format_field_embeds_str(output_format, *file, pathrel);
-		FMT_ERR_CHECK(fmt_res, "singular_output_format");
+		dynfield_element->size = strlen(raw_out) + 1;
+
+		fmt_res = STATS_TIMED(
+			STAT_FORMAT,
+			mcfg_format_field_embeds_str(output_format, *file, pathrel));
+		if (_fmt_failed(fmt_res, "singular_output_format")) {
+			XFREE(raw_in);
+			XFREE(raw_out);
+			XFREE(in);
+			ret = fmt_res.err;
+			goto exit;
+		}
 
 		char *out = fmt_res.formatted;
 
-		if (build_type == BUILD_TYPE_INCREMENTAL && !is_file_newer(in, out) &&
-			!cfg.always_force) {
-			goto build_loop_continue;
+		if (build_type == BUILD_TYPE_INCREMENTAL && !cfg.always_force &&
+			(!is_file_newer(in, out) || (restat && mb_restat_clean(in, out)))) {
+			mb_event_job_skipped(rule->name, raw_in);
+			XFREE(raw_in);
+			XFREE(raw_out);
+			XFREE(in);
+			XFREE(out);
+			continue;
+		}
+
+		mb_event_job_queued(rule->name, raw_in);
+
+		jobs[job_count++] = (job_t){
+			.index = ix,
+			.raw_in = raw_in,
+			.raw_out = raw_out,
+			.in = in,
+			.out = out,
+			.cost = 0,
+		};
+
+		if (restat) {
+			mb_restat_snapshot(out, &jobs[job_count - 1].before);
+		}
+	}
+
+	dynfield_element->data = NULL;
+
+	if (!mb_exec_options_load(rule, &exec_options) ||
+		!_load_worker(file, rule, pathrel, &exec_options, &max_procs)) {
+		ret = 1;
+		goto exit;
+	}
+
+	if (run_parallel) {
+		mb_logf(
+			LOG_DEBUG, "running parallel with max procs of %zu\n", max_procs);
+		processes = XCALLOC(max_procs, sizeof(*processes));
+		mb_board_slots(max_procs);
+
+		/* the order only matters if not every job gets a slot right away */
+		if (job_count > max_procs) {
+			_order_jobs(rule->name, jobs, job_count);
+		}
+
+		/* batches are an upper bound, don't leave slots idle to fill them */
+		size_t per_slot = (job_count + max_procs - 1) / max_procs;
+		batch_size = _size_t_max(_size_t_min(batch_size, per_slot), 1);
+	}
+
+	/* execute */
+	size_t used_processes = 0;
+	size_t jix = 0;
+
+	/* every iteration runs a batch of up to batch_size jobs in one script */
+	for (; jix < job_count; jix += batch_size) {
+		size_t process_ix = used_processes;
+		size_t batch_count = _size_t_min(batch_size, job_count - jix);
+		job_t *job = &jobs[jix];
+
+		/* a batch of a single job uses the strings of the job itself */
+		char *element = job->raw_out;
+		char *raw_in = job->raw_in;
+		char *in = job->in;
+		char *out = job->out;
+
+		if (batch_count > 1) {
+			element = _join_jobs(job, batch_count, offsetof(job_t, raw_out));
+			raw_in = _join_jobs(job, batch_count, offsetof(job_t, raw_in));
+			in = _join_jobs(job, batch_count, offsetof(job_t, in));
+			out = _join_jobs(job, batch_count, offsetof(job_t, out));
+			mb_event_jobs_batched(rule->name, raw_in, batch_count);
 		}
 
+		dynfield_element->data = element;
+		dynfield_element->size = strlen(element) + 1;
 		dynfield_output->data = out;
 		dynfield_output->size = strlen(out) + 1;
 		dynfield_input->data = in;
 		dynfield_input->size = strlen(in) + 1;
 
-		fmt_res = mcfg_format_field_embeds(*field_exec, *file, pathrel);
-		FMT_ERR_CHECK(fmt_res, "singular_script_format");
+		bool prepared = true;
+		for (size_t bix = 0; bix < batch_count && prepared; bix++) {
+			prepared = mb_ensure_parent_dir(job[bix].out);
+		}
+
+		if (prepared && field_actions != NULL) {
+			uint64_t started = mb_stats_now();
+			prepared =
+				mb_actions_run(file, field_actions, pathrel, rule->name);
+
+			if (field_exec == NULL) {
+				mb_event_job_finished(
+					rule->name, raw_in, 0, prepared ? 0 : 1,
+					mb_stats_now() - started, NULL);
+			}
+		}
+
+		if (!prepared || field_exec == NULL) {
+			ret = prepared ? ret : 1;
+			goto next_batch;
+		}
+
+		fmt_res = STATS_TIMED(
+			STAT_FORMAT,
+			mcfg_format_field_embeds(*field_exec, *file, pathrel));
+		if (_fmt_failed(fmt_res, "singular_script_format")) {
+			if (batch_count > 1) {
+				XFREE(element);
+				XFREE(raw_in);
+				XFREE(in);
+				XFREE(out);
+			}
+
+			ret = fmt_res.err;
+			if (processes != NULL) {
+				mb_cancel_processes(processes, max_procs);
+			}
+			goto exit;
+		}
 
 		char *script = fmt_res.formatted;
 
 		mb_logf(LOG_STEPS, "exec: %s > %s\n", in, out);
 
+		/* the history is kept per element, not per batch */
+		exec_options.batch_count = batch_count;
+
 		if (!run_parallel) {
-			int tmp_ret = mb_exec(script, rule->name);
+			int tmp_ret = mb_exec(script, rule->name, raw_in, &exec_options);
 			ret = ret > tmp_ret ? ret : tmp_ret;
 		} else {
 			int exit_status = _find_process_slot(
-				max_procs, processes, &used_processes, &process_ix);
+				max_procs, processes, &used_processes, &process_ix,
+				&exec_options);
 
 			if (!cfg.ignore_failures && exit_status != 0) {
+				mb_pool_release(exec_options.pool, exec_options.weight);
+				mb_jobserver_release(exec_options.token);
 				ret = exit_status;
-				goto build_loop_continue;
+			} else {
+				exec_options.cpu = mb_topology_cpu(process_ix);
+				processes[process_ix] = mb_exec_parallel(
+					script, rule->name, raw_in, &exec_options);
+				if (processes[process_ix].pid == 0) {
+					mb_pool_release(exec_options.pool, exec_options.weight);
+					mb_jobserver_release(exec_options.token);
+					ret = 1;
+				}
 			}
-
-			processes[process_ix] = mb_exec_parallel(script, rule->name);
 		}
 
 		XFREE(script);
-	build_loop_continue:
-		XFREE(raw_in);
-		XFREE(raw_out);
-		XFREE(in);
-		XFREE(out);
+
+	next_batch:
+		if (batch_count > 1) {
+			XFREE(element);
+			XFREE(raw_in);
+			XFREE(in);
+			XFREE(out);
+		}
 
 		if (ret != 0 && !cfg.ignore_failures) {
 			break;
 		}
 	}
 
+	if (used_processes == 0) {
+		goto exit;
+	}
+
+	/* cleanup remaining child processes */
+	int finish_ret =
+		_finish_processes(processes, max_procs, cfg.ignore_failures, ret);
+	ret = finish_ret != 0 ? finish_ret : ret;
+
+exit:;
 	/* We have to do this to avoid double-frees when running mcfg_free_file at
 	 * exit in build.c
 	 */
@@ -510,34 +1055,31 @@ int run_singular(
 	dynfield_input->data = NULL;
 	dynfield_output->data = NULL;
 
-	if (used_processes == 0) {
-		goto exit;
-	}
-
-	/* cleanup remaining child processes */
-	for (size_t pix = 0; pix < max_procs; pix++) {
-		if (processes[pix].pid == 0 || processes[pix].location == NULL) {
-			continue;
-		}
+	if (processes != NULL) {
+		XFREE(processes);
+	}
+	_unload_worker(&exec_options);
 
-		int stat;
-		if (waitpid(processes[pix].pid, &stat, 0) <= 0) {
-			continue;
-		}
+	/* with --keep-going the exit status of every single job is not known, so
+	 * restat only applies if all of them are known to have succeeded */
+	if (restat && ret == 0 && !cfg.ignore_failures) {
+		for (size_t ix = 0; ix < job_count; ix++) {
+			if (!mb_restat_unchanged(jobs[ix].out, &jobs[ix].before)) {
+				continue;
+			}
 
-		stat = WEXITSTATUS(stat);
-		if (stat != 0) {
-			ret = stat;
+			mb_logf(LOG_INFO, "restat: %s did not change\n", jobs[ix].out);
+			mb_restat_record(jobs[ix].in, jobs[ix].out);
 		}
-
-		mb_remove_script(processes[pix].location);
-		XFREE(processes[pix].location);
 	}
 
-exit:;
-	if (processes != NULL) {
-		XFREE(processes);
+	for (size_t ix = 0; ix < job_count; ix++) {
+		XFREE(jobs[ix].raw_in);
+		XFREE(jobs[ix].raw_out);
+		XFREE(jobs[ix].in);
+		XFREE(jobs[ix].out);
 	}
+	XFREE(jobs);
 
 	return ret;
 }
@@ -553,40 +1095,34 @@ int run_unify(
 		return 1;
 	}
 
-	mcfg_field_t *field_input_format = mcfg_get_field(rule, "input_format");
-	mcfg_field_t *field_output_format = mcfg_get_field(rule, "output_format");
+	/* builtin actions run before exec */
+	mcfg_field_t *field_actions = mcfg_get_field(rule, "actions");
 
-	if (field_input_format == NULL || field_output_format == NULL) {
-		mb_logf(
-			LOG_ERROR, "c_rule missing field \"%s\"!\n",
-			field_input_format == NULL ? "input_format" : "output_format");
+	char *input_format;
+	char *output_format;
+	if (!_get_io_formats(rule, &input_format, &output_format)) {
 		return 1;
-	} else if (
-		field_input_format->type != TYPE_STRING ||
-		field_output_format->type != TYPE_STRING) {
-		mb_logf(
-			LOG_ERROR, "invalid datatype for field \"%s\"! Expected str\n",
-			field_input_format->type != TYPE_STRING ? "input_format"
-													: "output_format");
+	}
+
+	struct io_fields io_fields;
+	if (!get_io_fields(file, rule, &io_fields)) {
 		return 1;
 	}
 
-	char *input_format = mcfg_data_as_string(*field_input_format);
-	char *output_format = mcfg_data_as_string(*field_output_format);
+	mcfg_list_t *list_input = mcfg_data_as_list(*io_fields.input);
 
-	if (input_format == NULL || output_format == NULL) {
-		mb_logf(
-			LOG_ERROR, "field \"%s\" is missing data!\n",
-			input_format == NULL ? "input_format" : "output_format");
+	bool restat;
+	if (!_load_restat(rule, &restat)) {
 		return 1;
 	}
 
-	struct io_fields io_fields;
-	if (!get_io_fields(file, rule, &io_fields)) {
-		return 1;
+	/* the inputs the job runs for, recorded if its output does not change */
+	CPtrList restat_inputs = {.capacity = 0};
+	if (restat) {
+		cptrlist_init(&restat_inputs, 16, 16);
 	}
 
-	mcfg_list_t *list_input = mcfg_data_as_list(*io_fields.input);
+	mb_event_c_rule_elements(rule->name, list_input->field_count);
 
 	mcfg_path_t pathrel = {
 		.absolute = true,
@@ -599,81 +1135,764 @@ int run_unify(
 	ADD_DYNFIELD(file, "element");
 	ADD_DYNFIELD(file, "input");
 	ADD_DYNFIELD(file, "output");
+	ADD_DYNFIELD(file, "changed");
+	ADD_DYNFIELD(file, "any_changed");
 
 	mcfg_field_t *dynfield_element = mcfg_get_dynfield(file, "element");
 	mcfg_field_t *dynfield_input = mcfg_get_dynfield(file, "input");
 	mcfg_field_t *dynfield_output = mcfg_get_dynfield(file, "output");
+	mcfg_field_t *dynfield_changed = mcfg_get_dynfield(file, "changed");
+	mcfg_field_t *dynfield_any_changed = mcfg_get_dynfield(file, "any_changed");
 
-	mcfg_fmt_res_t fmt_res =
-		mcfg_format_field_embeds_str(output_format, *file, pathrel);
-	FMT_ERR_CHECK(fmt_res, "unify_output_format");
+	dynfield_input->data = NULL;
+	dynfield_output->data = NULL;
+	dynfield_changed->data = NULL;
+	dynfield_any_changed->data = NULL;
+
+	int ret = 0;
+
+	mcfg_fmt_res_t fmt_res = STATS_TIMED(
+		STAT_FORMAT,
+		mcfg_format_field_embeds_str(output_format, *file, pathrel));
+	if (_fmt_failed(fmt_res, "unify_output_format")) {
+		ret = fmt_res.err;
+		goto exit;
+	}
 
 	dynfield_output->data = fmt_res.formatted;
 	dynfield_output->size = strlen(dynfield_output->data) + 1;
 
-	size_t incount = 0;
-	size_t wix = 0;
+	/* %input% lists every input, %changed% only the ones newer than the
+	 * output (or all of them if the build is forced) */
+	size_t changed_count = 0;
+	size_t input_wix = 0;
+	size_t changed_wix = 0;
 
 	dynfield_input->size = 16;
 	dynfield_input->data = XMALLOC(dynfield_input->size);
-
-	int ret = 0;
+	dynfield_changed->size = 16;
+	dynfield_changed->data = XMALLOC(dynfield_changed->size);
 
 	for (size_t ix = 0; ix < list_input->field_count; ix++) {
 		char *raw_in = mcfg_data_to_string(list_input->fields[ix]);
 		dynfield_element->data = raw_in;
 		dynfield_element->size = strlen(raw_in) + 1;
 
-		fmt_res = mcfg_format_field_embeds_str(input_format, *file, pathrel);
-		FMT_ERR_CHECK(fmt_res, "unify_input_format");
+		fmt_res = STATS_TIMED(
+			STAT_FORMAT,
+			mcfg_format_field_embeds_str(input_format, *file, pathrel));
+		if (_fmt_failed(fmt_res, "unify_input_format")) {
+			XFREE(raw_in);
+			ret = fmt_res.err;
+			goto exit;
+		}
 
 		char *fmted = fmt_res.formatted;
 
-		if (build_type == BUILD_TYPE_INCREMENTAL &&
-			!is_file_newer(fmted, dynfield_output->data) && !cfg.always_force) {
+		_append_word(
+			(char **)&dynfield_input->data, &input_wix, &dynfield_input->size,
+			fmted);
+
+		if (!cfg.always_force &&
+			(!is_file_newer(fmted, dynfield_output->data) ||
+			 (restat && mb_restat_clean(fmted, dynfield_output->data)))) {
 			goto input_assembly_continue;
 		}
 
-		wix = _append_str(
-			(char **)&dynfield_input->data, wix, &dynfield_input->size, fmted);
-		_append_char(
-			(char **)&dynfield_input->data, wix, &dynfield_input->size, ' ');
-		wix++;
+		_append_word(
+			(char **)&dynfield_changed->data, &changed_wix,
+			&dynfield_changed->size, fmted);
 
-		incount++;
+		changed_count++;
+
+		if (restat) {
+			cptrlist_append(&restat_inputs, fmted);
+			fmted = NULL;
+		}
 	input_assembly_continue:
 		XFREE(raw_in);
-		XFREE(fmted);
+		if (fmted != NULL) {
+			XFREE(fmted);
+		}
 	}
 
-	_append_char((char **)&dynfield_input->data, wix, &dynfield_input->size, 0);
-	wix++;
+	_append_char(
+		(char **)&dynfield_input->data, input_wix, &dynfield_input->size, 0);
+	_append_char(
+		(char **)&dynfield_changed->data, changed_wix, &dynfield_changed->size,
+		0);
+
+	dynfield_any_changed->data = strdup(changed_count > 0 ? "true" : "false");
+	dynfield_any_changed->size = strlen(dynfield_any_changed->data) + 1;
+
+	char *unify_output = mcfg_data_as_string(*dynfield_output);
 
-	if (incount == 0) {
-		mb_log(LOG_INFO, "no inputs, skipping!\n");
+	/* full builds always run the rule, %any_changed% tells the script if it
+	 * has to */
+	if (build_type == BUILD_TYPE_INCREMENTAL && changed_count == 0) {
+		mb_log(LOG_INFO, "no changed inputs, skipping!\n");
+		mb_event_job_skipped(rule->name, unify_output);
+		goto exit;
+	}
+
+	mb_event_job_queued(rule->name, unify_output);
+
+	if (!mb_ensure_parent_dir(unify_output) ||
+		(field_actions != NULL &&
+		 !mb_actions_run(file, field_actions, pathrel, rule->name))) {
+		ret = 1;
 		goto exit;
 	}
 
 	mb_logf(
-		LOG_STEPS, "exec: %s > %s\n", mcfg_data_as_string(*dynfield_input),
+		LOG_STEPS, "exec: %s > %s\n", mcfg_data_as_string(*dynfield_changed),
 		mcfg_data_as_string(*dynfield_output));
 
-	fmt_res = mcfg_format_field_embeds(*field_exec, *file, pathrel);
-	FMT_ERR_CHECK(fmt_res, "unify_script_format");
+	fmt_res = STATS_TIMED(
+		STAT_FORMAT,
+		mcfg_format_field_embeds(*field_exec, *file, pathrel));
+	if (_fmt_failed(fmt_res, "unify_script_format")) {
+		ret = fmt_res.err;
+		goto exit;
+	}
 
 	char *script = fmt_res.formatted;
 
-	int tmp_ret = mb_exec(script, rule->name);
+	exec_options_t exec_options;
+	if (!mb_exec_options_load(rule, &exec_options) ||
+		!_load_worker(file, rule, pathrel, &exec_options, NULL)) {
+		XFREE(script);
+		ret = 1;
+		goto exit;
+	}
+
+	restat_snapshot_t before;
+	if (restat) {
+		mb_restat_snapshot(unify_output, &before);
+	}
+
+	int tmp_ret = mb_exec(script, rule->name, unify_output, &exec_options);
+	_unload_worker(&exec_options);
 	ret = ret > tmp_ret ? ret : tmp_ret;
 
+	if (restat && ret == 0 && mb_restat_unchanged(unify_output, &before)) {
+		mb_logf(LOG_INFO, "restat: %s did not change\n", unify_output);
+		for (size_t ix = 0; ix < restat_inputs.size; ix++) {
+			mb_restat_record(restat_inputs.items[ix], unify_output);
+		}
+	}
+
 	XFREE(script);
 exit:
-	XFREE(dynfield_input->data);
-	XFREE(dynfield_output->data);
+	for (size_t ix = 0; ix < restat_inputs.size; ix++) {
+		XFREE(restat_inputs.items[ix]);
+	}
+
+	if (restat_inputs.items != NULL) {
+		free(restat_inputs.items);
+	}
+
+	if (dynfield_input->data != NULL) {
+		XFREE(dynfield_input->data);
+	}
+	if (dynfield_output->data != NULL) {
+		XFREE(dynfield_output->data);
+	}
+	if (dynfield_changed->data != NULL) {
+		XFREE(dynfield_changed->data);
+	}
+	if (dynfield_any_changed->data != NULL) {
+		XFREE(dynfield_any_changed->data);
+	}
+
+	dynfield_element->data = NULL;
+	dynfield_input->data = NULL;
+	dynfield_output->data = NULL;
+	dynfield_changed->data = NULL;
+	dynfield_any_changed->data = NULL;
+
+	return ret;
+}
+
+/**
+ * @brief Assemble the %input% and %changed% lists of a job.
+ * @param inputs The formatted inputs of the job
+ * @param force Consider every input as changed
+ * @param input_list Output for the space separated list of all inputs
+ * @param changed_list Output for the space separated list of the inputs
+ * which are newer than output
+ * @return The number of changed inputs
+ */
+static size_t _assemble_inputs(
+	char **inputs,
+	size_t count,
+	char *output,
+	bool force,
+	char **input_list,
+	char **changed_list) {
+	size_t input_size = 16;
+	size_t input_wix = 0;
+	size_t changed_size = 16;
+	size_t changed_wix = 0;
+	size_t changed = 0;
+
+	*input_list = XMALLOC(input_size);
+	*changed_list = XMALLOC(changed_size);
+
+	for (size_t ix = 0; ix < count; ix++) {
+		_append_word(input_list, &input_wix, &input_size, inputs[ix]);
+
+		if (force || is_file_newer(inputs[ix], output)) {
+			_append_word(changed_list, &changed_wix, &changed_size, inputs[ix]);
+			changed++;
+		}
+	}
+
+	_append_char(input_list, input_wix, &input_size, 0);
+	_append_char(changed_list, changed_wix, &changed_size, 0);
+
+	return changed;
+}
+
+static char *_chunk_members_path(char *chunk_output) {
+	size_t path_size = strlen(chunk_output) + sizeof(CHUNK_MEMBERS_SUFFIX);
+	char *path = XMALLOC(path_size);
+	snprintf(path, path_size, "%s" CHUNK_MEMBERS_SUFFIX, chunk_output);
+	return path;
+}
+
+/**
+ * @brief Check if the inputs of a chunk differ from the ones it was last
+ * built from. The chunk output is removed if they do, so it is rebuilt even
+ * if its job fails.
+ * @param members The inputs of the chunk separated by spaces
+ * @return true if the inputs differ
+ */
+static bool _chunk_members_changed(char *chunk_output, char *members) {
+	char *path = _chunk_members_path(chunk_output);
+	size_t members_len = strlen(members);
+	bool changed = true;
+
+	FILE *file = fopen(path, "r");
+	if (file != NULL) {
+		char *previous = XMALLOC(members_len + 1);
+		size_t len = fread(previous, 1, members_len + 1, file);
+		changed = len != members_len || memcmp(previous, members, len) != 0;
+		XFREE(previous);
+		fclose(file);
+	}
+
+	if (changed) {
+		unlink(chunk_output);
+	}
+
+	XFREE(path);
+	return changed;
+}
+
+/**
+ * @brief Remember the inputs a chunk was built from.
+ */
+static void _write_chunk_members(char *chunk_output, char *members) {
+	char *path = _chunk_members_path(chunk_output);
+	size_t members_len = strlen(members);
+
+	FILE *file = fopen(path, "w");
+	if (file == NULL || fwrite(members, 1, members_len, file) != members_len) {
+		mb_logf(
+			LOG_WARNING, "failed to write \"%s\": %s\n", path, strerror(errno));
+	}
+
+	if (file != NULL) {
+		fclose(file);
+	}
+
+	XFREE(path);
+}
+
+/**
+ * @brief FNV-1a hash of a string.
+ */
+static uint64_t _hash_str(const char *str) {
+	uint64_t hash = 0xcbf29ce484222325ull;
+	for (const char *chr = str; *chr != 0; chr++) {
+		hash = (hash ^ (unsigned char)*chr) * 0x100000001b3ull;
+	}
+
+	return hash;
+}
+
+/**
+ * @brief Split the inputs of a unity rule into groups. A group ends after an
+ * input whose path hashes to a multiple of group_size, so groups have
+ * group_size inputs on average and adding or removing an input only changes
+ * the group it belongs to instead of shifting every group behind it. Groups
+ * are cut off at twice the group size to bound unlucky runs.
+ * @param chunk_ends Output for the index after the last input of every group,
+ * has to hold up to count entries
+ * @return The number of groups
+ */
+static size_t _unity_groups(
+	char **inputs,
+	size_t count,
+	size_t group_size,
+	size_t *chunk_ends) {
+	size_t groups = 0;
+	size_t first = 0;
+
+	for (size_t ix = 0; ix < count; ix++) {
+		if (_hash_str(inputs[ix]) % group_size == 0 ||
+			ix + 1 - first >= group_size * 2 || ix + 1 == count) {
+			chunk_ends[groups++] = ix + 1;
+			first = ix + 1;
+		}
+	}
+
+	return groups;
+}
+
+/**
+ * @brief Write the source file of a unity group which includes all of its
+ * inputs. The file is only rewritten if its content changes.
+ * @return The path of the source file, it is named like the group output
+ * with the extension of the first input
+ */
+static char *_write_unity_source(
+	const char *rule_name,
+	char *chunk_output,
+	char **inputs,
+	size_t count) {
+	const char *base = strrchr(inputs[0], '/');
+	const char *ext = strrchr(base == NULL ? inputs[0] : base, '.');
+	if (ext == NULL) {
+		ext = ".c";
+	}
+
+	size_t path_size = strlen(chunk_output) + strlen(ext) + 1;
+	char *path = XMALLOC(path_size);
+	snprintf(path, path_size, "%s%s", chunk_output, ext);
+
+	size_t content_size = 128;
+	size_t content_wix = 0;
+	char *content = XMALLOC(content_size);
+	char line[PATH_MAX + 16];
+
+	snprintf(
+		line, sizeof(line),
+		"/* unity source of c_rule \"%s\", generated by mariebuild */\n",
+		rule_name);
+	content_wix = _append_str(&content, content_wix, &content_size, line);
+
+	/* the includes are resolved relative to the unity source, not to the
+	 * directory mariebuild runs in */
+	for (size_t ix = 0; ix < count; ix++) {
+		char resolved[PATH_MAX];
+		const char *input =
+			realpath(inputs[ix], resolved) != NULL ? resolved : inputs[ix];
+
+		snprintf(line, sizeof(line), "#include \"%s\"\n", input);
+		content_wix = _append_str(&content, content_wix, &content_size, line);
+	}
+
+	_append_char(&content, content_wix, &content_size, 0);
+
+	size_t content_len = strlen(content);
+	bool changed = true;
+
+	FILE *file = fopen(path, "r");
+	if (file != NULL) {
+		char *previous = XMALLOC(content_len + 1);
+		size_t len = fread(previous, 1, content_len + 1, file);
+		changed = len != content_len || memcmp(previous, content, len) != 0;
+		XFREE(previous);
+		fclose(file);
+	}
+
+	if (changed) {
+		file = fopen(path, "w");
+		if (file == NULL ||
+			fwrite(content, 1, content_len, file) != content_len) {
+			mb_logf(
+				LOG_WARNING, "failed to write \"%s\": %s\n", path,
+				strerror(errno));
+		}
+
+		if (file != NULL) {
+			fclose(file);
+		}
+	}
+
+	XFREE(content);
+	return path;
+}
+
+int run_chunked(
+	mcfg_file_t *file,
+	mcfg_section_t *rule,
+	const config_t cfg,
+	build_type_t build_type,
+	exec_mode_t exec_mode) {
+	bool unity = exec_mode == EXEC_MODE_UNITY;
+
+	mcfg_field_t *field_exec = mcfg_get_field(rule, "exec");
+	if (field_exec == NULL || field_exec->data == NULL) {
+		mb_log(LOG_ERROR, "c_rule missing field \"exec\"\n");
+		return 1;
+	}
+
+	/* optional, without it the chunk outputs are the result of the rule */
+	mcfg_field_t *field_reduce_exec = mcfg_get_field(rule, "reduce_exec");
+
+	char *input_format;
+	char *output_format;
+	if (!_get_io_formats(rule, &input_format, &output_format)) {
+		return 1;
+	}
+
+	uint64_t chunk_size = unity ? UNITY_DEFAULT_GROUP_SIZE : 0;
+	if (!_load_count(
+			rule, unity ? "unity_group_size" : "chunk_size", &chunk_size)) {
+		return 1;
+	}
+
+	if (chunk_size == 0) {
+		mb_log(LOG_ERROR, "c_rule missing field \"chunk_size\"\n");
+		return 1;
+	}
+
+	size_t max_procs;
+	if (!_load_max_procs(rule, &max_procs)) {
+		return 1;
+	}
+
+	exec_options_t exec_options;
+	if (!mb_exec_options_load(rule, &exec_options)) {
+		return 1;
+	}
+
+	struct io_fields io_fields;
+	if (!get_io_fields(file, rule, &io_fields)) {
+		return 1;
+	}
+
+	mcfg_list_t *list_input = mcfg_data_as_list(*io_fields.input);
+
+	mcfg_path_t pathrel = {
+		.absolute = true,
+		.dynfield_path = false,
+
+		.sector = "c_rules",
+		.section = rule->name,
+		.field = ""};
+
+	if (!_load_worker(file, rule, pathrel, &exec_options, &max_procs)) {
+		return 1;
+	}
+
+	ADD_DYNFIELD(file, "element");
+	ADD_DYNFIELD(file, "input");
+	ADD_DYNFIELD(file, "output");
+	ADD_DYNFIELD(file, "changed");
+	ADD_DYNFIELD(file, "any_changed");
+
+	mcfg_field_t *dynfield_element = mcfg_get_dynfield(file, "element");
+	mcfg_field_t *dynfield_input = mcfg_get_dynfield(file, "input");
+	mcfg_field_t *dynfield_output = mcfg_get_dynfield(file, "output");
+	mcfg_field_t *dynfield_changed = mcfg_get_dynfield(file, "changed");
+	mcfg_field_t *dynfield_any_changed = mcfg_get_dynfield(file, "any_changed");
+
+	mcfg_fmt_res_t fmt_res = STATS_TIMED(
+		STAT_FORMAT,
+		mcfg_format_field_embeds_str(output_format, *file, pathrel));
+	if (_fmt_failed(fmt_res, "chunked_output_format")) {
+		_unload_worker(&exec_options);
+		return fmt_res.err;
+	}
+
+	char *output = fmt_res.formatted;
+
+	size_t input_count = list_input->field_count;
+	char **inputs = XMALLOC(_size_t_max(input_count, 1) * sizeof(char *));
+
+	for (size_t ix = 0; ix < input_count; ix++) {
+		char *raw_in = mcfg_data_to_string(list_input->fields[ix]);
+		dynfield_element->data = raw_in;
+		dynfield_element->size = strlen(raw_in) + 1;
+
+		fmt_res = STATS_TIMED(
+			STAT_FORMAT,
+			mcfg_format_field_embeds_str(input_format, *file, pathrel));
+		if (_fmt_failed(fmt_res, "chunked_input_format")) {
+			dynfield_element->data = NULL;
+			XFREE(raw_in);
+			for (size_t jx = 0; jx < ix; jx++) {
+				XFREE(inputs[jx]);
+			}
+			XFREE(inputs);
+			XFREE(output);
+			_unload_worker(&exec_options);
+			return fmt_res.err;
+		}
+
+		inputs[ix] = fmt_res.formatted;
+		XFREE(raw_in);
+	}
+
+	dynfield_element->data = NULL;
 
+	size_t *chunk_ends = XMALLOC(_size_t_max(input_count, 1) * sizeof(size_t));
+	size_t chunk_count = 0;
+
+	if (unity) {
+		chunk_count =
+			_unity_groups(inputs, input_count, chunk_size, chunk_ends);
+	} else {
+		chunk_count = (input_count + chunk_size - 1) / chunk_size;
+		for (size_t chunk = 0; chunk < chunk_count; chunk++) {
+			chunk_ends[chunk] =
+				_size_t_min((chunk + 1) * chunk_size, input_count);
+		}
+	}
+
+	char **chunk_outputs =
+		XCALLOC(_size_t_max(chunk_count, 1), sizeof(char *));
+
+	/* inputs of the chunks which are rebuilt, written once they are done */
+	char **chunk_members =
+		XCALLOC(_size_t_max(chunk_count, 1), sizeof(char *));
+
+	mb_event_c_rule_elements(
+		rule->name, chunk_count + (field_reduce_exec != NULL ? 1 : 0));
+
+	mb_logf(
+		LOG_DEBUG, "%zu inputs in %zu chunks, max procs of %zu\n", input_count,
+		chunk_count, max_procs);
+
+	process_t *processes = XCALLOC(max_procs, sizeof(*processes));
+	mb_board_slots(max_procs);
+	size_t used_processes = 0;
+	int ret = 0;
+
+	/* the chunk outputs live next to the output */
+	if (!mb_ensure_parent_dir(output)) {
+		ret = 1;
+		goto exit;
+	}
+
+	/* map: run exec for every chunk which is out of date */
+	for (size_t chunk = 0; chunk < chunk_count; chunk++) {
+		size_t first = chunk == 0 ? 0 : chunk_ends[chunk - 1];
+		size_t count = chunk_ends[chunk] - first;
+
+		/* unity groups are named after their first input so they keep their
+		 * output when groups in front of them change */
+		char chunk_name[24];
+		if (unity) {
+			snprintf(
+				chunk_name, sizeof(chunk_name), "%016llx",
+				(unsigned long long)_hash_str(inputs[first]));
+		} else {
+			snprintf(chunk_name, sizeof(chunk_name), "%zu", chunk);
+		}
+
+		size_t chunk_output_size = strlen(output) + strlen(chunk_name) + 2;
+		chunk_outputs[chunk] = XMALLOC(chunk_output_size);
+		snprintf(
+			chunk_outputs[chunk], chunk_output_size, "%s.%s", output,
+			chunk_name);
+
+		char *input_list;
+		char *changed_list;
+		size_t changed = _assemble_inputs(
+			&inputs[first], count, chunk_outputs[chunk], cfg.always_force,
+			&input_list, &changed_list);
+
+		/* inputs moving between chunks do not change any mtimes */
+		if (_chunk_members_changed(chunk_outputs[chunk], input_list)) {
+			XFREE(changed_list);
+			changed_list = strdup(input_list);
+			changed = count;
+		}
+
+		if (build_type == BUILD_TYPE_INCREMENTAL && changed == 0) {
+			mb_event_job_skipped(rule->name, chunk_outputs[chunk]);
+			XFREE(input_list);
+			XFREE(changed_list);
+			continue;
+		}
+
+		mb_event_job_queued(rule->name, chunk_outputs[chunk]);
+
+		/* a unity group compiles the one source including all of its
+		 * inputs */
+		char *unity_source =
+			unity ? _write_unity_source(
+						rule->name, chunk_outputs[chunk], &inputs[first], count)
+				  : NULL;
+		char *chunk_input = unity ? unity_source : input_list;
+
+		dynfield_element->data = chunk_name;
+		dynfield_element->size = strlen(chunk_name) + 1;
+		dynfield_input->data = chunk_input;
+		dynfield_input->size = strlen(chunk_input) + 1;
+		dynfield_changed->data = changed_list;
+		dynfield_changed->size = strlen(changed_list) + 1;
+		dynfield_any_changed->data = changed > 0 ? "true" : "false";
+		dynfield_any_changed->size = strlen(dynfield_any_changed->data) + 1;
+		dynfield_output->data = chunk_outputs[chunk];
+		dynfield_output->size = strlen(chunk_outputs[chunk]) + 1;
+
+		fmt_res = STATS_TIMED(
+			STAT_FORMAT,
+			mcfg_format_field_embeds(*field_exec, *file, pathrel));
+
+		chunk_members[chunk] = input_list;
+		XFREE(changed_list);
+		if (unity_source != NULL) {
+			XFREE(unity_source);
+		}
+		if (_fmt_failed(fmt_res, "chunked_script_format")) {
+			ret = fmt_res.err;
+			mb_cancel_processes(processes, max_procs);
+			goto exit;
+		}
+
+		char *script = fmt_res.formatted;
+
+		mb_logf(
+			LOG_STEPS, "exec: %s %s (%zu inputs) > %s\n",
+			unity ? "unity group" : "chunk", chunk_name, count,
+			chunk_outputs[chunk]);
+
+		size_t process_ix = used_processes;
+		int exit_status = _find_process_slot(
+			max_procs, processes, &used_processes, &process_ix,
+			&exec_options);
+
+		if (!cfg.ignore_failures && exit_status != 0) {
+			mb_pool_release(exec_options.pool, exec_options.weight);
+			mb_jobserver_release(exec_options.token);
+			ret = exit_status;
+			XFREE(script);
+			break;
+		}
+
+		exec_options.cpu = mb_topology_cpu(process_ix);
+		processes[process_ix] = mb_exec_parallel(
+			script, rule->name, chunk_outputs[chunk], &exec_options);
+		if (processes[process_ix].pid == 0) {
+			mb_pool_release(exec_options.pool, exec_options.weight);
+			mb_jobserver_release(exec_options.token);
+			ret = 1;
+		}
+
+		XFREE(script);
+	}
+
+	/* the chunk outputs are the inputs of the reduce step */
+	int finish_ret =
+		_finish_processes(processes, max_procs, cfg.ignore_failures, ret);
+	ret = finish_ret != 0 ? finish_ret : ret;
+
+	for (size_t chunk = 0; ret == 0 && chunk < chunk_count; chunk++) {
+		if (chunk_members[chunk] != NULL) {
+			_write_chunk_members(chunk_outputs[chunk], chunk_members[chunk]);
+		}
+	}
+
+	exec_options.cpu = -1;
+
+	/* reduce: run reduce_exec over the chunk outputs */
+	if (ret == 0 && field_reduce_exec != NULL) {
+		char *input_list;
+		char *changed_list;
+		size_t changed = _assemble_inputs(
+			chunk_outputs, chunk_count, output, cfg.always_force, &input_list,
+			&changed_list);
+
+		/* chunks can disappear without any of the others changing */
+		if (_chunk_members_changed(output, input_list)) {
+			XFREE(changed_list);
+			changed_list = strdup(input_list);
+			changed = chunk_count;
+		}
+
+		if (build_type == BUILD_TYPE_INCREMENTAL && changed == 0) {
+			mb_event_job_skipped(rule->name, output);
+			XFREE(input_list);
+			XFREE(changed_list);
+			goto exit;
+		}
+
+		mb_event_job_queued(rule->name, output);
+
+		dynfield_element->data = NULL;
+		dynfield_input->data = input_list;
+		dynfield_input->size = strlen(input_list) + 1;
+		dynfield_changed->data = changed_list;
+		dynfield_changed->size = strlen(changed_list) + 1;
+		dynfield_any_changed->data = changed > 0 ? "true" : "false";
+		dynfield_any_changed->size = strlen(dynfield_any_changed->data) + 1;
+		dynfield_output->data = output;
+		dynfield_output->size = strlen(output) + 1;
+
+		fmt_res = STATS_TIMED(
+			STAT_FORMAT,
+			mcfg_format_field_embeds(*field_reduce_exec, *file, pathrel));
+
+		XFREE(changed_list);
+		if (_fmt_failed(fmt_res, "chunked_reduce_exec_format")) {
+			XFREE(input_list);
+			ret = fmt_res.err;
+			goto exit;
+		}
+
+		char *script = fmt_res.formatted;
+
+		mb_logf(
+			LOG_STEPS, "exec: reduce %zu chunks > %s\n", chunk_count, output);
+
+		/* the reduce step is not a work request */
+		_unload_worker(&exec_options);
+		ret = mb_exec(script, rule->name, output, &exec_options);
+		if (ret == 0) {
+			_write_chunk_members(output, input_list);
+		}
+
+		XFREE(input_list);
+		XFREE(script);
+	}
+
+exit:
+	/* the dynfields only pointed to memory owned by this function, reset
+	 * them to avoid double-frees when running mcfg_free_file */
 	dynfield_element->data = NULL;
 	dynfield_input->data = NULL;
 	dynfield_output->data = NULL;
+	dynfield_changed->data = NULL;
+	dynfield_any_changed->data = NULL;
+
+	for (size_t ix = 0; ix < input_count; ix++) {
+		XFREE(inputs[ix]);
+	}
+	XFREE(inputs);
+
+	for (size_t ix = 0; ix < chunk_count; ix++) {
+		if (chunk_outputs[ix] != NULL) {
+			XFREE(chunk_outputs[ix]);
+		}
+
+		if (chunk_members[ix] != NULL) {
+			XFREE(chunk_members[ix]);
+		}
+	}
+	XFREE(chunk_outputs);
+	XFREE(chunk_members);
+	XFREE(chunk_ends);
+
+	XFREE(processes);
+	XFREE(output);
+	_unload_worker(&exec_options);
 
 	return ret;
 }
@@ -713,6 +1932,9 @@ int mb_run_c_rule(mcfg_file_t *file, mcfg_section_t *rule, const config_t cfg) {
 		XFREE(data);
 	}
 
+	mb_event_c_rule_start(rule->name, exec_mode_to_str(exec_mode));
+	mb_accounting_enter_c_rule(rule->name);
+
 	int ret = 0;
 
 	switch (exec_mode) {
@@ -722,8 +1944,18 @@ int mb_run_c_rule(mcfg_file_t *file, mcfg_section_t *rule, const config_t cfg) {
 		case EXEC_MODE_UNIFY:
 			ret = run_unify(file, rule, cfg, build_type);
 			break;
+		case EXEC_MODE_CHUNKED:
+		case EXEC_MODE_UNITY:
+			ret = run_chunked(file, rule, cfg, build_type, exec_mode);
+			break;
 	}
 
+	/* shell workers are per rule */
+	mb_workers_stop();
+
+	mb_accounting_leave_c_rule();
+	mb_event_c_rule_end(rule->name, ret);
+
 	if (ret == 0) {
 		mb_logf(LOG_INFO, "fulfilled c_rule \"%s\"!\n", rule->name);
 	}
@@ -7,6 +7,9 @@
 #ifndef C_RULE_H
 #define C_RULE_H
 
+#include <stdbool.h>
+#include <stddef.h>
+
 #include "mcfg.h"
 #include "types.h"
 
@@ -22,4 +25,15 @@ int mb_run_c_rules(
 
 int mb_run_c_rule(mcfg_file_t *file, mcfg_section_t *rule, const config_t cfg);
 
+/* exposed for the microbenchmarks in bench/microbench.c */
+
+void _append_char(char **dest, size_t wix, size_t *dest_size, char chr);
+size_t _append_str(char **dest, size_t wix, size_t *dest_size, char *src);
+
+/**
+ * @brief Check if the modification time of file1 is newer than that of file2.
+ * If either file does not exist file1 is considered to be newer.
+ */
+bool is_file_newer(char *file1, char *file2);
+
 #endif /* #infdef C_RULE_H */
@@ -0,0 +1,135 @@
+/* capture.c ; mariebuild job output capture
+ *
+ * Copyright (c) 2025, Marie Eckert
+ * Licensend under the BSD 3-Clause License.
+ */
+
+#define _XOPEN_SOURCE 700
+#define _POSIX_C_SOURCE 200809L
+#define _DEFAULT_SOURCE
+
+#include <errno.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "capture.h"
+#include "logging.h"
+#include "progress.h"
+#include "signals.h"
+#include "xmem.h"
+
+#define CAPTURE_TEMPLATE "/tmp/mb_output_XXXXXX"
+
+output_mode_t mb_output_mode = OUTPUT_MODE_ALL;
+
+void mb_capture_begin(capture_t *capture, bool parallel) {
+	*capture = (capture_t){.fd = -1, .path = NULL};
+
+	/* a job writing to the terminal would tear the status line */
+	bool capture_serial =
+		mb_output_mode == OUTPUT_MODE_FAILED || mb_progress_enabled();
+	if (mb_output_mode == OUTPUT_MODE_LIVE || (!parallel && !capture_serial)) {
+		return;
+	}
+
+	char *path = strdup(CAPTURE_TEMPLATE);
+
+	int fd = mkstemp(path);
+	if (fd < 0) {
+		mb_logf(
+			LOG_WARNING, "could not capture job output: %s\n", strerror(errno));
+		XFREE(path);
+		return;
+	}
+
+	/* jobs running in parallel must not hold on to the files of each other */
+	fcntl(fd, F_SETFD, FD_CLOEXEC);
+
+	mb_register_tmp_file(path);
+	capture->fd = fd;
+	capture->path = path;
+}
+
+/**
+ * @brief Read the whole output of a job from the start of its file.
+ * @param len Output for the length of the output
+ * @return The heap allocated and NUL terminated output, NULL if it is empty
+ * or could not be read
+ */
+static char *_read_output(int fd, size_t *len) {
+	struct stat st;
+	if (fstat(fd, &st) != 0 || st.st_size <= 0) {
+		return NULL;
+	}
+
+	size_t size = (size_t)st.st_size;
+	char *output = XMALLOC(size + 1);
+	size_t done = 0;
+	while (done < size) {
+		ssize_t res = pread(fd, output + done, size - done, (off_t)done);
+		if (res < 0 && errno == EINTR) {
+			continue;
+		}
+
+		if (res <= 0) {
+			break;
+		}
+
+		done += res;
+	}
+
+	if (done == 0) {
+		XFREE(output);
+		return NULL;
+	}
+
+	output[done] = 0;
+	*len = done;
+	return output;
+}
+
+void mb_capture_end(
+	capture_t *capture,
+	const char *rule,
+	const char *element,
+	int exit_status) {
+	if (capture->fd < 0) {
+		return;
+	}
+
+	bool print = exit_status != 0 || mb_output_mode != OUTPUT_MODE_FAILED;
+	size_t len = 0;
+	char *output = print ? _read_output(capture->fd, &len) : NULL;
+
+	if (output != NULL) {
+		/* with a status line, like the steps, the output of successful
+		 * jobs only goes to the log file */
+		log_level_t level = exit_status != 0 ? LOG_ERROR
+							: mb_progress_enabled() ? LOG_STEPS
+													: LOG_INFO;
+		const char *newline = output[len - 1] == '\n' ? "" : "\n";
+
+		/* both messages are queued back to back, so the block is never
+		 * interleaved with the output of other jobs */
+		if (element == NULL) {
+			mb_logf(level, "output of %s:\n", rule);
+		} else {
+			mb_logf(level, "output of %s (%s):\n", rule, element);
+		}
+		mb_logf_noprefix(level, "%s%s", output, newline);
+
+		XFREE(output);
+	}
+
+	close(capture->fd);
+	unlink(capture->path);
+	mb_unregister_tmp_file(capture->path);
+	XFREE(capture->path);
+
+	*capture = (capture_t){.fd = -1, .path = NULL};
+}
@@ -0,0 +1,46 @@
+/* capture.h ; mariebuild job output capture header
+ *
+ * Copyright (c) 2025, Marie Eckert
+ * Licensend under the BSD 3-Clause License.
+ */
+
+#ifndef CAPTURE_H
+#define CAPTURE_H
+
+#include <stdbool.h>
+
+#include "types.h"
+
+/* The output of a job, collected in a temporary file while it runs */
+typedef struct capture {
+	/* -1 if the output of the job is not captured */
+	int fd;
+
+	char *path;
+} capture_t;
+
+/* set from the --output option */
+extern output_mode_t mb_output_mode;
+
+/**
+ * @brief Start capturing the output of a job if the output mode asks for it.
+ * If the temporary file can not be created the job writes to the terminal.
+ * @param parallel Whether the job runs alongside others, the output of jobs
+ * running alone is only captured when it is printed for failed jobs only or
+ * when a status line is shown
+ */
+void mb_capture_begin(capture_t *capture, bool parallel);
+
+/**
+ * @brief Print the output of a finished job as one block, prefixed with the
+ * rule and element of the job, and remove the temporary file. Nothing is
+ * printed for empty output or, in OUTPUT_MODE_FAILED, for successful jobs.
+ * @param element The element the job was run for, may be NULL
+ */
+void mb_capture_end(
+	capture_t *capture,
+	const char *rule,
+	const char *element,
+	int exit_status);
+
+#endif /* #ifndef CAPTURE_H */
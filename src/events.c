@@ -0,0 +1,379 @@
+/* events.c ; mariebuild machine-readable progress events
+ *
+ * Every event is written as a single line of JSON (NDJSON) with a single
+ * write call. See doc/events.md for the format.
+ *
+ * Copyright (c) 2025, Marie Eckert
+ * Licensend under the BSD 3-Clause License.
+ */
+
+#define _XOPEN_SOURCE 700
+#define _POSIX_C_SOURCE 200809L
+
+#include <errno.h>
+#include <signal.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "board.h"
+#include "events.h"
+#include "logging.h"
+#include "progress.h"
+#include "stats.h"
+#include "xmem.h"
+
+#define EVENT_INITIAL_SIZE 256
+
+typedef struct event {
+	char *data;
+	size_t size;
+	size_t len;
+} event_t;
+
+static int events_fd = -1;
+static bool events_owns_fd = false;
+static uint64_t events_epoch = 0;
+
+static void _event_put_raw(event_t *event, const char *raw, size_t len) {
+	if (event->len + len + 1 > event->size) {
+		while (event->len + len + 1 > event->size) {
+			event->size *= 2;
+		}
+		event->data = XREALLOC(event->data, event->size);
+	}
+
+	memcpy(event->data + event->len, raw, len);
+	event->len += len;
+}
+
+static void _event_put_escaped(event_t *event, const char *str) {
+	_event_put_raw(event, "\"", 1);
+
+	if (str == NULL) {
+		_event_put_raw(event, "\"", 1);
+		return;
+	}
+
+	for (const char *chr = str; *chr != 0; chr++) {
+		char escaped[8];
+		switch (*chr) {
+			case '"':
+				_event_put_raw(event, "\\\"", 2);
+				break;
+			case '\\':
+				_event_put_raw(event, "\\\\", 2);
+				break;
+			case '\n':
+				_event_put_raw(event, "\\n", 2);
+				break;
+			case '\t':
+				_event_put_raw(event, "\\t", 2);
+				break;
+			default:
+				if ((unsigned char)*chr < 0x20) {
+					snprintf(
+						escaped, sizeof(escaped), "\\u%04x",
+						(unsigned char)*chr);
+					_event_put_raw(event, escaped, strlen(escaped));
+				} else {
+					_event_put_raw(event, chr, 1);
+				}
+				break;
+		}
+	}
+
+	_event_put_raw(event, "\"", 1);
+}
+
+static void _event_put_key(event_t *event, const char *key) {
+	_event_put_raw(event, ",", 1);
+	_event_put_escaped(event, key);
+	_event_put_raw(event, ":", 1);
+}
+
+static void _event_put_str(event_t *event, const char *key, const char *val) {
+	_event_put_key(event, key);
+	_event_put_escaped(event, val);
+}
+
+static void _event_put_int(event_t *event, const char *key, int64_t val) {
+	char num[32];
+	snprintf(num, sizeof(num), "%lld", (long long)val);
+
+	_event_put_key(event, key);
+	_event_put_raw(event, num, strlen(num));
+}
+
+static bool _event_begin(event_t *event, const char *type) {
+	if (events_fd < 0) {
+		return false;
+	}
+
+	event->size = EVENT_INITIAL_SIZE;
+	event->len = 0;
+	event->data = XMALLOC(event->size);
+
+	char head[64];
+	snprintf(head, sizeof(head), "{\"v\":%d", MB_EVENTS_VERSION);
+	_event_put_raw(event, head, strlen(head));
+	_event_put_int(event, "t", mb_stats_now() - events_epoch);
+	_event_put_str(event, "event", type);
+
+	return true;
+}
+
+static void _event_emit(event_t *event) {
+	_event_put_raw(event, "}\n", 2);
+
+	size_t written = 0;
+	while (written < event->len) {
+		ssize_t res =
+			write(events_fd, event->data + written, event->len - written);
+		if (res < 0) {
+			if (errno == EINTR) {
+				continue;
+			}
+
+			mb_logf(
+				LOG_WARNING, "failed to write event, disabling events: %s\n",
+				strerror(errno));
+			mb_events_close();
+			break;
+		}
+
+		written += res;
+	}
+
+	XFREE(event->data);
+}
+
+static bool _events_setup(int fd) {
+	if (fcntl(fd, F_GETFD) < 0) {
+		mb_logf(LOG_ERROR, "invalid events fd %d: %s\n", fd, strerror(errno));
+		return false;
+	}
+
+	/* scripts should not inherit the event stream */
+	fcntl(fd, F_SETFD, fcntl(fd, F_GETFD) | FD_CLOEXEC);
+
+	/* a consumer going away should disable events, not kill the build.
+	 * Children get the default disposition back in the executor. */
+	signal(SIGPIPE, SIG_IGN);
+
+	events_fd = fd;
+	events_epoch = mb_stats_now();
+	return true;
+}
+
+bool mb_events_open_fd(int fd) {
+	events_owns_fd = false;
+	return _events_setup(fd);
+}
+
+bool mb_events_open_file(const char *path) {
+	int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+	if (fd < 0) {
+		mb_logf(
+			LOG_ERROR, "failed to open events file \"%s\": %s\n", path,
+			strerror(errno));
+		return false;
+	}
+
+	events_owns_fd = true;
+	return _events_setup(fd);
+}
+
+void mb_events_close(void) {
+	if (events_fd >= 0 && events_owns_fd) {
+		close(events_fd);
+	}
+
+	events_fd = -1;
+}
+
+bool mb_events_enabled(void) {
+	return events_fd >= 0;
+}
+
+void mb_event_build_start(const char *buildfile, const char *target) {
+	event_t event;
+	if (!_event_begin(&event, "build_start")) {
+		return;
+	}
+
+	_event_put_int(&event, "time", (int64_t)time(NULL));
+	_event_put_int(&event, "pid", getpid());
+	_event_put_str(&event, "buildfile", buildfile);
+	_event_put_str(&event, "target", target);
+	_event_emit(&event);
+}
+
+void mb_event_build_end(int status) {
+	event_t event;
+	if (!_event_begin(&event, "build_end")) {
+		return;
+	}
+
+	_event_put_int(&event, "status", status);
+	_event_emit(&event);
+}
+
+void mb_event_target_start(const char *target) {
+	mb_board_target(target);
+
+	event_t event;
+	if (!_event_begin(&event, "target_start")) {
+		return;
+	}
+
+	_event_put_str(&event, "target", target);
+	_event_emit(&event);
+}
+
+void mb_event_target_end(const char *target, int status) {
+	event_t event;
+	if (!_event_begin(&event, "target_end")) {
+		return;
+	}
+
+	_event_put_str(&event, "target", target);
+	_event_put_int(&event, "status", status);
+	_event_emit(&event);
+}
+
+void mb_event_c_rule_start(const char *c_rule, const char *exec_mode) {
+	mb_board_c_rule(c_rule);
+
+	event_t event;
+	if (!_event_begin(&event, "c_rule_start")) {
+		return;
+	}
+
+	_event_put_str(&event, "c_rule", c_rule);
+	_event_put_str(&event, "exec_mode", exec_mode);
+	_event_emit(&event);
+}
+
+void mb_event_c_rule_elements(const char *c_rule, size_t count) {
+	event_t event;
+	if (!_event_begin(&event, "c_rule_elements")) {
+		return;
+	}
+
+	_event_put_str(&event, "c_rule", c_rule);
+	_event_put_int(&event, "count", (int64_t)count);
+	_event_emit(&event);
+}
+
+void mb_event_c_rule_end(const char *c_rule, int status) {
+	event_t event;
+	if (!_event_begin(&event, "c_rule_end")) {
+		return;
+	}
+
+	_event_put_str(&event, "c_rule", c_rule);
+	_event_put_int(&event, "status", status);
+	_event_emit(&event);
+}
+
+void mb_event_job_queued(const char *rule, const char *element) {
+	mb_progress_job_queued();
+	mb_board_job_queued();
+
+	event_t event;
+	if (!_event_begin(&event, "job_queued")) {
+		return;
+	}
+
+	_event_put_str(&event, "rule", rule);
+	_event_put_str(&event, "element", element);
+	_event_emit(&event);
+}
+
+void mb_event_jobs_batched(
+	const char *rule,
+	const char *element,
+	size_t count) {
+	mb_progress_jobs_batched(count);
+	mb_board_jobs_batched(count);
+
+	event_t event;
+	if (!_event_begin(&event, "jobs_batched")) {
+		return;
+	}
+
+	_event_put_str(&event, "rule", rule);
+	_event_put_str(&event, "element", element);
+	_event_put_int(&event, "count", (int64_t)count);
+	_event_emit(&event);
+}
+
+void mb_event_job_spawned(const char *rule, const char *element, int pid) {
+	mb_progress_job_spawned(rule, element, pid);
+	mb_board_job_spawned(rule, element, pid);
+
+	event_t event;
+	if (!_event_begin(&event, "job_spawned")) {
+		return;
+	}
+
+	_event_put_str(&event, "rule", rule);
+	_event_put_str(&event, "element", element);
+	_event_put_int(&event, "pid", pid);
+	_event_emit(&event);
+}
+
+static int64_t _timeval_us(struct timeval tv) {
+	return (int64_t)tv.tv_sec * 1000000 + tv.tv_usec;
+}
+
+void mb_event_job_finished(
+	const char *rule,
+	const char *element,
+	int pid,
+	int status,
+	uint64_t duration_ns,
+	const struct rusage *usage) {
+	mb_progress_job_finished(pid);
+	mb_board_job_finished(pid, status);
+
+	event_t event;
+	if (!_event_begin(&event, "job_finished")) {
+		return;
+	}
+
+	_event_put_str(&event, "rule", rule);
+	_event_put_str(&event, "element", element);
+	_event_put_int(&event, "pid", pid);
+	_event_put_int(&event, "status", status);
+	_event_put_int(&event, "duration_ns", (int64_t)duration_ns);
+
+	if (usage != NULL) {
+		_event_put_int(&event, "utime_us", _timeval_us(usage->ru_utime));
+		_event_put_int(&event, "stime_us", _timeval_us(usage->ru_stime));
+		_event_put_int(&event, "maxrss_kb", mb_rusage_maxrss_kb(usage));
+		_event_put_int(&event, "inblock", usage->ru_inblock);
+		_event_put_int(&event, "oublock", usage->ru_oublock);
+		_event_put_int(&event, "nvcsw", usage->ru_nvcsw);
+		_event_put_int(&event, "nivcsw", usage->ru_nivcsw);
+	}
+
+	_event_emit(&event);
+}
+
+void mb_event_job_skipped(const char *rule, const char *element) {
+	event_t event;
+	if (!_event_begin(&event, "job_skipped")) {
+		return;
+	}
+
+	_event_put_str(&event, "rule", rule);
+	_event_put_str(&event, "element", element);
+	_event_emit(&event);
+}
@@ -0,0 +1,61 @@
+/* events.h ; mariebuild machine-readable progress events header
+ *
+ * Copyright (c) 2025, Marie Eckert
+ * Licensend under the BSD 3-Clause License.
+ */
+
+#ifndef EVENTS_H
+#define EVENTS_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include <sys/resource.h>
+
+/* Bumped whenever an existing event or field changes its meaning. Adding new
+ * events or fields does not bump the version. */
+#define MB_EVENTS_VERSION 1
+
+/**
+ * @brief Emit events to an already open file descriptor.
+ * @return Success?
+ */
+bool mb_events_open_fd(int fd);
+
+/**
+ * @brief Emit events to the given file, the file is truncated.
+ * @return Success?
+ */
+bool mb_events_open_file(const char *path);
+
+void mb_events_close(void);
+
+bool mb_events_enabled(void);
+
+void mb_event_build_start(const char *buildfile, const char *target);
+void mb_event_build_end(int status);
+
+void mb_event_target_start(const char *target);
+void mb_event_target_end(const char *target, int status);
+
+void mb_event_c_rule_start(const char *c_rule, const char *exec_mode);
+void mb_event_c_rule_elements(const char *c_rule, size_t count);
+void mb_event_c_rule_end(const char *c_rule, int status);
+
+void mb_event_job_queued(const char *rule, const char *element);
+void mb_event_jobs_batched(
+	const char *rule,
+	const char *element,
+	size_t count);
+void mb_event_job_spawned(const char *rule, const char *element, int pid);
+void mb_event_job_finished(
+	const char *rule,
+	const char *element,
+	int pid,
+	int status,
+	uint64_t duration_ns,
+	const struct rusage *usage);
+void mb_event_job_skipped(const char *rule, const char *element);
+
+#endif /* #ifndef EVENTS_H */
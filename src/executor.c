@@ -6,25 +6,59 @@
 
 #define _XOPEN_SOURCE 700
 #define _POSIX_C_SOURCE 2
+#define _DEFAULT_SOURCE
 
 #include <errno.h>
 #include <limits.h>
 #include <math.h>
+#include <signal.h>
 #include <stdbool.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <time.h>
 
 #include <fcntl.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
 #include <sys/wait.h>
 #include <unistd.h>
 
+#include "accounting.h"
+#include "capture.h"
+#include "events.h"
 #include "executor.h"
+#include "history.h"
+#include "jobserver.h"
 #include "logging.h"
+#include "mcfg_util.h"
+#include "pools.h"
 #include "signals.h"
+#include "stats.h"
+#include "stringutil.h"
+#include "topology.h"
+#include "workers.h"
 #include "xmem.h"
 
+/* characters which make the shell do more than splitting a command into
+ * words, scripts containing them outside of quotes are run through the shell */
+#define SHELL_SPECIAL_CHARS "|&;<>()$`\\*?[]{}~#!"
+
+/* interpreters whose scripts may be run directly or by a shell worker */
+static const char *shells[] = {"sh", "bash", "dash", "ksh", "zsh"};
+
+#define SHELL_COUNT (sizeof(shells) / sizeof(shells[0]))
+
+/* A script consisting of a single simple command, run without a shell */
+typedef struct direct_command {
+	char path[PATH_MAX];
+	char **argv;
+
+	/* storage of the words argv points into */
+	char *words;
+} direct_command_t;
+
 /* this is such a disgusting hack i dont even want to think about it */
 static uint64_t script_counter = 0;
 
@@ -51,6 +85,8 @@ char *create_name(char *name) {
 }
 
 int _prepare_exec(char *script, char **name) {
+	uint64_t stats_begin = mb_stats_begin();
+
 	*name = create_name(*name);
 	mb_logf(LOG_DEBUG, "writing script to \"%s\"\n", *name);
 
@@ -59,10 +95,9 @@ int _prepare_exec(char *script, char **name) {
 
 	if (outfile == NULL) {
 		mb_logf(LOG_ERROR, "failed to save script to \"%s\"\n", *name);
-		char *errname = strerror(errno);
-		mb_logf(LOG_ERROR, "OS Error %d (%s)\n", errno, errname);
-		XFREE(errname);
+		mb_logf(LOG_ERROR, "OS Error %d (%s)\n", errno, strerror(errno));
 
+		mb_stats_end(STAT_PREPARE_EXEC, stats_begin);
 		return 1;
 	}
 
@@ -71,46 +106,859 @@ int _prepare_exec(char *script, char **name) {
 	fclose(outfile);
 	close(fd);
 
+	mb_stats_end(STAT_PREPARE_EXEC, stats_begin);
 	return 0;
 }
 
-int mb_exec(char *script, char *name) {
-	int ret = _prepare_exec(script, &name);
-	if (ret != 0) {
+/**
+ * @brief Find the shell a script is written for.
+ * @param shell Output for the path of the shell, /bin/sh for scripts without
+ * a shebang
+ * @param body Output for the start of the script after the shebang line
+ * @return false if the interpreter of the script is not a shell or gets
+ * options, which change what the script does (e.g. -e or -x)
+ */
+static bool _script_shell(
+	const char *script,
+	char *shell,
+	size_t shell_size,
+	const char **body) {
+	*body = script;
+	if (strncmp(script, "#!", 2) != 0) {
+		snprintf(shell, shell_size, "/bin/sh");
+		return true;
+	}
+
+	const char *chr = script + 2;
+	chr += strspn(chr, " \t");
+
+	size_t interpreter_len = strcspn(chr, " \t\n");
+	const char *interpreter = chr;
+	chr += interpreter_len;
+
+	chr += strspn(chr, " \t");
+	if (*chr != '\n' && *chr != 0) {
+		return false;
+	}
+
+	const char *base = interpreter;
+	for (size_t ix = 0; ix < interpreter_len; ix++) {
+		if (interpreter[ix] == '/') {
+			base = &interpreter[ix + 1];
+		}
+	}
+
+	size_t base_len = interpreter_len - (size_t)(base - interpreter);
+	for (size_t ix = 0; ix < SHELL_COUNT; ix++) {
+		if (strlen(shells[ix]) == base_len &&
+			strncmp(shells[ix], base, base_len) == 0 &&
+			interpreter_len < shell_size) {
+			snprintf(
+				shell, shell_size, "%.*s", (int)interpreter_len, interpreter);
+			*body = chr;
+			return true;
+		}
+	}
+
+	return false;
+}
+
+ssize_t mb_split_words(
+	const char *line,
+	bool literal,
+	char *words,
+	char **argv) {
+	size_t argc = 0;
+	size_t wix = 0;
+	bool in_word = false;
+	bool line_done = false;
+
+	for (const char *chr = line; *chr != 0; chr++) {
+		char c = *chr;
+
+		if (c == ' ' || c == '\t' || c == '\n') {
+			if (in_word) {
+				words[wix++] = 0;
+				in_word = false;
+			}
+
+			line_done = line_done || (c == '\n' && argc > 0 && !literal);
+			continue;
+		}
+
+		/* a second command */
+		if (line_done) {
+			return -1;
+		}
+
+		if (!in_word) {
+			argv[argc++] = &words[wix];
+			in_word = true;
+		}
+
+		if (c == '\'') {
+			const char *end = strchr(chr + 1, '\'');
+			if (end == NULL) {
+				return -1;
+			}
+
+			size_t len = (size_t)(end - chr - 1);
+			memcpy(&words[wix], chr + 1, len);
+			wix += len;
+			chr = end;
+		} else if (c == '"' && literal) {
+			for (chr++; *chr != '"'; chr++) {
+				if (*chr == '\\' && (chr[1] == '"' || chr[1] == '\\')) {
+					chr++;
+				}
+
+				if (*chr == 0) {
+					return -1;
+				}
+
+				words[wix++] = *chr;
+			}
+		} else if (c == '"') {
+			size_t len = strcspn(chr + 1, "\"$`\\!");
+			if (chr[len + 1] != '"') {
+				return -1;
+			}
+
+			memcpy(&words[wix], chr + 1, len);
+			wix += len;
+			chr += len + 1;
+		} else if (c == '\\' && literal && chr[1] != 0) {
+			words[wix++] = *++chr;
+		} else if (!literal && strchr(SHELL_SPECIAL_CHARS, c) != NULL) {
+			return -1;
+		} else {
+			words[wix++] = c;
+		}
+	}
+
+	if (in_word) {
+		words[wix++] = 0;
+	}
+
+	argv[argc] = NULL;
+	return (ssize_t)argc;
+}
+
+/**
+ * @brief Split a script consisting of a single simple command into its words.
+ * Scripts for an interpreter which is not a shell or which need the shell
+ * for anything but splitting words are rejected.
+ * @return Success?
+ */
+static bool
+_split_simple_command(const char *script, char *words, char **argv) {
+	char shell[PATH_MAX];
+	const char *body;
+	if (!_script_shell(script, shell, sizeof(shell), &body)) {
+		return false;
+	}
+
+	/* an empty script or one starting with a variable assignment */
+	return mb_split_words(body, false, words, argv) > 0 &&
+		   strchr(argv[0], '=') == NULL;
+}
+
+/**
+ * @brief Find the executable a command name refers to like the shell would.
+ * The last lookup is cached since the jobs of a rule all run the same
+ * command.
+ * @return Success?
+ */
+static bool _resolve_command(const char *command, char *path, size_t size) {
+	static char cached_command[PATH_MAX];
+	static char cached_path[PATH_MAX];
+
+	if (strchr(command, '/') != NULL) {
+		snprintf(path, size, "%s", command);
+		return access(path, X_OK) == 0;
+	}
+
+	if (strcmp(command, cached_command) == 0) {
+		snprintf(path, size, "%s", cached_path);
+		return true;
+	}
+
+	const char *search_path = getenv("PATH");
+	if (search_path == NULL) {
+		search_path = "/usr/bin:/bin";
+	}
+
+	while (*search_path != 0) {
+		size_t dir_len = strcspn(search_path, ":");
+
+		/* an empty entry is the current directory */
+		int len;
+		if (dir_len == 0) {
+			len = snprintf(path, size, "%s", command);
+		} else {
+			len = snprintf(
+				path, size, "%.*s/%s", (int)dir_len, search_path, command);
+		}
+
+		struct stat st;
+		if (len > 0 && (size_t)len < size && stat(path, &st) == 0 &&
+			S_ISREG(st.st_mode) && access(path, X_OK) == 0) {
+			snprintf(cached_command, sizeof(cached_command), "%s", command);
+			snprintf(cached_path, sizeof(cached_path), "%s", path);
+			return true;
+		}
+
+		search_path += dir_len;
+		if (*search_path == ':') {
+			search_path++;
+		}
+	}
+
+	return false;
+}
+
+/**
+ * @brief Check if a script can be run without a shell and prepare its
+ * arguments if so.
+ * @param direct Output for the command, has to be freed with _free_direct if
+ * true is returned
+ * @return true if the script is run directly
+ */
+static bool _prepare_direct(
+	char *script,
+	const exec_options_t *options,
+	direct_command_t *direct) {
+	if (options != NULL && !options->direct_exec) {
+		return false;
+	}
+
+	uint64_t stats_begin = mb_stats_begin();
+
+	size_t script_len = strlen(script);
+	char *words = XMALLOC(script_len + 1);
+	char **argv = XMALLOC((script_len / 2 + 2) * sizeof(char *));
+
+	bool ok = _split_simple_command(script, words, argv) &&
+			  _resolve_command(argv[0], direct->path, sizeof(direct->path));
+
+	if (ok) {
+		direct->words = words;
+		direct->argv = argv;
+		mb_logf(LOG_DEBUG, "running \"%s\" without a shell\n", direct->path);
+	} else {
+		XFREE(words);
+		XFREE(argv);
+	}
+
+	mb_stats_end(STAT_PREPARE_EXEC, stats_begin);
+	return ok;
+}
+
+static void _free_direct(direct_command_t *direct) {
+	XFREE(direct->words);
+	XFREE(direct->argv);
+}
+
+bool mb_exec_options_load(mcfg_section_t *section, exec_options_t *options) {
+	*options = (exec_options_t){
+		.pool = NULL,
+		.weight = 1,
+		.memory_limit = 0,
+		.cpu = -1,
+		.batch_count = 1,
+		.token = false,
+		.direct_exec = true,
+		.shell_workers = false,
+		.worker_command = NULL,
+	};
+
+	struct {
+		const char *name;
+		bool *value;
+	} flags[] = {
+		{"direct_exec", &options->direct_exec},
+		{"shell_workers", &options->shell_workers},
+	};
+
+	for (size_t ix = 0; ix < sizeof(flags) / sizeof(flags[0]); ix++) {
+		mcfg_field_t *field = mcfg_get_field(section, (char *)flags[ix].name);
+		if (field == NULL) {
+			continue;
+		}
+
+		if (field->type != TYPE_BOOL) {
+			mb_logf(
+				LOG_ERROR, "%s: field \"%s\" should be of type bool\n",
+				section->name, flags[ix].name);
+			return false;
+		}
+
+		*flags[ix].value = mcfg_data_as_bool(*field);
+	}
+
+	mcfg_field_t *field_pool = mcfg_get_field(section, "pool");
+	if (field_pool != NULL) {
+		char *pool_name = mcfg_data_to_string(*field_pool);
+		options->pool = mb_pool_find(pool_name);
+		if (options->pool == NULL) {
+			mb_logf(
+				LOG_ERROR, "%s: pool \"%s\" is not declared in /config/pools\n",
+				section->name, pool_name);
+		}
+		XFREE(pool_name);
+
+		if (options->pool == NULL) {
+			return false;
+		}
+	}
+
+	struct {
+		const char *name;
+		uint64_t *value;
+	} amounts[] = {
+		{"weight", &options->weight},
+		{"memory_limit", &options->memory_limit},
+	};
+
+	for (size_t ix = 0; ix < sizeof(amounts) / sizeof(amounts[0]); ix++) {
+		mcfg_field_t *field = mcfg_get_field(section, (char *)amounts[ix].name);
+		if (field == NULL) {
+			continue;
+		}
+
+		char *raw = mcfg_data_to_string(*field);
+		bool ok = mb_parse_amount(raw, amounts[ix].value);
+		XFREE(raw);
+
+		if (!ok) {
+			mb_logf(
+				LOG_ERROR, "%s: invalid value for field \"%s\"\n",
+				section->name, amounts[ix].name);
+			return false;
+		}
+	}
+
+	return true;
+}
+
+/**
+ * @brief Replace the forked child with the shell running the script, or with
+ * the command itself if it is run directly.
+ * @param direct The command to run without a shell, NULL to run the script at
+ * location
+ * @param output_fd File stdout and stderr are redirected to, -1 to keep them
+ */
+static _Noreturn void _exec_child(
+	char *location,
+	const direct_command_t *direct,
+	int output_fd,
+	const exec_options_t *options) {
+	signal(SIGPIPE, SIG_DFL);
+
+	if (output_fd >= 0 &&
+		(dup2(output_fd, STDOUT_FILENO) < 0 ||
+		 dup2(output_fd, STDERR_FILENO) < 0)) {
+		perror("dup2");
+		_exit(127);
+	}
+
+	/* a job is cancelled by signalling its process group, which has to
+	 * include everything it starts but not mariebuild itself */
+	setpgid(0, 0);
+
+	if (options != NULL && options->memory_limit != 0) {
+		struct rlimit limit = {
+			.rlim_cur = options->memory_limit,
+			.rlim_max = options->memory_limit,
+		};
+
+		if (setrlimit(RLIMIT_AS, &limit) != 0) {
+			perror("setrlimit(RLIMIT_AS)");
+			_exit(127);
+		}
+	}
+
+	/* not being able to pin only costs performance */
+	if (options != NULL && options->cpu >= 0 &&
+		!mb_topology_pin(0, options->cpu)) {
+		perror("sched_setaffinity");
+	}
+
+	if (direct != NULL) {
+		execv(direct->path, direct->argv);
+		perror("execv");
+		_exit(127);
+	}
+
+	execl("/bin/sh", "sh", "-c", location, (char *)NULL);
+	perror("execl");
+	_exit(127);
+}
+
+/**
+ * @brief Hand a script written to location to a shell worker if the options
+ * ask for it.
+ * @return The worker running the script or NULL if it has to be forked
+ */
+static worker_t *_run_in_worker(
+	char *script,
+	char *rule,
+	char *location,
+	const capture_t *capture,
+	const exec_options_t *options) {
+	if (options == NULL || !options->shell_workers) {
+		return NULL;
+	}
+
+	char shell[PATH_MAX];
+	const char *body;
+	if (!_script_shell(script, shell, sizeof(shell), &body)) {
+		return NULL;
+	}
+
+	worker_t *worker = mb_worker_get(
+		rule, WORKER_KIND_SHELL, shell, options->memory_limit);
+	if (worker == NULL ||
+		!mb_worker_run(worker, location, capture->path, options->cpu)) {
+		return NULL;
+	}
+
+	return worker;
+}
+
+/**
+ * @brief Send the formatted exec of a job as a work request to a persistent
+ * worker of its rule. The words of exec are the arguments of the request. If
+ * the worker went away it is started again.
+ * @return The worker handling the request or NULL on failure
+ */
+static worker_t *_request_persistent(
+	char *script,
+	char *rule,
+	const capture_t *capture,
+	const exec_options_t *options) {
+	size_t script_len = strlen(script);
+	char *words = XMALLOC(script_len + 1);
+	char **argv = XMALLOC((script_len / 2 + 2) * sizeof(char *));
+	worker_t *worker = NULL;
+
+	if (mb_split_words(script, true, words, argv) < 0) {
+		mb_logf(LOG_ERROR, "%s: unbalanced quotes in worker request\n", rule);
 		goto exit;
 	}
 
-	mb_register_tmp_file(name);
+	for (size_t attempt = 0; attempt < 2 && worker == NULL; attempt++) {
+		worker = mb_worker_get(
+			rule, WORKER_KIND_PERSISTENT, options->worker_command,
+			options->memory_limit);
+		if (worker == NULL) {
+			break;
+		}
+
+		if (!mb_worker_request(worker, argv, capture->fd, options->cpu)) {
+			worker = NULL;
+		}
+	}
 
+	if (worker == NULL) {
+		mb_logf(LOG_ERROR, "%s: could not hand the job to a worker\n", rule);
+	}
+
+exit:
+	XFREE(words);
+	XFREE(argv);
+	return worker;
+}
+
+/**
+ * @brief Fork a child running a job in its own process group.
+ * @return The pid of the child or -1 on failure
+ */
+static int _fork_job(
+	char *location,
+	const direct_command_t *direct,
+	const capture_t *capture,
+	const exec_options_t *options) {
 	int pid = fork();
 	if (pid == 0) {
-		execl("/bin/sh", "sh", "-c", name, (char *)NULL);
-		__builtin_unreachable();
+		_exec_child(location, direct, capture->fd, options);
 	}
 
-	waitpid(pid, &ret, 0);
+	if (pid < 0) {
+		mb_logf(LOG_ERROR, "fork failed: %s\n", strerror(errno));
+		return -1;
+	}
 
-	mb_unregister_tmp_file(name);
+	/* also done by the child, whichever runs first wins the race */
+	setpgid(pid, pid);
+	return pid;
+}
 
-exit:
-	XFREE(name);
-	return WEXITSTATUS(ret);
+/**
+ * @brief Split the CPU time of a batch evenly across the jobs in it.
+ */
+static struct timeval _share_timeval(struct timeval tv, size_t count) {
+	int64_t us = ((int64_t)tv.tv_sec * 1000000 + tv.tv_usec) / (int64_t)count;
+	return (struct timeval){.tv_sec = us / 1000000, .tv_usec = us % 1000000};
+}
+
+/**
+ * @brief Record a finished job in the history. A job building a batch of
+ * elements is recorded once for every element, each with an equal share of
+ * the time the job took, so the elements keep their own history no matter
+ * which batch they end up in.
+ */
+static void _record_history(
+	const char *rule,
+	const char *element,
+	size_t batch_count,
+	int status,
+	uint64_t duration,
+	const struct rusage *usage) {
+	if (batch_count <= 1 || element == NULL) {
+		mb_history_record(rule, element, status, duration, usage);
+		return;
+	}
+
+	struct rusage share = {0};
+	if (usage != NULL) {
+		share = *usage;
+		share.ru_utime = _share_timeval(usage->ru_utime, batch_count);
+		share.ru_stime = _share_timeval(usage->ru_stime, batch_count);
+	}
+
+	char *elements = strdup(element);
+	char *word = elements;
+	while (word != NULL) {
+		char *space = strchr(word, ' ');
+		if (space != NULL) {
+			*space = 0;
+		}
+
+		mb_history_record(
+			rule, word, status, duration / batch_count,
+			usage == NULL ? NULL : &share);
+		word = space == NULL ? NULL : space + 1;
+	}
+	XFREE(elements);
 }
 
-process_t mb_exec_parallel(char *script, char *name) {
-	int ret = _prepare_exec(script, &name);
-	if (ret != 0) {
+/**
+ * @brief Get the exit status of a job from its wait status, jobs killed by a
+ * signal fail like they would in a shell.
+ */
+static int _exit_status(int stat) {
+	if (WIFSIGNALED(stat)) {
+		return 128 + WTERMSIG(stat);
+	}
+
+	return WEXITSTATUS(stat);
+}
+
+int mb_exec(
+	char *script,
+	char *name,
+	char *element,
+	const exec_options_t *options) {
+	char *rule = name;
+	pool_t *pool = options == NULL ? NULL : options->pool;
+	uint64_t weight = options == NULL ? 0 : options->weight;
+	int ret = 0;
+
+	/* a persistent worker answers asynchronously anyway */
+	if (options != NULL && options->worker_command != NULL) {
+		mb_log_flush();
+
+		mb_pool_acquire(pool, weight);
+		process_t process = mb_exec_parallel(script, name, element, options);
+		if (!mb_reap_process(&process, true, &ret)) {
+			mb_pool_release(pool, weight);
+			return 1;
+		}
+
+		return ret;
+	}
+
+	direct_command_t direct;
+	bool is_direct = _prepare_direct(script, options, &direct);
+	if (!is_direct) {
+		ret = _prepare_exec(script, &name);
+		if (ret != 0) {
+			XFREE(name);
+			return ret;
+		}
+
+		mb_register_tmp_file(name);
+	}
+
+	/* keep our own output in front of the output of the script */
+	mb_log_flush();
+
+	mb_pool_acquire(pool, weight);
+
+	capture_t capture;
+	mb_capture_begin(&capture, false);
+
+	uint64_t stats_begin = mb_stats_begin();
+	uint64_t started = mb_stats_now();
+	worker_t *worker = NULL;
+	if (!is_direct) {
+		worker = _run_in_worker(script, rule, name, &capture, options);
+	}
+
+	int pid = worker != NULL ? mb_worker_pid(worker)
+							 : _fork_job(
+								   name, is_direct ? &direct : NULL, &capture,
+								   options);
+	mb_stats_end(STAT_FORK, stats_begin);
+	if (pid > 0) {
+		mb_register_job_group(pid);
+	}
+	mb_event_job_spawned(rule, element, pid);
+
+	/* jobs run by a worker are not our children, so their resource usage is
+	 * unknown */
+	struct rusage usage = {0};
+	if (worker != NULL) {
+		mb_worker_poll(worker, true, &ret);
+	} else if (pid < 0) {
+		ret = 1;
+	} else {
+		int stat = 0;
+		while (wait4(pid, &stat, 0, &usage) < 0 && errno == EINTR) {
+		}
+		ret = _exit_status(stat);
+	}
+
+	if (pid > 0) {
+		mb_unregister_job_group(pid);
+	}
+
+	mb_pool_release(pool, weight);
+	uint64_t duration = mb_stats_now() - started;
+	mb_capture_end(&capture, rule, element, ret);
+	mb_event_job_finished(rule, element, pid, ret, duration, &usage);
+	_record_history(
+		rule, element, options == NULL ? 1 : options->batch_count, ret,
+		duration, &usage);
+	mb_accounting_record(duration, &usage);
+
+	if (is_direct) {
+		_free_direct(&direct);
+	} else {
+		mb_remove_script(name);
+		XFREE(name);
+	}
+
+	return ret;
+}
+
+process_t mb_exec_parallel(
+	char *script,
+	char *name,
+	char *element,
+	const exec_options_t *options) {
+	char *rule = name;
+	bool persistent = options != NULL && options->worker_command != NULL;
+
+	direct_command_t direct;
+	bool is_direct = !persistent && _prepare_direct(script, options, &direct);
+	bool has_script = !persistent && !is_direct;
+	/* jobs which could not be started are reported as failed right away */
+	if (has_script && _prepare_exec(script, &name) != 0) {
+		XFREE(name);
+		mb_event_job_finished(rule, element, 0, 1, 0, NULL);
 		return (process_t){.pid = 0, .location = NULL};
 	}
 
-	int pid = fork();
-	if (pid != 0) {
+	capture_t capture;
+	mb_capture_begin(&capture, true);
+
+	uint64_t stats_begin = mb_stats_begin();
+	uint64_t started = mb_stats_now();
+	worker_t *worker = NULL;
+	if (persistent) {
+		worker = _request_persistent(script, rule, &capture, options);
+		if (worker == NULL) {
+			mb_stats_end(STAT_FORK, stats_begin);
+			mb_capture_end(&capture, rule, element, 1);
+			mb_event_job_finished(
+				rule, element, 0, 1, mb_stats_now() - started, NULL);
+			return (process_t){.pid = 0, .location = NULL};
+		}
+	} else if (has_script) {
+		worker = _run_in_worker(script, rule, name, &capture, options);
+	}
+
+	int pid = worker != NULL ? mb_worker_pid(worker)
+							 : _fork_job(
+								   name, is_direct ? &direct : NULL, &capture,
+								   options);
+
+	mb_stats_end(STAT_FORK, stats_begin);
+	if (is_direct) {
+		_free_direct(&direct);
+	} else if (has_script) {
 		mb_register_tmp_file(name);
-		return (process_t){.pid = pid, .location = name};
 	}
 
-	execl("/bin/sh", "sh", "-c", name, (char *)NULL);
-	__builtin_unreachable();
+	if (pid < 0) {
+		mb_capture_end(&capture, rule, element, 1);
+		mb_event_job_finished(
+			rule, element, 0, 1, mb_stats_now() - started, NULL);
+		if (has_script) {
+			mb_remove_script(name);
+			XFREE(name);
+		}
+		return (process_t){.pid = 0, .location = NULL};
+	}
+
+	mb_register_job_group(pid);
+	mb_event_job_spawned(rule, element, pid);
+
+	process_t process = {
+		.pid = pid,
+		.location = has_script ? name : NULL,
+		.worker = worker,
+		.name = rule,
+		.element = element == NULL ? NULL : strdup(element),
+		.started = started,
+		.pool = options == NULL ? NULL : options->pool,
+		.weight = options == NULL ? 0 : options->weight,
+		.token = options != NULL && options->token,
+		.batch_count = options == NULL ? 1 : options->batch_count,
+		.capture = capture,
+	};
+
+	return process;
+}
+
+/**
+ * @brief Report a process which exited and reset it to an unused state.
+ */
+static void _finish_process(
+	process_t *process,
+	int exit_status,
+	const struct rusage *usage) {
+	mb_unregister_job_group(process->pid);
+	uint64_t duration = mb_stats_now() - process->started;
+	mb_capture_end(
+		&process->capture, process->name, process->element, exit_status);
+	mb_event_job_finished(
+		process->name, process->element, process->pid, exit_status, duration,
+		usage);
+	_record_history(
+		process->name, process->element, process->batch_count, exit_status,
+		duration, usage);
+	mb_accounting_record(duration, usage);
+
+	mb_pool_release(process->pool, process->weight);
+	mb_jobserver_release(process->token);
+
+	if (process->location != NULL) {
+		mb_remove_script(process->location);
+		XFREE(process->location);
+	}
+
+	if (process->element != NULL) {
+		XFREE(process->element);
+	}
+
+	*process = (process_t){.pid = 0, .location = NULL};
+}
+
+bool mb_reap_process(process_t *process, bool block, int *exit_status) {
+	if (process->pid == 0) {
+		return false;
+	}
+
+	int stat = 0;
+	struct rusage usage = {0};
+	if (process->worker != NULL) {
+		if (!mb_worker_poll(process->worker, block, exit_status)) {
+			return false;
+		}
+	} else {
+		if (wait4(process->pid, &stat, block ? 0 : WNOHANG, &usage) <= 0) {
+			return false;
+		}
+
+		*exit_status = _exit_status(stat);
+	}
+
+	_finish_process(process, *exit_status, &usage);
+	return true;
+}
+
+void mb_cancel_processes(process_t *processes, size_t count) {
+	const struct timespec poll_interval = {
+		.tv_sec = 0, .tv_nsec = MB_CANCEL_POLL_NS};
+
+	size_t running = 0;
+	for (size_t ix = 0; ix < count; ix++) {
+		if (processes[ix].pid == 0) {
+			continue;
+		}
+
+		/* a worker outlives its job, only one still running its job is
+		 * stopped, it shares its group with the job */
+		int exit_status;
+		if (processes[ix].worker != NULL &&
+			mb_reap_process(&processes[ix], false, &exit_status)) {
+			continue;
+		}
+
+		kill(-processes[ix].pid, SIGTERM);
+		running++;
+	}
+
+	if (running == 0) {
+		return;
+	}
+
+	mb_logf(LOG_INFO, "cancelling %zu running jobs\n", running);
+
+	uint64_t deadline = mb_stats_now() + MB_CANCEL_GRACE_NS;
+
+	for (size_t ix = 0; ix < count; ix++) {
+		if (processes[ix].pid == 0 || processes[ix].worker == NULL) {
+			continue;
+		}
+
+		mb_worker_cancel(processes[ix].worker, deadline);
+		struct rusage usage = {0};
+		_finish_process(&processes[ix], 128 + SIGTERM, &usage);
+	}
+
+	bool killed = false;
+	while (running > 0) {
+		bool kill_now = !killed && mb_stats_now() >= deadline;
+		killed = killed || kill_now;
+
+		running = 0;
+		for (size_t ix = 0; ix < count; ix++) {
+			int pgid = processes[ix].pid;
+			int exit_status;
+			if (pgid == 0) {
+				continue;
+			}
+
+			/* whatever the job left behind in its group goes with it */
+			if (mb_reap_process(&processes[ix], false, &exit_status)) {
+				kill(-pgid, SIGKILL);
+				continue;
+			}
+
+			if (kill_now) {
+				kill(-pgid, SIGKILL);
+			}
+			running++;
+		}
+
+		if (running > 0) {
+			nanosleep(&poll_interval, NULL);
+		}
+	}
 }
 
 void mb_remove_script(char *script) {
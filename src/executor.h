@@ -7,16 +7,152 @@
 #ifndef EXECUTOR_H
 #define EXECUTOR_H
 
+#include <stdbool.h>
+#include <stdint.h>
+
+#include <sys/types.h>
+
+#include "capture.h"
+#include "mcfg.h"
+#include "pools.h"
+#include "workers.h"
+
+/* Options for running a job, loaded from the c_rule or target it belongs to */
+typedef struct exec_options {
+	/* the pool the job is admitted to, may be NULL */
+	pool_t *pool;
+	uint64_t weight;
+
+	/* limit of the address space of every process of the job in bytes
+	 * (RLIMIT_AS), 0 for no limit */
+	uint64_t memory_limit;
+
+	/* CPU the job is pinned to, -1 to not pin it */
+	int cpu;
+
+	/* whether the job holds a jobserver token, see jobserver.h */
+	bool token;
+
+	/* number of elements the job builds at once, its element lists them
+	 * separated by spaces */
+	size_t batch_count;
+
+	/* run scripts which are a single simple command without a shell */
+	bool direct_exec;
+
+	/* run scripts in long-lived shells instead of starting one per job */
+	bool shell_workers;
+
+	/* command line of the persistent worker the jobs are sent to as work
+	 * requests, NULL to run them as scripts. Owned by the caller. */
+	char *worker_command;
+} exec_options_t;
+
 typedef struct process {
 	int pid;
 
 	char *location;
+
+	/* the shell worker running the script, NULL if the process was forked */
+	worker_t *worker;
+
+	/* name of the rule or target and the element the process builds, used
+	 * for reporting only. */
+	char *name;
+	char *element;
+	uint64_t started;
+
+	/* released when the process is reaped */
+	pool_t *pool;
+	uint64_t weight;
+	bool token;
+
+	size_t batch_count;
+
+	/* printed when the process is reaped */
+	capture_t capture;
 } process_t;
 
-int mb_exec(char *script, char *name);
+/**
+ * @brief Split a command line into words, single and double quotes are
+ * removed like the shell would.
+ * @param literal Take everything else literally apart from backslashes
+ * escaping the next character and allow several lines.
+ * Otherwise anything the shell would have to interpret (expansions, globs,
+ * redirections, pipes, several commands, ...) makes this fail.
+ * @param words Buffer of at least strlen(line) + 1 bytes for the words
+ * @param argv Buffer of at least strlen(line) / 2 + 2 pointers, filled with
+ * the words and a terminating NULL
+ * @return The number of words or -1 on failure
+ */
+ssize_t mb_split_words(
+	const char *line,
+	bool literal,
+	char *words,
+	char **argv);
+
+/**
+ * @brief Load the pool, weight, memory_limit, direct_exec and shell_workers
+ * fields of a c_rule or target.
+ * @param options Output for the options, fields which are not present are set
+ * to their defaults
+ * @return Success?
+ */
+bool mb_exec_options_load(mcfg_section_t *section, exec_options_t *options);
+
+/**
+ * @brief Run a script and wait for it to exit.
+ * @param name The name of the rule or target the script belongs to
+ * @param element The element the script is run for, may be NULL
+ * @param options The options for the job, may be NULL
+ * @return The exit status of the script
+ */
+int mb_exec(
+	char *script,
+	char *name,
+	char *element,
+	const exec_options_t *options);
+
+/**
+ * @brief Start a script without waiting for it to exit. The returned process
+ * has to be passed to mb_reap_process eventually. The caller has to take the
+ * room of the job in its pool, it is released when the process is reaped.
+ */
+process_t mb_exec_parallel(
+	char *script,
+	char *name,
+	char *element,
+	const exec_options_t *options);
 
-process_t mb_exec_parallel(char *script, char *name);
+/**
+ * @brief Reap a process started by mb_exec_parallel if it has exited. The
+ * captured output of the process is printed, its script is removed and the
+ * process is reset to an unused state (pid 0).
+ * @param block Wait for the process to exit
+ * @param exit_status Output for the exit status of the process
+ * @return true if the process was reaped
+ */
+bool mb_reap_process(process_t *process, bool block, int *exit_status);
+
+/**
+ * @brief Cancel running processes started by mb_exec_parallel. Their process
+ * groups get SIGTERM and, if they are still running after
+ * MB_CANCEL_GRACE_NS, SIGKILL. All of them are reaped. Workers still running
+ * a job are stopped with it, the others are left alone.
+ * @param count The amount of processes in the array, unused ones (pid 0) are
+ * skipped
+ */
+void mb_cancel_processes(process_t *processes, size_t count);
 
 void mb_remove_script(char *script);
 
+/**
+ * @brief Write a script to a new temporary file. Exposed for the
+ * microbenchmarks in bench/microbench.c
+ * @param name Name to base the file name on, replaced with the heap allocated
+ * path of the file.
+ * @return 0 on success
+ */
+int _prepare_exec(char *script, char **name);
+
 #endif /* #ifndef EXECUTOR_H */
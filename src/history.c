@@ -0,0 +1,829 @@
+/* history.c ; mariebuild per-element job history
+ *
+ * The history file is a tab separated text file. The first line is a header
+ * containing the version and the size of the file after it was last
+ * compacted, every other line is one finished job:
+ *
+ *   time  status  wall_ns  cpu_us  maxrss_kb  rule  element
+ *
+ * New jobs are appended after every build while holding an exclusive flock on
+ * the file, so concurrent builds in the same directory do not interleave.
+ * Once the file has doubled in size since the last compaction it is rewritten
+ * to only contain the last MB_HISTORY_KEEP samples of every rule/element pair.
+ *
+ * Copyright (c) 2025, Marie Eckert
+ * Licensend under the BSD 3-Clause License.
+ */
+
+#define _XOPEN_SOURCE 700
+#define _POSIX_C_SOURCE 200809L
+#define _DEFAULT_SOURCE
+
+#include <errno.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include <fcntl.h>
+#include <sys/file.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "history.h"
+#include "logging.h"
+#include "stats.h"
+#include "stringutil.h"
+#include "xmem.h"
+
+#define HISTORY_MAGIC "mb_history"
+
+/* the compacted size is padded so the header always has the same size */
+#define HISTORY_HEADER_FORMAT HISTORY_MAGIC " %d %020llu\n"
+#define HISTORY_HEADER_SIZE 34
+
+/* the history file is never compacted below this size */
+#define HISTORY_COMPACT_MIN (256 * 1024)
+
+#define HISTORY_INITIAL_TABLE_SIZE 256
+
+/* a regression is only reported if there are at least this many earlier
+ * samples to compare against */
+#define REPORT_MIN_BASELINE 3
+
+/* jobs faster than this are too noisy to report as regressions */
+#define REPORT_MIN_WALL_NS 10000000ull
+
+#define REPORT_TOP 10
+
+/* lines of jobs finished during this build which have not been saved yet */
+static char *pending = NULL;
+static size_t pending_len = 0;
+static size_t pending_size = 0;
+
+static void _pending_append(const char *str) {
+	size_t len = strlen(str);
+	if (pending_len + len + 1 > pending_size) {
+		while (pending_len + len + 1 > pending_size) {
+			pending_size = pending_size == 0 ? 4096 : pending_size * 2;
+		}
+		pending = pending == NULL ? XMALLOC(pending_size)
+								  : XREALLOC(pending, pending_size);
+	}
+
+	memcpy(pending + pending_len, str, len);
+	pending_len += len;
+	pending[pending_len] = 0;
+}
+
+/* tabs and newlines would break the format */
+static void _pending_append_field(const char *str) {
+	size_t start = pending_len;
+	_pending_append(str == NULL ? "" : str);
+
+	for (size_t ix = start; ix < pending_len; ix++) {
+		if (pending[ix] == '\t' || pending[ix] == '\n') {
+			pending[ix] = ' ';
+		}
+	}
+}
+
+static int64_t _timeval_us(struct timeval tv) {
+	return (int64_t)tv.tv_sec * 1000000 + tv.tv_usec;
+}
+
+void mb_history_record(
+	const char *rule,
+	const char *element,
+	int status,
+	uint64_t wall_ns,
+	const struct rusage *usage) {
+	int64_t cpu_us = 0;
+	int64_t maxrss_kb = 0;
+	if (usage != NULL) {
+		cpu_us = _timeval_us(usage->ru_utime) + _timeval_us(usage->ru_stime);
+		maxrss_kb = mb_rusage_maxrss_kb(usage);
+	}
+
+	char numbers[128];
+	snprintf(
+		numbers, sizeof(numbers), "%lld\t%d\t%llu\t%lld\t%lld\t",
+		(long long)time(NULL), status, (unsigned long long)wall_ns,
+		(long long)cpu_us, (long long)maxrss_kb);
+
+	_pending_append(numbers);
+	_pending_append_field(rule);
+	_pending_append("\t");
+	_pending_append_field(element);
+	_pending_append("\n");
+}
+
+/******** in-memory history ********/
+
+static uint64_t _hash_key(const char *rule, const char *element) {
+	/* FNV-1a */
+	uint64_t hash = 0xcbf29ce484222325ull;
+	for (const char *chr = rule; *chr != 0; chr++) {
+		hash = (hash ^ (unsigned char)*chr) * 0x100000001b3ull;
+	}
+
+	hash = (hash ^ '\t') * 0x100000001b3ull;
+	for (const char *chr = element; *chr != 0; chr++) {
+		hash = (hash ^ (unsigned char)*chr) * 0x100000001b3ull;
+	}
+
+	return hash;
+}
+
+/**
+ * @brief Find the table slot of a key, either the one holding the key or the
+ * empty slot the key would be inserted into.
+ */
+static size_t *
+_find_slot(history_t *history, const char *rule, const char *element) {
+	size_t mask = history->table_size - 1;
+	size_t slot = _hash_key(rule, element) & mask;
+
+	for (;;) {
+		size_t ix = history->table[slot];
+		if (ix == 0) {
+			return &history->table[slot];
+		}
+
+		history_entry_t *entry = &history->entries[ix - 1];
+		if (strcmp(entry->rule, rule) == 0 &&
+			strcmp(entry->element, element) == 0) {
+			return &history->table[slot];
+		}
+
+		slot = (slot + 1) & mask;
+	}
+}
+
+static void _grow_table(history_t *history) {
+	if (history->table != NULL) {
+		XFREE(history->table);
+	}
+
+	history->table_size = history->table_size == 0 ? HISTORY_INITIAL_TABLE_SIZE
+												   : history->table_size * 2;
+	history->table = XCALLOC(history->table_size, sizeof(size_t));
+
+	for (size_t ix = 0; ix < history->entry_count; ix++) {
+		history_entry_t *entry = &history->entries[ix];
+		*_find_slot(history, entry->rule, entry->element) = ix + 1;
+	}
+}
+
+static history_entry_t *
+_get_entry(history_t *history, const char *rule, const char *element) {
+	/* keep the load factor below 1/2 */
+	if ((history->entry_count + 1) * 2 > history->table_size) {
+		_grow_table(history);
+	}
+
+	size_t *slot = _find_slot(history, rule, element);
+	if (*slot != 0) {
+		return &history->entries[*slot - 1];
+	}
+
+	if (history->entry_count == history->entry_capacity) {
+		history->entry_capacity =
+			history->entry_capacity == 0 ? 64 : history->entry_capacity * 2;
+		history->entries = history->entries == NULL
+							   ? XMALLOC(
+									 history->entry_capacity *
+									 sizeof(history_entry_t))
+							   : XREALLOC(
+									 history->entries,
+									 history->entry_capacity *
+										 sizeof(history_entry_t));
+	}
+
+	history_entry_t *entry = &history->entries[history->entry_count];
+	entry->rule = strdup(rule);
+	entry->element = strdup(element);
+	entry->sample_count = 0;
+
+	history->entry_count++;
+	*slot = history->entry_count;
+
+	return entry;
+}
+
+static void _add_sample(history_entry_t *entry, history_sample_t sample) {
+	if (entry->sample_count == MB_HISTORY_KEEP) {
+		memmove(
+			&entry->samples[0], &entry->samples[1],
+			(MB_HISTORY_KEEP - 1) * sizeof(history_sample_t));
+		entry->sample_count--;
+	}
+
+	entry->samples[entry->sample_count++] = sample;
+}
+
+history_entry_t *
+mb_history_find(history_t *history, const char *rule, const char *element) {
+	if (history->table_size == 0) {
+		return NULL;
+	}
+
+	size_t ix = *_find_slot(history, rule, element == NULL ? "" : element);
+	return ix == 0 ? NULL : &history->entries[ix - 1];
+}
+
+void mb_history_free(history_t *history) {
+	for (size_t ix = 0; ix < history->entry_count; ix++) {
+		XFREE(history->entries[ix].rule);
+		XFREE(history->entries[ix].element);
+	}
+
+	if (history->entries != NULL) {
+		XFREE(history->entries);
+	}
+
+	if (history->table != NULL) {
+		XFREE(history->table);
+	}
+
+	*history = (history_t){0};
+}
+
+/******** reading and writing ********/
+
+static history_t previous;
+static bool previous_loaded = false;
+
+/**
+ * @brief Parse a single line, modifies the line.
+ * @return Success?
+ */
+static bool _parse_line(char *line, history_t *history) {
+	char *fields[7];
+	for (size_t ix = 0; ix < 7; ix++) {
+		fields[ix] = strsep(&line, "\t");
+		if (fields[ix] == NULL) {
+			return false;
+		}
+	}
+
+	history_sample_t sample = {
+		.time = strtoll(fields[0], NULL, 10),
+		.status = (int)strtol(fields[1], NULL, 10),
+		.wall_ns = strtoull(fields[2], NULL, 10),
+		.cpu_us = strtoll(fields[3], NULL, 10),
+		.maxrss_kb = strtoll(fields[4], NULL, 10),
+	};
+
+	_add_sample(_get_entry(history, fields[5], fields[6]), sample);
+	return true;
+}
+
+static char *_read_all(int fd, size_t *len) {
+	struct stat st;
+	if (fstat(fd, &st) != 0) {
+		return NULL;
+	}
+
+	size_t size = (size_t)st.st_size + 1;
+	char *data = XMALLOC(size);
+	*len = 0;
+
+	for (;;) {
+		if (*len + 1 == size) {
+			size *= 2;
+			data = XREALLOC(data, size);
+		}
+
+		ssize_t res = pread(fd, data + *len, size - *len - 1, *len);
+		if (res < 0) {
+			if (errno == EINTR) {
+				continue;
+			}
+
+			XFREE(data);
+			return NULL;
+		}
+
+		if (res == 0) {
+			break;
+		}
+
+		*len += res;
+	}
+
+	data[*len] = 0;
+	return data;
+}
+
+/**
+ * @brief Parse the header of a history file.
+ * @return Success?
+ */
+static bool _parse_header(const char *data, uint64_t *compacted_size) {
+	int version = 0;
+	unsigned long long compacted = 0;
+	if (sscanf(data, HISTORY_MAGIC " %d %llu", &version, &compacted) != 2) {
+		return false;
+	}
+
+	if (version != MB_HISTORY_VERSION) {
+		return false;
+	}
+
+	if (compacted_size != NULL) {
+		*compacted_size = compacted;
+	}
+
+	return true;
+}
+
+/**
+ * @brief Parse the contents of a history file, modifies data.
+ */
+static bool _parse_history(char *data, history_t *history) {
+	if (!_parse_header(data, NULL)) {
+		return false;
+	}
+
+	char *line = strchr(data, '\n');
+	while (line != NULL && *(++line) != 0) {
+		char *next = strchr(line, '\n');
+		if (next == NULL) {
+			/* a partially written line */
+			break;
+		}
+
+		*next = 0;
+		if (!_parse_line(line, history)) {
+			mb_logf(LOG_DEBUG, "skipping malformed history line\n");
+		}
+		line = next;
+	}
+
+	return true;
+}
+
+bool mb_history_load(const char *path, history_t *history) {
+	*history = (history_t){0};
+
+	int fd = open(path, O_RDONLY);
+	if (fd < 0) {
+		return errno == ENOENT;
+	}
+
+	flock(fd, LOCK_SH);
+
+	size_t len;
+	char *data = _read_all(fd, &len);
+
+	flock(fd, LOCK_UN);
+	close(fd);
+
+	if (data == NULL) {
+		mb_logf(
+			LOG_WARNING, "failed to read \"%s\": %s\n", path, strerror(errno));
+		return false;
+	}
+
+	bool ok = len == 0 || _parse_history(data, history);
+	if (!ok) {
+		mb_logf(LOG_WARNING, "\"%s\" is not a valid history file\n", path);
+	}
+
+	XFREE(data);
+	return ok;
+}
+
+history_t *mb_history_previous(void) {
+	if (!previous_loaded) {
+		uint64_t begin = mb_stats_now();
+		if (!mb_history_load(MB_HISTORY_FILE, &previous)) {
+			mb_history_free(&previous);
+		}
+
+		mb_logf(
+			LOG_DEBUG, "loaded history of %zu elements in %.1fms\n",
+			previous.entry_count, (double)(mb_stats_now() - begin) / 1000000);
+		previous_loaded = true;
+	}
+
+	return &previous;
+}
+
+void mb_history_release(void) {
+	if (previous_loaded) {
+		mb_history_free(&previous);
+		previous_loaded = false;
+	}
+}
+
+static bool _write_all(int fd, const char *data, size_t len) {
+	while (len > 0) {
+		ssize_t res = write(fd, data, len);
+		if (res < 0) {
+			if (errno == EINTR) {
+				continue;
+			}
+			return false;
+		}
+
+		data += res;
+		len -= res;
+	}
+
+	return true;
+}
+
+static void _put_header(char *header, uint64_t compacted_size) {
+	snprintf(
+		header, HISTORY_HEADER_SIZE + 1, HISTORY_HEADER_FORMAT,
+		MB_HISTORY_VERSION, (unsigned long long)compacted_size);
+}
+
+/**
+ * @brief Rewrite the history file to only contain the last MB_HISTORY_KEEP
+ * samples of every rule/element pair. Expects fd to be locked exclusively.
+ */
+static bool _compact(const char *path, int fd) {
+	size_t len;
+	char *data = _read_all(fd, &len);
+	if (data == NULL) {
+		return false;
+	}
+
+	history_t history = {0};
+	bool ok = _parse_history(data, &history);
+	XFREE(data);
+
+	if (!ok) {
+		return false;
+	}
+
+	size_t tmp_path_size = strlen(path) + 5;
+	char *tmp_path = XMALLOC(tmp_path_size);
+	snprintf(tmp_path, tmp_path_size, "%s.tmp", path);
+
+	int tmp_fd = open(tmp_path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+	if (tmp_fd < 0) {
+		XFREE(tmp_path);
+		mb_history_free(&history);
+		return false;
+	}
+
+	char header[HISTORY_HEADER_SIZE + 1];
+	_put_header(header, 0);
+	ok = _write_all(tmp_fd, header, HISTORY_HEADER_SIZE);
+
+	char line[128];
+	uint64_t written = HISTORY_HEADER_SIZE;
+	for (size_t ix = 0; ok && ix < history.entry_count; ix++) {
+		history_entry_t *entry = &history.entries[ix];
+		for (size_t six = 0; ok && six < entry->sample_count; six++) {
+			history_sample_t *sample = &entry->samples[six];
+			int line_len = snprintf(
+				line, sizeof(line), "%lld\t%d\t%llu\t%lld\t%lld\t",
+				(long long)sample->time, sample->status,
+				(unsigned long long)sample->wall_ns,
+				(long long)sample->cpu_us, (long long)sample->maxrss_kb);
+
+			ok = _write_all(tmp_fd, line, line_len) &&
+				 _write_all(tmp_fd, entry->rule, strlen(entry->rule)) &&
+				 _write_all(tmp_fd, "\t", 1) &&
+				 _write_all(tmp_fd, entry->element, strlen(entry->element)) &&
+				 _write_all(tmp_fd, "\n", 1);
+
+			written +=
+				line_len + strlen(entry->rule) + strlen(entry->element) + 2;
+		}
+	}
+
+	_put_header(header, written);
+	ok = ok && pwrite(tmp_fd, header, HISTORY_HEADER_SIZE, 0) ==
+				   (ssize_t)HISTORY_HEADER_SIZE;
+
+	close(tmp_fd);
+	mb_history_free(&history);
+
+	if (ok && rename(tmp_path, path) != 0) {
+		ok = false;
+	}
+
+	if (!ok) {
+		remove(tmp_path);
+	}
+
+	XFREE(tmp_path);
+	return ok;
+}
+
+/**
+ * @brief Open and exclusively lock the history file. Retries if the file was
+ * replaced by a compaction while waiting for the lock.
+ * @return The file descriptor or -1 on error
+ */
+static int _open_locked(const char *path) {
+	for (;;) {
+		int fd = open(path, O_RDWR | O_CREAT | O_APPEND, 0644);
+		if (fd < 0) {
+			return -1;
+		}
+
+		if (flock(fd, LOCK_EX) != 0) {
+			close(fd);
+			return -1;
+		}
+
+		struct stat fd_stat;
+		struct stat path_stat;
+		if (fstat(fd, &fd_stat) == 0 && stat(path, &path_stat) == 0 &&
+			fd_stat.st_ino == path_stat.st_ino &&
+			fd_stat.st_dev == path_stat.st_dev) {
+			return fd;
+		}
+
+		close(fd);
+	}
+}
+
+bool mb_history_save(const char *path) {
+	if (pending_len == 0) {
+		return true;
+	}
+
+	bool ok = false;
+
+	int fd = _open_locked(path);
+	if (fd < 0) {
+		goto exit;
+	}
+
+	struct stat st;
+	if (fstat(fd, &st) != 0) {
+		goto exit;
+	}
+
+	uint64_t compacted_size = 0;
+	if (st.st_size == 0) {
+		char header[HISTORY_HEADER_SIZE + 1];
+		_put_header(header, HISTORY_HEADER_SIZE);
+		if (!_write_all(fd, header, HISTORY_HEADER_SIZE)) {
+			goto exit;
+		}
+	} else {
+		char header[HISTORY_HEADER_SIZE + 1] = {0};
+		if (pread(fd, header, HISTORY_HEADER_SIZE, 0) < 0 ||
+			!_parse_header(header, &compacted_size)) {
+			/* do not touch a file we do not understand */
+			mb_logf(
+				LOG_WARNING, "\"%s\" is not a valid history file\n", path);
+			errno = 0;
+			goto exit;
+		}
+	}
+
+	if (!_write_all(fd, pending, pending_len)) {
+		goto exit;
+	}
+
+	ok = true;
+
+	if (fstat(fd, &st) == 0 && st.st_size > HISTORY_COMPACT_MIN &&
+		(uint64_t)st.st_size > compacted_size * 2) {
+		mb_logf(LOG_DEBUG, "compacting \"%s\"\n", path);
+		if (!_compact(path, fd)) {
+			mb_logf(
+				LOG_WARNING, "failed to compact \"%s\": %s\n", path,
+				strerror(errno));
+		}
+	}
+
+exit:
+	if (!ok && errno != 0) {
+		mb_logf(
+			LOG_WARNING, "failed to write history to \"%s\": %s\n", path,
+			strerror(errno));
+	}
+
+	if (fd >= 0) {
+		flock(fd, LOCK_UN);
+		close(fd);
+	}
+
+	XFREE(pending);
+	pending = NULL;
+	pending_len = 0;
+	pending_size = 0;
+
+	return ok;
+}
+
+/******** reporting ********/
+
+static int _compare_u64(const void *a, const void *b) {
+	uint64_t ua = *(const uint64_t *)a;
+	uint64_t ub = *(const uint64_t *)b;
+	return (ua > ub) - (ua < ub);
+}
+
+/**
+ * @brief Median wall time of the first count samples of an entry, failed
+ * samples are ignored.
+ * @param used Output for the number of samples used, may be NULL
+ */
+static uint64_t
+_median_wall(const history_entry_t *entry, size_t count, size_t *used) {
+	uint64_t walls[MB_HISTORY_KEEP];
+	size_t wall_count = 0;
+
+	for (size_t ix = 0; ix < count; ix++) {
+		if (entry->samples[ix].status == 0) {
+			walls[wall_count++] = entry->samples[ix].wall_ns;
+		}
+	}
+
+	if (used != NULL) {
+		*used = wall_count;
+	}
+
+	if (wall_count == 0) {
+		return 0;
+	}
+
+	qsort(walls, wall_count, sizeof(uint64_t), &_compare_u64);
+	if (wall_count % 2 == 1) {
+		return walls[wall_count / 2];
+	}
+
+	return (walls[wall_count / 2 - 1] + walls[wall_count / 2]) / 2;
+}
+
+uint64_t mb_history_median_wall(const history_entry_t *entry) {
+	return _median_wall(entry, entry->sample_count, NULL);
+}
+
+static const history_sample_t *_latest(const history_entry_t *entry) {
+	return &entry->samples[entry->sample_count - 1];
+}
+
+static double _ms(uint64_t ns) {
+	return (double)ns / 1000000.0;
+}
+
+static const char *_element_name(const history_entry_t *entry) {
+	return entry->element[0] == 0 ? "-" : entry->element;
+}
+
+static int _compare_latest_wall(const void *a, const void *b) {
+	const history_entry_t *ea = *(history_entry_t *const *)a;
+	const history_entry_t *eb = *(history_entry_t *const *)b;
+	uint64_t wa = _latest(ea)->wall_ns;
+	uint64_t wb = _latest(eb)->wall_ns;
+	return (wa < wb) - (wa > wb);
+}
+
+typedef struct rule_total {
+	const char *rule;
+	size_t elements;
+	uint64_t wall_ns;
+	int64_t cpu_us;
+} rule_total_t;
+
+static int _compare_rule_total(const void *a, const void *b) {
+	const rule_total_t *ta = a;
+	const rule_total_t *tb = b;
+	return (ta->wall_ns < tb->wall_ns) - (ta->wall_ns > tb->wall_ns);
+}
+
+static void _report_slowest(history_t *history) {
+	history_entry_t **sorted =
+		XMALLOC(history->entry_count * sizeof(history_entry_t *));
+	for (size_t ix = 0; ix < history->entry_count; ix++) {
+		sorted[ix] = &history->entries[ix];
+	}
+
+	qsort(
+		sorted, history->entry_count, sizeof(history_entry_t *),
+		&_compare_latest_wall);
+
+	printf("slowest elements (latest run):\n");
+	printf(
+		"  %-20s %-40s %10s %10s %10s\n", "rule", "element", "wall (ms)",
+		"cpu (ms)", "rss (KiB)");
+
+	for (size_t ix = 0; ix < history->entry_count && ix < REPORT_TOP; ix++) {
+		const history_sample_t *sample = _latest(sorted[ix]);
+		printf(
+			"  %-20s %-40s %10.1f %10.1f %10lld\n", sorted[ix]->rule,
+			_element_name(sorted[ix]), _ms(sample->wall_ns),
+			(double)sample->cpu_us / 1000.0, (long long)sample->maxrss_kb);
+	}
+
+	XFREE(sorted);
+}
+
+static void _report_rule_totals(history_t *history) {
+	rule_total_t *totals = XCALLOC(history->entry_count, sizeof(rule_total_t));
+	size_t total_count = 0;
+
+	for (size_t ix = 0; ix < history->entry_count; ix++) {
+		history_entry_t *entry = &history->entries[ix];
+
+		rule_total_t *total = NULL;
+		for (size_t tix = 0; tix < total_count; tix++) {
+			if (strcmp(totals[tix].rule, entry->rule) == 0) {
+				total = &totals[tix];
+				break;
+			}
+		}
+
+		if (total == NULL) {
+			total = &totals[total_count++];
+			total->rule = entry->rule;
+		}
+
+		total->elements++;
+		total->wall_ns += _latest(entry)->wall_ns;
+		total->cpu_us += _latest(entry)->cpu_us;
+	}
+
+	qsort(totals, total_count, sizeof(rule_total_t), &_compare_rule_total);
+
+	printf("\nper-rule totals (latest run of every element):\n");
+	printf(
+		"  %-20s %10s %12s %12s\n", "rule", "elements", "wall (ms)",
+		"cpu (ms)");
+
+	for (size_t ix = 0; ix < total_count; ix++) {
+		printf(
+			"  %-20s %10zu %12.1f %12.1f\n", totals[ix].rule,
+			totals[ix].elements, _ms(totals[ix].wall_ns),
+			(double)totals[ix].cpu_us / 1000.0);
+	}
+
+	XFREE(totals);
+}
+
+static void _report_regressions(history_t *history, double threshold) {
+	printf(
+		"\nregressions (more than %.0f%% over the rolling median):\n",
+		threshold);
+
+	size_t regressions = 0;
+	for (size_t ix = 0; ix < history->entry_count; ix++) {
+		history_entry_t *entry = &history->entries[ix];
+		const history_sample_t *latest = _latest(entry);
+		if (latest->status != 0 || latest->wall_ns < REPORT_MIN_WALL_NS) {
+			continue;
+		}
+
+		size_t used;
+		uint64_t median = _median_wall(entry, entry->sample_count - 1, &used);
+		if (used < REPORT_MIN_BASELINE || median == 0) {
+			continue;
+		}
+
+		double change =
+			((double)latest->wall_ns - (double)median) / (double)median * 100;
+		if (change <= threshold) {
+			continue;
+		}
+
+		if (regressions == 0) {
+			printf(
+				"  %-20s %-40s %10s %10s %8s\n", "rule", "element",
+				"median", "latest", "change");
+		}
+
+		printf(
+			"  %-20s %-40s %10.1f %10.1f %+7.0f%%\n", entry->rule,
+			_element_name(entry), _ms(median), _ms(latest->wall_ns), change);
+		regressions++;
+	}
+
+	if (regressions == 0) {
+		printf("  none\n");
+	}
+}
+
+int mb_history_report(const char *path, double threshold) {
+	history_t history;
+	if (!mb_history_load(path, &history)) {
+		return 1;
+	}
+
+	if (history.entry_count == 0) {
+		mb_logf(LOG_ERROR, "no history recorded in \"%s\" yet\n", path);
+		return 1;
+	}
+
+	_report_slowest(&history);
+	_report_rule_totals(&history);
+	_report_regressions(&history, threshold);
+
+	mb_history_free(&history);
+	return 0;
+}
@@ -0,0 +1,110 @@
+/* history.h ; mariebuild per-element job history header
+ *
+ * Copyright (c) 2025, Marie Eckert
+ * Licensend under the BSD 3-Clause License.
+ */
+
+#ifndef HISTORY_H
+#define HISTORY_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include <sys/resource.h>
+
+#define MB_HISTORY_FILE ".mb_history"
+
+/* Bumped whenever the format of the history file changes */
+#define MB_HISTORY_VERSION 1
+
+/* Samples kept per rule/element pair */
+#define MB_HISTORY_KEEP 8
+
+typedef struct history_sample {
+	int64_t time;
+	int status;
+	uint64_t wall_ns;
+	int64_t cpu_us;
+	int64_t maxrss_kb;
+} history_sample_t;
+
+typedef struct history_entry {
+	char *rule;
+	char *element;
+
+	/* oldest sample first */
+	history_sample_t samples[MB_HISTORY_KEEP];
+	size_t sample_count;
+} history_entry_t;
+
+typedef struct history {
+	history_entry_t *entries;
+	size_t entry_count;
+	size_t entry_capacity;
+
+	/* open addressing hash table of indices into entries + 1, 0 is empty */
+	size_t *table;
+	size_t table_size;
+} history_t;
+
+/**
+ * @brief Remember a finished job, written to disk by mb_history_save.
+ * @param element The element of the job, may be NULL
+ * @param usage The resource usage of the job, may be NULL
+ */
+void mb_history_record(
+	const char *rule,
+	const char *element,
+	int status,
+	uint64_t wall_ns,
+	const struct rusage *usage);
+
+/**
+ * @brief Append all jobs recorded so far to the history file, compacting it
+ * if it has grown too much.
+ * @return Success?
+ */
+bool mb_history_save(const char *path);
+
+/**
+ * @brief Load the history file, a missing file results in an empty history.
+ * @return Success?
+ */
+bool mb_history_load(const char *path, history_t *history);
+
+void mb_history_free(history_t *history);
+
+/**
+ * @brief The history of previous builds, loaded from MB_HISTORY_FILE on first
+ * use. Jobs recorded during the current build are not part of it.
+ */
+history_t *mb_history_previous(void);
+
+/**
+ * @brief Free the history returned by mb_history_previous.
+ */
+void mb_history_release(void);
+
+/**
+ * @brief Find the entry of a rule/element pair.
+ * @param element The element, may be NULL
+ * @return The entry or NULL if there is none
+ */
+history_entry_t *
+mb_history_find(history_t *history, const char *rule, const char *element);
+
+/**
+ * @brief Median wall time of the successful samples of an entry.
+ * @return The median or 0 if there are no successful samples
+ */
+uint64_t mb_history_median_wall(const history_entry_t *entry);
+
+/**
+ * @brief Print the slowest elements, per-rule totals and elements which
+ * regressed by more than threshold percent against their rolling median.
+ * @return 0 on success
+ */
+int mb_history_report(const char *path, double threshold);
+
+#endif /* #ifndef HISTORY_H */
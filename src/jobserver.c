@@ -0,0 +1,89 @@
+/* jobserver.c ; mariebuild job slots shared between processes
+ *
+ * The processes building several targets at once share one pool of job
+ * slots, handed out as bytes in a pipe like the jobserver of make does.
+ *
+ * Copyright (c) 2025, Marie Eckert
+ * Licensend under the BSD 3-Clause License.
+ */
+
+#define _XOPEN_SOURCE 700
+#define _POSIX_C_SOURCE 200809L
+
+#include <errno.h>
+#include <stdbool.h>
+#include <string.h>
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "jobserver.h"
+#include "logging.h"
+
+/* -1 if there is no jobserver */
+static int tokens_read = -1;
+static int tokens_write = -1;
+
+bool mb_jobserver_create(size_t tokens) {
+	int fds[2];
+	if (pipe(fds) != 0) {
+		mb_logf(
+			LOG_ERROR, "could not create the jobserver pipe: %s\n",
+			strerror(errno));
+		return false;
+	}
+
+	/* a process waiting for a token has to keep reaping its own jobs */
+	fcntl(fds[0], F_SETFL, fcntl(fds[0], F_GETFL) | O_NONBLOCK);
+	fcntl(fds[0], F_SETFD, FD_CLOEXEC);
+	fcntl(fds[1], F_SETFD, FD_CLOEXEC);
+
+	tokens_read = fds[0];
+	tokens_write = fds[1];
+
+	for (size_t ix = 0; ix < tokens; ix++) {
+		mb_jobserver_release(true);
+	}
+
+	mb_logf(LOG_DEBUG, "jobserver with %zu tokens\n", tokens);
+	return true;
+}
+
+bool mb_jobserver_acquire(bool *token) {
+	*token = false;
+	if (tokens_read < 0) {
+		return true;
+	}
+
+	char byte;
+	ssize_t res;
+	do {
+		res = read(tokens_read, &byte, 1);
+	} while (res < 0 && errno == EINTR);
+
+	*token = res == 1;
+	return *token;
+}
+
+void mb_jobserver_release(bool token) {
+	if (!token || tokens_write < 0) {
+		return;
+	}
+
+	/* the pipe never holds more tokens than it was created with, so this
+	 * does not block */
+	const char byte = '+';
+	while (write(tokens_write, &byte, 1) < 0 && errno == EINTR) {
+	}
+}
+
+void mb_jobserver_close(void) {
+	if (tokens_read < 0) {
+		return;
+	}
+
+	close(tokens_read);
+	close(tokens_write);
+	tokens_read = -1;
+	tokens_write = -1;
+}
@@ -0,0 +1,36 @@
+/* jobserver.h ; mariebuild job slots shared between processes header
+ *
+ * Copyright (c) 2025, Marie Eckert
+ * Licensend under the BSD 3-Clause License.
+ */
+
+#ifndef JOBSERVER_H
+#define JOBSERVER_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+/**
+ * @brief Create the token pipe shared by the processes building several
+ * targets at once. Every process may run one job without a token, every
+ * further job running at the same time needs one.
+ * @param tokens The amount of tokens in the pipe
+ * @return Success?
+ */
+bool mb_jobserver_create(size_t tokens);
+
+/**
+ * @brief Try to take a token for another job, without blocking.
+ * @param token Output, whether a token was taken and has to be released
+ * @return true if the job may start, always the case without a jobserver
+ */
+bool mb_jobserver_acquire(bool *token);
+
+/**
+ * @param token Whether a token was taken for the job, nothing is done if not
+ */
+void mb_jobserver_release(bool token);
+
+void mb_jobserver_close(void);
+
+#endif /* #ifndef JOBSERVER_H */
@@ -4,15 +4,63 @@
  * Licensend under the BSD 3-Clause License.
  */
 
+#define _XOPEN_SOURCE 700
+#define _POSIX_C_SOURCE 200809L
+#define _DEFAULT_SOURCE
+
+#include <errno.h>
+#include <signal.h>
 #include <stdarg.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include <pthread.h>
+#include <sched.h>
+#include <sys/ioctl.h>
+#include <unistd.h>
 
 #include "ansi.h"
 #include "logging.h"
+#include "progress.h"
+
+/* Size of the ring buffer between the logging functions and the writer
+ * thread. Has to be a power of two. */
+#define LOG_RING_SIZE (64 * 1024)
+
+/* How long the writer thread sleeps if there is nothing to write. Anything
+ * logged within this interval is written out as one batch. */
+#define LOG_WRITER_INTERVAL_NS 2000000
+
+/* Messages up to this length are formatted on the stack */
+#define LOG_LINE_SIZE 1024
+
+/* Erases the current line of the terminal */
+#define LOG_CLEAR_LINE "\r\x1b[K"
+
+/* Terminal width assumed if it can not be queried */
+#define LOG_DEFAULT_WIDTH 80
 
 log_level_t mb_log_level = LOG_STEPS;
 
+/* The ring is single-producer (the main thread) / single-consumer (the writer
+ * thread). head and tail are free running counters, only the producer
+ * advances head and only the consumer advances tail. */
+static char ring[LOG_RING_SIZE];
+static atomic_size_t ring_head = 0;
+static atomic_size_t ring_tail = 0;
+
+static atomic_bool writer_running = false;
+static atomic_bool writer_stop = false;
+static pthread_t writer_thread;
+
+/* only written by the main thread */
+static FILE *log_file = NULL;
+
 log_level_t str_to_loglvl(char *str) {
 	if (str == NULL) {
 		return LOG_DEBUG;
@@ -36,41 +84,352 @@ log_level_t str_to_loglvl(char *str) {
 	}
 }
 
+static void _write_all(const char *buf, size_t len) {
+	while (len > 0) {
+		ssize_t written = write(STDERR_FILENO, buf, len);
+		if (written < 0) {
+			if (errno == EINTR) {
+				continue;
+			}
+			return;
+		}
+
+		buf += written;
+		len -= written;
+	}
+}
+
+static uint64_t _now_ns(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000 + (uint64_t)ts.tv_nsec;
+}
+
+/**
+ * @brief Check if written output ends with a complete line, messages end with
+ * a newline followed by ANSI_RESET.
+ */
+static bool _ends_line(const char *buf, size_t len) {
+	size_t reset_len = strlen(ANSI_RESET);
+	if (len >= reset_len &&
+		memcmp(buf + len - reset_len, ANSI_RESET, reset_len) == 0) {
+		len -= reset_len;
+	}
+
+	return len > 0 && buf[len - 1] == '\n';
+}
+
+/**
+ * @brief Draw the status line of the progress display in place of the
+ * current, empty, line of the terminal.
+ */
+static void _draw_status(void) {
+	struct winsize size;
+	size_t width = LOG_DEFAULT_WIDTH;
+	if (ioctl(STDERR_FILENO, TIOCGWINSZ, &size) == 0 && size.ws_col > 0) {
+		width = size.ws_col;
+	}
+
+	/* leave the last column free, so the cursor never wraps */
+	char line[sizeof(LOG_CLEAR_LINE) + 512];
+	size_t len = strlen(LOG_CLEAR_LINE);
+	memcpy(line, LOG_CLEAR_LINE, len);
+	len += mb_progress_render(line + len, sizeof(line) - len, width - 1);
+
+	_write_all(line, len);
+}
+
+static void *_writer_main(void *arg) {
+	(void)arg;
+
+	/* signals should always be handled by the main thread */
+	sigset_t all;
+	sigfillset(&all);
+	pthread_sigmask(SIG_BLOCK, &all, NULL);
+
+	const struct timespec interval = {
+		.tv_sec = 0, .tv_nsec = LOG_WRITER_INTERVAL_NS};
+	const uint64_t redraw_interval = 1000000000 / MB_PROGRESS_REDRAW_HZ;
+
+	/* the status line is only drawn between complete lines of the log */
+	bool status_shown = false;
+	bool at_line_start = true;
+	uint64_t last_redraw = 0;
+
+	for (;;) {
+		size_t tail = atomic_load_explicit(&ring_tail, memory_order_relaxed);
+		size_t head = atomic_load_explicit(&ring_head, memory_order_acquire);
+
+		if (head == tail) {
+			if (atomic_load(&writer_stop)) {
+				break;
+			}
+
+			uint64_t now = _now_ns();
+			if (mb_progress_enabled() && at_line_start &&
+				now - last_redraw >= redraw_interval) {
+				_draw_status();
+				status_shown = true;
+				last_redraw = now;
+			}
+
+			nanosleep(&interval, NULL);
+			continue;
+		}
+
+		if (status_shown) {
+			_write_all(LOG_CLEAR_LINE, strlen(LOG_CLEAR_LINE));
+			status_shown = false;
+		}
+
+		size_t offset = tail & (LOG_RING_SIZE - 1);
+		size_t len = head - tail;
+		if (offset + len > LOG_RING_SIZE) {
+			len = LOG_RING_SIZE - offset;
+		}
+
+		_write_all(ring + offset, len);
+		at_line_start = _ends_line(ring + offset, len);
+		atomic_store_explicit(&ring_tail, tail + len, memory_order_release);
+	}
+
+	if (status_shown) {
+		_write_all(LOG_CLEAR_LINE, strlen(LOG_CLEAR_LINE));
+	}
+
+	return NULL;
+}
+
+/**
+ * @brief Hand a formatted message to the writer thread. If the ring is full
+ * this waits for the writer thread to make space, if the writer thread is not
+ * running the message is written directly.
+ */
+static void _log_write(const char *buf, size_t len) {
+	if (!atomic_load(&writer_running)) {
+		_write_all(buf, len);
+		return;
+	}
+
+	while (len > 0) {
+		size_t head = atomic_load_explicit(&ring_head, memory_order_relaxed);
+		size_t tail = atomic_load_explicit(&ring_tail, memory_order_acquire);
+		size_t space = LOG_RING_SIZE - (head - tail);
+
+		if (space == 0) {
+			sched_yield();
+			continue;
+		}
+
+		size_t offset = head & (LOG_RING_SIZE - 1);
+		size_t chunk = len < space ? len : space;
+		if (offset + chunk > LOG_RING_SIZE) {
+			chunk = LOG_RING_SIZE - offset;
+		}
+
+		memcpy(ring + offset, buf, chunk);
+		atomic_store_explicit(&ring_head, head + chunk, memory_order_release);
+
+		buf += chunk;
+		len -= chunk;
+	}
+}
+
+/**
+ * @brief Format prefix, message and suffix into one buffer so that every
+ * message only results in a single write. The message is also written to the
+ * log file, with a prefix without colours.
+ * @param console Whether the message is shown on the terminal
+ */
+static int _log_vformat(
+	bool console,
+	const char *prefix,
+	const char *file_prefix,
+	const char *suffix,
+	const char *format,
+	va_list arg) {
+	char line[LOG_LINE_SIZE];
+
+	va_list arg_copy;
+	va_copy(arg_copy, arg);
+
+	size_t prefix_len = strlen(prefix);
+	size_t suffix_len = strlen(suffix);
+	size_t available = sizeof(line) - prefix_len - suffix_len;
+
+	int done = vsnprintf(line + prefix_len, available, format, arg);
+	if (done < 0) {
+		va_end(arg_copy);
+		return done;
+	}
+
+	char *buf = line;
+	if ((size_t)done >= available) {
+		buf = malloc(prefix_len + done + suffix_len + 1);
+		if (buf == NULL) {
+			va_end(arg_copy);
+			return -1;
+		}
+
+		vsnprintf(buf + prefix_len, done + 1, format, arg_copy);
+	}
+	va_end(arg_copy);
+
+	if (log_file != NULL) {
+		fputs(file_prefix, log_file);
+		fwrite(buf + prefix_len, 1, done, log_file);
+	}
+
+	if (console) {
+		memcpy(buf, prefix, prefix_len);
+		memcpy(buf + prefix_len + done, suffix, suffix_len);
+
+		_log_write(buf, prefix_len + done + suffix_len);
+	}
+
+	if (buf != line) {
+		free(buf);
+	}
+
+	return done;
+}
+
+void mb_log_init(void) {
+	if (atomic_load(&writer_running)) {
+		return;
+	}
+
+	atomic_store(&writer_stop, false);
+	if (pthread_create(&writer_thread, NULL, &_writer_main, NULL) != 0) {
+		/* fall back to writing synchronously */
+		return;
+	}
+
+	atomic_store(&writer_running, true);
+}
+
+void mb_log_flush(void) {
+	if (!atomic_load(&writer_running)) {
+		return;
+	}
+
+	while (atomic_load_explicit(&ring_tail, memory_order_acquire) !=
+		   atomic_load_explicit(&ring_head, memory_order_relaxed)) {
+		sched_yield();
+	}
+}
+
+void mb_log_error_signal_safe(const char *msg) {
+	static const char prefix[] =
+		ANSI_BOLD ANSI_FG_RED "ERR" ANSI_RESET " " ANSI_BOLD;
+
+	/* the writer thread blocks all signals, so it keeps draining what was
+	 * published before the signal arrived */
+	mb_log_flush();
+	_write_all(prefix, sizeof(prefix) - 1);
+	_write_all(msg, strlen(msg));
+	_write_all(ANSI_RESET, strlen(ANSI_RESET));
+}
+
+bool mb_log_open_file(const char *path) {
+	FILE *file = fopen(path, "w");
+	if (file == NULL) {
+		mb_logf(
+			LOG_ERROR, "could not open log file \"%s\": %s\n", path,
+			strerror(errno));
+		return false;
+	}
+
+	log_file = file;
+	return true;
+}
+
+/**
+ * @brief Check if a message is shown on the terminal. With a status line
+ * only messages of LOG_INFO and above are, the others only go to the log
+ * file.
+ */
+static bool _on_console(log_level_t level) {
+	return level >= LOG_INFO || !mb_progress_enabled();
+}
+
+static void _stop_writer(void) {
+	if (!atomic_load(&writer_running)) {
+		return;
+	}
+
+	atomic_store(&writer_stop, true);
+	pthread_join(writer_thread, NULL);
+	atomic_store(&writer_running, false);
+}
+
+void mb_log_shutdown(void) {
+	if (log_file != NULL) {
+		fclose(log_file);
+		log_file = NULL;
+	}
+
+	_stop_writer();
+}
+
+void mb_log_before_fork(void) {
+	_stop_writer();
+
+	if (log_file != NULL) {
+		fflush(log_file);
+	}
+	fflush(stdout);
+}
+
+void mb_log_after_fork(void) {
+	mb_log_init();
+}
+
 int mb_logf(log_level_t level, const char *format, ...) {
 	if (level < mb_log_level) {
 		return 0;
 	}
 
 	char *level_prefix;
+	char *file_prefix;
 	switch (level) {
 		default:
 		case LOG_DEBUG:
-			level_prefix = "---";
+			level_prefix = "--- " ANSI_BOLD;
+			file_prefix = "--- ";
 			break;
 		case LOG_STEPS:
-			level_prefix = "    ";
+			level_prefix = "     " ANSI_BOLD;
+			file_prefix = "     ";
 			break;
 		case LOG_INFO:
-			level_prefix = ANSI_BOLD ANSI_FG_GREEN "==>" ANSI_RESET;
+			level_prefix =
+				ANSI_BOLD ANSI_FG_GREEN "==>" ANSI_RESET " " ANSI_BOLD;
+			file_prefix = "==> ";
 			break;
 		case LOG_WARNING:
-			level_prefix = ANSI_BOLD ANSI_FG_YELLOW "WRN" ANSI_RESET;
+			level_prefix =
+				ANSI_BOLD ANSI_FG_YELLOW "WRN" ANSI_RESET " " ANSI_BOLD;
+			file_prefix = "WRN ";
 			break;
 		case LOG_ERROR:
-			level_prefix = ANSI_BOLD ANSI_FG_RED "ERR" ANSI_RESET;
+			level_prefix = ANSI_BOLD ANSI_FG_RED "ERR" ANSI_RESET " " ANSI_BOLD;
+			file_prefix = "ERR ";
 			break;
 	}
 
-	fprintf(stderr, "%s %s", level_prefix, ANSI_BOLD);
-
 	va_list arg;
 	int done;
 
 	va_start(arg, format);
-	done = vfprintf(stderr, format, arg);
+	done = _log_vformat(
+		_on_console(level), level_prefix, file_prefix, ANSI_RESET, format,
+		arg);
 	va_end(arg);
 
-	fprintf(stderr, ANSI_RESET);
+	if (level >= LOG_ERROR) {
+		mb_log_flush();
+	}
 
 	return done;
 }
@@ -84,9 +443,13 @@ int mb_logf_noprefix(log_level_t level, const char *format, ...) {
 	int done;
 
 	va_start(arg, format);
-	done = vfprintf(stderr, format, arg);
+	done = _log_vformat(_on_console(level), "", "", "", format, arg);
 	va_end(arg);
 
+	if (level >= LOG_ERROR) {
+		mb_log_flush();
+	}
+
 	return done;
 }
 
@@ -7,6 +7,8 @@
 #ifndef LOGGING_H
 #define LOGGING_H
 
+#include <stdbool.h>
+
 typedef enum log_level {
 	LOG_INVALID = -1,
 	LOG_DEBUG = 0,
@@ -17,6 +19,9 @@ typedef enum log_level {
 	__LOG_UPPER_BOUND
 } log_level_t;
 
+/* log file written alongside the status line if no other one is given */
+#define MB_LOG_FILE ".mb_log"
+
 #if !defined(DEFAULT_LOG_LEVEL)
 #define DEFAULT_LOG_LEVEL LOG_STEPS
 #endif
@@ -25,6 +30,31 @@ extern log_level_t mb_log_level;
 
 log_level_t str_to_loglvl(char *str);
 
+/* Start the writer thread. Until this is called, and after mb_log_shutdown,
+ * messages are written synchronously. */
+void mb_log_init(void);
+
+/* Block until every message logged so far has been written. */
+void mb_log_flush(void);
+
+/* Flush and stop the writer thread and close the log file. */
+void mb_log_shutdown(void);
+
+/* Stop the writer thread and flush all buffers, so a forked child neither
+ * waits for a thread it does not have nor writes anything twice. */
+void mb_log_before_fork(void);
+
+/* Start the writer thread again, in the parent as well as in the child. */
+void mb_log_after_fork(void);
+
+/* Also write every message to the given file, the file is truncated. */
+bool mb_log_open_file(const char *path);
+
+/* Write an error directly to stderr, bypassing the ring and the log file.
+ * Only this may be used from a signal handler, which may interrupt the main
+ * thread while it writes to the ring. */
+void mb_log_error_signal_safe(const char *msg);
+
 int mb_logf(log_level_t level, const char *format, ...);
 int mb_logf_noprefix(log_level_t level, const char *format, ...);
 void mb_log(int level, char *msg);
@@ -4,13 +4,19 @@
  * Licensend under the BSD 3-Clause License.
  */
 
+#define _XOPEN_SOURCE 700
+#define _POSIX_C_SOURCE 200809L
+
+#include <limits.h>
 #include <stdbool.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 
 #include <argp.h>
 
 #include "build.h"
+#include "cptrlist.h"
 #include "logging.h"
 #include "mcfg.h"
 #include "signals.h"
@@ -40,17 +46,58 @@ const char *argp_program_bug_address =
 const char description[] =
 	"A simple build system inspired by my hate against makefiles\n"
 	"Author: Marie Eckert";
-const char args_doc[] = "";
+const char args_doc[] = "[top]";
+
+/* keys for options without a short option */
+enum long_option_keys {
+	OPT_STATS = 0x100,
+	OPT_EVENTS_FD,
+	OPT_EVENTS_FILE,
+	OPT_REPORT,
+	OPT_REGRESSION_THRESHOLD,
+	OPT_OUTPUT,
+	OPT_PROGRESS,
+	OPT_LOG_FILE,
+};
 
 static struct argp_option options[] = {
 	{"in", 'i', "FILE", 0, "Specify a buildfile", 0},
-	{"target", 't', "TARGET", 0, "Specify the build target", 0},
+	{"target", 't', "TARGET", 0,
+	 "Specify the build target, repeat it or separate targets by commas to "
+	 "build several at once",
+	 0},
 	{"force", 'f', 0, 0, "Force a build, regardless if target is incremental",
 	 0},
 	{"no-splash", 'n', 0, 0, "Disable splash screen/logo", 0},
 	{"keep-going", 'k', 0, 0,
 	 "Ignore any failures (if possible) and keep on building", 0},
 	{"verbosity", 'v', "LEVEL", 0, "Set the verbosity level (0-3)", 0},
+	{"stats", OPT_STATS, 0, 0,
+	 "Print statistics about mariebuild's own overhead after the build", 0},
+	{"events-fd", OPT_EVENTS_FD, "FD", 0,
+	 "Write NDJSON progress events to the given file descriptor", 0},
+	{"events", OPT_EVENTS_FILE, "FILE", 0,
+	 "Write NDJSON progress events to the given file", 0},
+	{"report", OPT_REPORT, 0, 0,
+	 "Report the slowest elements, per-rule totals and regressions from the "
+	 "build history instead of building",
+	 0},
+	{"regression-threshold", OPT_REGRESSION_THRESHOLD, "PCT", 0,
+	 "Report elements more than PCT percent slower than their median as "
+	 "regressions (default 20)",
+	 0},
+	{"output", OPT_OUTPUT, "MODE", 0,
+	 "Print the output of jobs once they finish (all, the default), only for "
+	 "failed jobs (failed) or as they run (live)",
+	 0},
+	{"progress", OPT_PROGRESS, "MODE", 0,
+	 "Show the progress as a status line (line) or as the full log (plain). "
+	 "By default a status line is shown if stderr is a terminal (auto)",
+	 0},
+	{"log-file", OPT_LOG_FILE, "FILE", 0,
+	 "Write the full log to the given file (default " MB_LOG_FILE
+	 " with a status line)",
+	 0},
 	{0, 0, 0, 0, 0, 0}};
 
 static error_t parse_opt(int key, char *arg, struct argp_state *state) {
@@ -59,8 +106,12 @@ static error_t parse_opt(int key, char *arg, struct argp_state *state) {
 		case 'i':
 			args->buildfile = arg;
 			break;
-		case 't':
-			args->target = arg;
+		case 't':;
+			char *target_save;
+			for (char *name = strtok_r(arg, ",", &target_save); name != NULL;
+				 name = strtok_r(NULL, ",", &target_save)) {
+				cptrlist_append(&args->targets, strdup(name));
+			}
 			break;
 		case 'f':
 			args->force = true;
@@ -75,6 +126,52 @@ static error_t parse_opt(int key, char *arg, struct argp_state *state) {
 			args->verbosity = str_to_loglvl(arg);
 			args->verbosity_overriden = true;
 			break;
+		case OPT_STATS:
+			args->stats = true;
+			break;
+		case OPT_EVENTS_FD:;
+			char *end;
+			long fd = strtol(arg, &end, 10);
+			if (*end != 0 || fd < 0 || fd > INT_MAX) {
+				argp_error(state, "invalid file descriptor \"%s\"", arg);
+			}
+			args->events_fd = (int)fd;
+			break;
+		case OPT_EVENTS_FILE:
+			args->events_file = arg;
+			break;
+		case OPT_REPORT:
+			args->report = true;
+			break;
+		case OPT_REGRESSION_THRESHOLD:;
+			char *threshold_end;
+			args->regression_threshold = strtod(arg, &threshold_end);
+			if (*threshold_end != 0 || args->regression_threshold < 0) {
+				argp_error(state, "invalid threshold \"%s\"", arg);
+			}
+			break;
+		case OPT_OUTPUT:
+			args->output_mode = str_to_output_mode(arg, OUTPUT_MODE_INVALID);
+			if (args->output_mode == OUTPUT_MODE_INVALID) {
+				argp_error(state, "invalid output mode \"%s\"", arg);
+			}
+			break;
+		case OPT_PROGRESS:
+			args->progress_mode =
+				str_to_progress_mode(arg, PROGRESS_MODE_INVALID);
+			if (args->progress_mode == PROGRESS_MODE_INVALID) {
+				argp_error(state, "invalid progress mode \"%s\"", arg);
+			}
+			break;
+		case OPT_LOG_FILE:
+			args->log_file = arg;
+			break;
+		case ARGP_KEY_ARG:
+			if (state->arg_num > 0 || strcmp(arg, "top") != 0) {
+				argp_error(state, "unknown command \"%s\"", arg);
+			}
+			args->top = true;
+			break;
 		default:
 			return ARGP_ERR_UNKNOWN;
 	}
@@ -95,10 +192,19 @@ void print_splash(void) {
 int main(int argc, char **argv) {
 	args_t args;
 	args.buildfile = "build.mb";
-	args.target = NULL;
+	cptrlist_init(&args.targets, 1, 4);
 	args.force = false;
 	args.no_splash = false;
 	args.keep_going = false;
+	args.stats = false;
+	args.events_fd = -1;
+	args.events_file = NULL;
+	args.report = false;
+	args.top = false;
+	args.regression_threshold = 20.0;
+	args.output_mode = OUTPUT_MODE_ALL;
+	args.progress_mode = PROGRESS_MODE_AUTO;
+	args.log_file = NULL;
 	args.verbosity = DEFAULT_LOG_LEVEL;
 	args.verbosity_overriden = false;
 
@@ -109,7 +215,12 @@ int main(int argc, char **argv) {
 	}
 
 	mb_log_level = args.verbosity;
+	mb_log_init();
 
 	mb_install_signal_handlers();
-	return mb_start(args);
+	int ret = mb_start(args);
+	cptrlist_destroy(&args.targets);
+
+	mb_log_shutdown();
+	return ret;
 }
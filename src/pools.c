@@ -0,0 +1,192 @@
+/* pools.c ; mariebuild resource pools
+ *
+ * Pools cap how many jobs of a kind may run at once. Every job has a weight
+ * in its pool and is only started if the pool still has room for it, see
+ * doc/mariebuild.md for how they are declared. The pools live in shared
+ * memory, so the processes building several targets at once share them.
+ *
+ * Copyright (c) 2025, Marie Eckert
+ * Licensend under the BSD 3-Clause License.
+ */
+
+#define _XOPEN_SOURCE 700
+#define _POSIX_C_SOURCE 200809L
+#define _DEFAULT_SOURCE
+
+#include <ctype.h>
+#include <errno.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include <strings.h>
+#include <sys/mman.h>
+
+#include "logging.h"
+#include "mcfg.h"
+#include "mcfg_util.h"
+#include "pools.h"
+#include "stringutil.h"
+#include "xmem.h"
+
+/* interval in which mb_pool_acquire checks for room again */
+#define POOL_WAIT_NS 1000000
+
+static pool_t *pools = NULL;
+static size_t pool_count = 0;
+static size_t pools_size = 0;
+
+bool mb_parse_amount(const char *str, uint64_t *amount) {
+	if (str == NULL || !isdigit((unsigned char)*str)) {
+		return false;
+	}
+
+	char *end;
+	errno = 0;
+	unsigned long long value = strtoull(str, &end, 10);
+	if (errno != 0) {
+		return false;
+	}
+
+	unsigned int shift = 0;
+	switch (toupper((unsigned char)*end)) {
+		case 0:
+			break;
+		case 'K':
+			shift = 10;
+			break;
+		case 'M':
+			shift = 20;
+			break;
+		case 'G':
+			shift = 30;
+			break;
+		case 'T':
+			shift = 40;
+			break;
+		default:
+			return false;
+	}
+
+	/* allow "8G" as well as "8GB" / "8GiB" */
+	if (shift != 0) {
+		end++;
+		if (strcmp(end, "") != 0 && strcasecmp(end, "B") != 0 &&
+			strcasecmp(end, "iB") != 0) {
+			return false;
+		}
+	}
+
+	if (shift != 0 && value > (UINT64_MAX >> shift)) {
+		return false;
+	}
+
+	*amount = (uint64_t)value << shift;
+	return true;
+}
+
+bool mb_pools_load(mcfg_file_t *file) {
+	mcfg_section_t *section =
+		mcfg_get_section(mcfg_get_sector(file, "config"), "pools");
+	if (section == NULL || section->field_count == 0) {
+		return true;
+	}
+
+	pools_size = section->field_count * sizeof(pool_t);
+	pools = mmap(
+		NULL, pools_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS,
+		-1, 0);
+	if (pools == MAP_FAILED) {
+		mb_logf(
+			LOG_ERROR, "could not map the pools: %s\n", strerror(errno));
+		pools = NULL;
+		return false;
+	}
+
+	for (size_t ix = 0; ix < section->field_count; ix++) {
+		mcfg_field_t *field = &section->fields[ix];
+		char *raw = mcfg_data_to_string(*field);
+
+		uint64_t capacity;
+		bool ok = mb_parse_amount(raw, &capacity) && capacity > 0;
+		XFREE(raw);
+
+		if (!ok) {
+			mb_logf(
+				LOG_ERROR, "/config/pools/%s: invalid pool capacity\n",
+				field->name);
+			mb_pools_free();
+			return false;
+		}
+
+		pool_t *pool = &pools[pool_count++];
+		pool->name = strdup(field->name);
+		pool->capacity = capacity;
+		atomic_init(&pool->used, 0);
+
+		mb_logf(
+			LOG_DEBUG, "pool \"%s\" with a capacity of %llu\n", field->name,
+			(unsigned long long)capacity);
+	}
+
+	return true;
+}
+
+void mb_pools_free(void) {
+	for (size_t ix = 0; ix < pool_count; ix++) {
+		XFREE(pools[ix].name);
+	}
+
+	if (pools != NULL) {
+		munmap(pools, pools_size);
+	}
+
+	pools = NULL;
+	pool_count = 0;
+	pools_size = 0;
+}
+
+pool_t *mb_pool_find(const char *name) {
+	for (size_t ix = 0; ix < pool_count; ix++) {
+		if (strcmp(pools[ix].name, name) == 0) {
+			return &pools[ix];
+		}
+	}
+
+	return NULL;
+}
+
+bool mb_pool_try_acquire(pool_t *pool, uint64_t weight) {
+	if (pool == NULL) {
+		return true;
+	}
+
+	uint64_t used = atomic_load(&pool->used);
+	do {
+		if (used != 0 && used + weight > pool->capacity) {
+			return false;
+		}
+	} while (!atomic_compare_exchange_weak(&pool->used, &used, used + weight));
+
+	return true;
+}
+
+void mb_pool_acquire(pool_t *pool, uint64_t weight) {
+	const struct timespec wait = {.tv_sec = 0, .tv_nsec = POOL_WAIT_NS};
+	while (!mb_pool_try_acquire(pool, weight)) {
+		nanosleep(&wait, NULL);
+	}
+}
+
+void mb_pool_release(pool_t *pool, uint64_t weight) {
+	if (pool == NULL) {
+		return;
+	}
+
+	uint64_t used = atomic_load(&pool->used);
+	while (!atomic_compare_exchange_weak(
+		&pool->used, &used, used > weight ? used - weight : 0)) {
+	}
+}
@@ -0,0 +1,70 @@
+/* pools.h ; mariebuild resource pools header
+ *
+ * Copyright (c) 2025, Marie Eckert
+ * Licensend under the BSD 3-Clause License.
+ */
+
+#ifndef POOLS_H
+#define POOLS_H
+
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "mcfg.h"
+
+typedef struct pool {
+	char *name;
+
+	/* capacity and weights have no unit, they can be slots, bytes of memory
+	 * or anything else as long as they are used consistently. */
+	uint64_t capacity;
+
+	/* shared by the processes building several targets at once */
+	_Atomic uint64_t used;
+} pool_t;
+
+/**
+ * @brief Load the pools declared in the /config/pools section, every field
+ * in it declares a pool with its capacity.
+ * @return Success?
+ */
+bool mb_pools_load(mcfg_file_t *file);
+
+void mb_pools_free(void);
+
+/**
+ * @brief Find a pool by its name.
+ * @return The pool or NULL if there is none with the name
+ */
+pool_t *mb_pool_find(const char *name);
+
+/**
+ * @brief Take room for a job of the given weight in a pool if it has room for
+ * it. A job heavier than the capacity of the pool is admitted once the pool
+ * is empty.
+ * @param pool The pool, may be NULL in which case there is always room
+ * @return true if the room was taken
+ */
+bool mb_pool_try_acquire(pool_t *pool, uint64_t weight);
+
+/**
+ * @brief Take room for a job of the given weight in a pool, waiting for jobs
+ * of other processes to release it if needed.
+ * @param pool The pool, may be NULL
+ */
+void mb_pool_acquire(pool_t *pool, uint64_t weight);
+
+/**
+ * @param pool The pool, may be NULL
+ */
+void mb_pool_release(pool_t *pool, uint64_t weight);
+
+/**
+ * @brief Parse an amount with an optional binary suffix (K, M, G or T), e.g.
+ * "16" or "8G".
+ * @return Success?
+ */
+bool mb_parse_amount(const char *str, uint64_t *amount);
+
+#endif /* #ifndef POOLS_H */
@@ -0,0 +1,189 @@
+/* progress.c ; mariebuild terminal status line
+ *
+ * Copyright (c) 2025, Marie Eckert
+ * Licensend under the BSD 3-Clause License.
+ */
+
+#define _XOPEN_SOURCE 700
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+#include <pthread.h>
+#include <unistd.h>
+
+#include "progress.h"
+#include "stats.h"
+
+/* running jobs which are named in the status line, any further ones are only
+ * counted */
+#define PROGRESS_MAX_RUNNING 32
+
+#define PROGRESS_LABEL_SIZE 48
+
+typedef struct running_job {
+	int pid;
+	char label[PROGRESS_LABEL_SIZE];
+} running_job_t;
+
+/* updated by the main thread, read by the writer thread of the logger */
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+
+static atomic_bool enabled = false;
+static uint64_t started = 0;
+static size_t total = 0;
+static size_t done = 0;
+static size_t running_count = 0;
+static running_job_t running[PROGRESS_MAX_RUNNING];
+
+void mb_progress_enable(void) {
+	pthread_mutex_lock(&lock);
+	enabled = true;
+	started = mb_stats_now();
+	pthread_mutex_unlock(&lock);
+}
+
+bool mb_progress_enabled(void) {
+	return enabled;
+}
+
+bool mb_progress_supported(void) {
+	return isatty(STDERR_FILENO);
+}
+
+void mb_progress_job_queued(void) {
+	if (!enabled) {
+		return;
+	}
+
+	pthread_mutex_lock(&lock);
+	total++;
+	pthread_mutex_unlock(&lock);
+}
+
+void mb_progress_jobs_batched(size_t count) {
+	if (!enabled || count < 2) {
+		return;
+	}
+
+	pthread_mutex_lock(&lock);
+	total -= count - 1;
+	pthread_mutex_unlock(&lock);
+}
+
+void mb_progress_job_spawned(const char *rule, const char *element, int pid) {
+	if (!enabled || pid <= 0) {
+		return;
+	}
+
+	pthread_mutex_lock(&lock);
+	running_count++;
+	for (size_t ix = 0; ix < PROGRESS_MAX_RUNNING; ix++) {
+		if (running[ix].pid == 0) {
+			running[ix].pid = pid;
+			snprintf(
+				running[ix].label, PROGRESS_LABEL_SIZE, "%s",
+				element != NULL ? element : rule);
+			break;
+		}
+	}
+	pthread_mutex_unlock(&lock);
+}
+
+void mb_progress_job_finished(int pid) {
+	if (!enabled) {
+		return;
+	}
+
+	pthread_mutex_lock(&lock);
+	done++;
+
+	/* builtin actions and jobs which could not be started finish without
+	 * ever being spawned */
+	if (pid > 0) {
+		running_count--;
+		for (size_t ix = 0; ix < PROGRESS_MAX_RUNNING; ix++) {
+			if (running[ix].pid == pid) {
+				running[ix].pid = 0;
+				break;
+			}
+		}
+	}
+	pthread_mutex_unlock(&lock);
+}
+
+size_t mb_progress_render(char *buf, size_t size, size_t width) {
+	if (size == 0) {
+		return 0;
+	}
+
+	width = width < size ? width : size - 1;
+	buf[0] = 0;
+
+	pthread_mutex_lock(&lock);
+
+	char eta[32] = "";
+	uint64_t elapsed = mb_stats_now() - started;
+	if (done > 0 && total > done) {
+		uint64_t left_s =
+			(uint64_t)((double)elapsed / done * (total - done) / 1e9);
+		snprintf(
+			eta, sizeof(eta), " (ETA %lu:%02lu)", (unsigned long)(left_s / 60),
+			(unsigned long)(left_s % 60));
+	}
+
+	char head[48];
+	snprintf(head, sizeof(head), "[%zu/%zu] running:", done, total);
+
+	/* the ETA is kept and the list of running jobs shortened if the line is
+	 * too long for the terminal */
+	size_t head_len = strlen(head);
+	size_t eta_len = strlen(eta);
+	size_t list_width =
+		width > head_len + eta_len ? width - head_len - eta_len : 0;
+
+	char list[1024] = "";
+	size_t list_len = 0;
+	size_t named = 0;
+	for (size_t ix = 0; ix < PROGRESS_MAX_RUNNING; ix++) {
+		if (running[ix].pid == 0) {
+			continue;
+		}
+
+		int len = snprintf(
+			list + list_len, sizeof(list) - list_len, "%s%s",
+			named > 0 ? ", " : " ", running[ix].label);
+		if (len < 0 || list_len + len >= sizeof(list)) {
+			break;
+		}
+
+		list_len += len;
+		named++;
+	}
+
+	if (named < running_count) {
+		int len = snprintf(
+			list + list_len, sizeof(list) - list_len, " +%zu",
+			running_count - named);
+		list_len += len > 0 ? (size_t)len : 0;
+		list_len = list_len < sizeof(list) ? list_len : sizeof(list) - 1;
+	}
+
+	pthread_mutex_unlock(&lock);
+
+	if (list_len > list_width) {
+		list_len = list_width;
+	}
+
+	int len = snprintf(
+		buf, width + 1, "%s%.*s%s", head, (int)list_len, list, eta);
+	if (len < 0) {
+		return 0;
+	}
+
+	return (size_t)len > width ? width : (size_t)len;
+}
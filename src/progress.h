@@ -0,0 +1,49 @@
+/* progress.h ; mariebuild terminal status line header
+ *
+ * Copyright (c) 2025, Marie Eckert
+ * Licensend under the BSD 3-Clause License.
+ */
+
+#ifndef PROGRESS_H
+#define PROGRESS_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+/* how often the status line is redrawn at most */
+#define MB_PROGRESS_REDRAW_HZ 10
+
+/**
+ * @brief Start showing a status line at the bottom of the terminal. The
+ * status line is drawn by the writer thread of the logger.
+ */
+void mb_progress_enable(void);
+
+bool mb_progress_enabled(void);
+
+/**
+ * @brief Check if a status line can be drawn, which is the case if stderr is
+ * a terminal.
+ */
+bool mb_progress_supported(void);
+
+/* Fed by the job events, see events.h */
+void mb_progress_job_queued(void);
+void mb_progress_job_spawned(const char *rule, const char *element, int pid);
+void mb_progress_job_finished(int pid);
+
+/**
+ * @brief Account for queued jobs which are run together as one batch.
+ * @param count The amount of queued jobs in the batch
+ */
+void mb_progress_jobs_batched(size_t count);
+
+/**
+ * @brief Render the status line, "[done/total] running: <elements>" followed
+ * by the estimated time left.
+ * @param width Width of the terminal, the line is shortened to fit
+ * @return The length of the line
+ */
+size_t mb_progress_render(char *buf, size_t size, size_t width);
+
+#endif /* #ifndef PROGRESS_H */
@@ -0,0 +1,487 @@
+/* restat.c ; mariebuild early cutoff for unchanged outputs
+ *
+ * Rules with restat set hash their outputs before a job runs. If a job
+ * rewrites an output with identical content, the old modification time of
+ * the output is restored, so rules depending on it do not rebuild. The
+ * output is then older than its input though, which would make the job
+ * itself run again on every build. The restat file remembers such
+ * input/output pairs together with the modification times they had, as long
+ * as neither of them changes the pair is considered up to date. It is a tab
+ * separated text file with a version header and one pair per line:
+ *
+ *   input_mtime_ns  output_mtime_ns  input  output
+ *
+ * Saving merges the pairs with the ones other processes saved in the meantime
+ * while holding a lock on a separate lock file, since the restat file itself
+ * is replaced on every save.
+ *
+ * Copyright (c) 2025, Marie Eckert
+ * Licensend under the BSD 3-Clause License.
+ */
+
+#define _XOPEN_SOURCE 700
+#define _POSIX_C_SOURCE 200809L
+#define _DEFAULT_SOURCE
+
+#include <errno.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <fcntl.h>
+#include <sys/file.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "logging.h"
+#include "restat.h"
+#include "stats.h"
+#include "xmem.h"
+
+#define RESTAT_MAGIC "mb_restat"
+
+#define RESTAT_INITIAL_TABLE_SIZE 256
+
+#define RESTAT_READ_SIZE (64 * 1024)
+
+typedef struct restat_entry {
+	char *input;
+	char *output;
+	int64_t input_mtime_ns;
+	int64_t output_mtime_ns;
+
+	/* recorded since the last save, wins over the restat file */
+	bool recorded;
+} restat_entry_t;
+
+static restat_entry_t *entries = NULL;
+static size_t entry_count = 0;
+static size_t entry_capacity = 0;
+
+/* open addressing hash table of indices into entries + 1, 0 is empty */
+static size_t *table = NULL;
+static size_t table_size = 0;
+
+static bool loaded = false;
+static bool dirty = false;
+
+/**
+ * @return The modification time in nanoseconds or -1 if the file can not be
+ * stat'ed
+ */
+static int64_t _mtime_ns(const char *path) {
+	struct stat st;
+	if (stat(path, &st) != 0) {
+		return -1;
+	}
+
+#ifdef __APPLE__
+	return (int64_t)st.st_mtimespec.tv_sec * 1000000000 +
+		   st.st_mtimespec.tv_nsec;
+#else
+	return (int64_t)st.st_mtim.tv_sec * 1000000000 + st.st_mtim.tv_nsec;
+#endif
+}
+
+void mb_restat_snapshot(const char *output, restat_snapshot_t *snapshot) {
+	uint64_t stats_begin = mb_stats_begin();
+	*snapshot = (restat_snapshot_t){.exists = false};
+
+	int fd = open(output, O_RDONLY);
+	if (fd < 0) {
+		goto exit;
+	}
+
+	struct stat st;
+	if (fstat(fd, &st) != 0) {
+		close(fd);
+		goto exit;
+	}
+
+	/* FNV-1a */
+	uint64_t hash = 0xcbf29ce484222325ull;
+	uint64_t size = 0;
+	unsigned char *buffer = XMALLOC(RESTAT_READ_SIZE);
+
+	ssize_t res;
+	while ((res = read(fd, buffer, RESTAT_READ_SIZE)) != 0) {
+		if (res < 0) {
+			if (errno == EINTR) {
+				continue;
+			}
+			break;
+		}
+
+		for (ssize_t ix = 0; ix < res; ix++) {
+			hash = (hash ^ buffer[ix]) * 0x100000001b3ull;
+		}
+		size += (uint64_t)res;
+	}
+
+	XFREE(buffer);
+	close(fd);
+
+	if (res < 0) {
+		goto exit;
+	}
+
+	*snapshot = (restat_snapshot_t){
+		.exists = true,
+		.size = size,
+		.hash = hash,
+#ifdef __APPLE__
+		.mtime_ns = (int64_t)st.st_mtimespec.tv_sec * 1000000000 +
+					st.st_mtimespec.tv_nsec,
+#else
+		.mtime_ns = (int64_t)st.st_mtim.tv_sec * 1000000000 +
+					st.st_mtim.tv_nsec,
+#endif
+	};
+
+exit:
+	mb_stats_end(STAT_RESTAT, stats_begin);
+}
+
+bool mb_restat_unchanged(
+	const char *output,
+	const restat_snapshot_t *snapshot) {
+	if (!snapshot->exists) {
+		return false;
+	}
+
+	restat_snapshot_t after;
+	mb_restat_snapshot(output, &after);
+
+	if (!after.exists || after.size != snapshot->size ||
+		after.hash != snapshot->hash) {
+		return false;
+	}
+
+	if (after.mtime_ns == snapshot->mtime_ns) {
+		return true;
+	}
+
+	struct timespec times[2] = {
+		{.tv_sec = 0, .tv_nsec = UTIME_OMIT},
+		{.tv_sec = snapshot->mtime_ns / 1000000000,
+		 .tv_nsec = snapshot->mtime_ns % 1000000000},
+	};
+
+	if (utimensat(AT_FDCWD, output, times, 0) != 0) {
+		mb_logf(
+			LOG_WARNING, "restat: failed to restore the mtime of \"%s\": %s\n",
+			output, strerror(errno));
+		return false;
+	}
+
+	return true;
+}
+
+/******** recorded pairs ********/
+
+static uint64_t _hash_key(const char *input, const char *output) {
+	/* FNV-1a */
+	uint64_t hash = 0xcbf29ce484222325ull;
+	for (const char *chr = input; *chr != 0; chr++) {
+		hash = (hash ^ (unsigned char)*chr) * 0x100000001b3ull;
+	}
+
+	hash = (hash ^ '\t') * 0x100000001b3ull;
+	for (const char *chr = output; *chr != 0; chr++) {
+		hash = (hash ^ (unsigned char)*chr) * 0x100000001b3ull;
+	}
+
+	return hash;
+}
+
+/**
+ * @brief Find the table slot of a key, either the one holding the key or the
+ * empty slot the key would be inserted into.
+ */
+static size_t *_find_slot(const char *input, const char *output) {
+	size_t mask = table_size - 1;
+	size_t slot = _hash_key(input, output) & mask;
+
+	for (;;) {
+		size_t ix = table[slot];
+		if (ix == 0) {
+			return &table[slot];
+		}
+
+		restat_entry_t *entry = &entries[ix - 1];
+		if (strcmp(entry->input, input) == 0 &&
+			strcmp(entry->output, output) == 0) {
+			return &table[slot];
+		}
+
+		slot = (slot + 1) & mask;
+	}
+}
+
+static void _grow_table(void) {
+	if (table != NULL) {
+		XFREE(table);
+	}
+
+	table_size =
+		table_size == 0 ? RESTAT_INITIAL_TABLE_SIZE : table_size * 2;
+	table = XCALLOC(table_size, sizeof(size_t));
+
+	for (size_t ix = 0; ix < entry_count; ix++) {
+		*_find_slot(entries[ix].input, entries[ix].output) = ix + 1;
+	}
+}
+
+static restat_entry_t *_get_entry(const char *input, const char *output) {
+	/* keep the load factor below 1/2 */
+	if ((entry_count + 1) * 2 > table_size) {
+		_grow_table();
+	}
+
+	size_t *slot = _find_slot(input, output);
+	if (*slot != 0) {
+		return &entries[*slot - 1];
+	}
+
+	if (entry_count == entry_capacity) {
+		entry_capacity = entry_capacity == 0 ? 64 : entry_capacity * 2;
+		entries = entries == NULL
+					  ? XMALLOC(entry_capacity * sizeof(restat_entry_t))
+					  : XREALLOC(
+							entries, entry_capacity * sizeof(restat_entry_t));
+	}
+
+	entries[entry_count] = (restat_entry_t){
+		.input = strdup(input),
+		.output = strdup(output),
+		.input_mtime_ns = -1,
+		.output_mtime_ns = -1,
+		.recorded = false,
+	};
+
+	*slot = ++entry_count;
+	return &entries[entry_count - 1];
+}
+
+/**
+ * @brief Read the pairs of a restat file, pairs recorded since the last save
+ * are kept as they are.
+ */
+static void _read(const char *path) {
+	FILE *file = fopen(path, "r");
+	if (file == NULL) {
+		return;
+	}
+
+	char *line = NULL;
+	size_t line_size = 0;
+
+	int version = 0;
+	if (getline(&line, &line_size, file) < 0 ||
+		sscanf(line, RESTAT_MAGIC " %d", &version) != 1 ||
+		version != MB_RESTAT_VERSION) {
+		mb_logf(
+			LOG_WARNING, "\"%s\" is not a valid restat file, ignoring it\n",
+			path);
+		goto exit;
+	}
+
+	ssize_t len;
+	while ((len = getline(&line, &line_size, file)) > 0) {
+		if (line[len - 1] == '\n') {
+			line[len - 1] = 0;
+		}
+
+		long long input_mtime, output_mtime;
+		int offset;
+		if (sscanf(line, "%lld\t%lld\t%n", &input_mtime, &output_mtime,
+				   &offset) != 2) {
+			continue;
+		}
+
+		char *input = line + offset;
+		char *output = strchr(input, '\t');
+		if (output == NULL) {
+			continue;
+		}
+		*output++ = 0;
+
+		restat_entry_t *entry = _get_entry(input, output);
+		if (!entry->recorded) {
+			entry->input_mtime_ns = input_mtime;
+			entry->output_mtime_ns = output_mtime;
+		}
+	}
+
+exit:
+	if (line != NULL) {
+		free(line);
+	}
+	fclose(file);
+}
+
+static void _load(void) {
+	loaded = true;
+	_read(MB_RESTAT_FILE);
+	mb_logf(LOG_DEBUG, "loaded %zu restat entries\n", entry_count);
+}
+
+/**
+ * @brief Open and lock the lock file of a restat file.
+ * @return The locked file descriptor or -1 on error
+ */
+static int _lock(const char *path) {
+	size_t lock_size = strlen(path) + sizeof(".lock");
+	char *lock_path = XMALLOC(lock_size);
+	snprintf(lock_path, lock_size, "%s.lock", path);
+
+	int fd = open(lock_path, O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+	if (fd < 0) {
+		mb_logf(
+			LOG_WARNING, "failed to open \"%s\": %s\n", lock_path,
+			strerror(errno));
+		XFREE(lock_path);
+		return -1;
+	}
+
+	int res;
+	while ((res = flock(fd, LOCK_EX)) != 0 && errno == EINTR) {
+	}
+
+	if (res != 0) {
+		mb_logf(
+			LOG_WARNING, "failed to lock \"%s\": %s\n", lock_path,
+			strerror(errno));
+		close(fd);
+		fd = -1;
+	}
+
+	XFREE(lock_path);
+	return fd;
+}
+
+void mb_restat_record(const char *input, const char *output) {
+	/* the file format can not represent these */
+	if (strpbrk(input, "\t\n") != NULL || strpbrk(output, "\t\n") != NULL) {
+		return;
+	}
+
+	if (!loaded) {
+		_load();
+	}
+
+	restat_entry_t *entry = _get_entry(input, output);
+	entry->input_mtime_ns = _mtime_ns(input);
+	entry->output_mtime_ns = _mtime_ns(output);
+	entry->recorded = true;
+	dirty = true;
+}
+
+bool mb_restat_clean(const char *input, const char *output) {
+	if (!loaded) {
+		_load();
+	}
+
+	if (entry_count == 0) {
+		return false;
+	}
+
+	size_t ix = *_find_slot(input, output);
+	if (ix == 0) {
+		return false;
+	}
+
+	restat_entry_t *entry = &entries[ix - 1];
+	if (entry->input_mtime_ns < 0 || entry->output_mtime_ns < 0) {
+		return false;
+	}
+
+	int64_t input_mtime = _mtime_ns(input);
+	return input_mtime >= 0 && input_mtime <= entry->input_mtime_ns &&
+		   _mtime_ns(output) == entry->output_mtime_ns;
+}
+
+bool mb_restat_save(const char *path) {
+	if (!dirty) {
+		return true;
+	}
+
+	/* the builds of several targets may save at once, keep the pairs the
+	 * others saved since the file was loaded */
+	int lock_fd = _lock(path);
+	if (lock_fd < 0) {
+		return false;
+	}
+
+	_read(path);
+
+	size_t tmp_size = strlen(path) + 32;
+	char *tmp_path = XMALLOC(tmp_size);
+	snprintf(tmp_path, tmp_size, "%s.%ld.tmp", path, (long)getpid());
+
+	FILE *file = fopen(tmp_path, "w");
+	if (file == NULL) {
+		mb_logf(
+			LOG_WARNING, "failed to write \"%s\": %s\n", tmp_path,
+			strerror(errno));
+		XFREE(tmp_path);
+		close(lock_fd);
+		return false;
+	}
+
+	fprintf(file, RESTAT_MAGIC " %d\n", MB_RESTAT_VERSION);
+	for (size_t ix = 0; ix < entry_count; ix++) {
+		restat_entry_t *entry = &entries[ix];
+
+		/* pairs whose files are gone are of no use anymore */
+		if (entry->input_mtime_ns < 0 || entry->output_mtime_ns < 0) {
+			continue;
+		}
+
+		fprintf(
+			file, "%lld\t%lld\t%s\t%s\n", (long long)entry->input_mtime_ns,
+			(long long)entry->output_mtime_ns, entry->input, entry->output);
+	}
+
+	bool ok = fclose(file) == 0 && rename(tmp_path, path) == 0;
+	if (!ok) {
+		mb_logf(
+			LOG_WARNING, "failed to write \"%s\": %s\n", path,
+			strerror(errno));
+		unlink(tmp_path);
+	} else {
+		for (size_t ix = 0; ix < entry_count; ix++) {
+			entries[ix].recorded = false;
+		}
+		dirty = false;
+	}
+
+	close(lock_fd);
+	XFREE(tmp_path);
+	return ok;
+}
+
+void mb_restat_free(void) {
+	for (size_t ix = 0; ix < entry_count; ix++) {
+		XFREE(entries[ix].input);
+		XFREE(entries[ix].output);
+	}
+
+	if (entries != NULL) {
+		XFREE(entries);
+	}
+
+	if (table != NULL) {
+		XFREE(table);
+	}
+
+	entries = NULL;
+	entry_count = 0;
+	entry_capacity = 0;
+	table = NULL;
+	table_size = 0;
+	loaded = false;
+	dirty = false;
+}
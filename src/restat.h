@@ -0,0 +1,62 @@
+/* restat.h ; mariebuild early cutoff for unchanged outputs header
+ *
+ * Copyright (c) 2025, Marie Eckert
+ * Licensend under the BSD 3-Clause License.
+ */
+
+#ifndef RESTAT_H
+#define RESTAT_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#define MB_RESTAT_FILE ".mb_restat"
+
+/* Bumped whenever the format of the restat file changes */
+#define MB_RESTAT_VERSION 1
+
+/* State of an output before the job producing it runs */
+typedef struct restat_snapshot {
+	bool exists;
+	uint64_t size;
+	uint64_t hash;
+	int64_t mtime_ns;
+} restat_snapshot_t;
+
+/**
+ * @brief Hash the content of an output before the job producing it runs.
+ */
+void mb_restat_snapshot(const char *output, restat_snapshot_t *snapshot);
+
+/**
+ * @brief Compare an output after its job succeeded with its snapshot. If the
+ * content did not change the old modification time is restored, so rules
+ * using the output as their input do not consider it as changed.
+ * @return true if the output is unchanged
+ */
+bool mb_restat_unchanged(
+	const char *output,
+	const restat_snapshot_t *snapshot);
+
+/**
+ * @brief Remember that output is up to date with the current version of
+ * input even though it is older than it.
+ */
+void mb_restat_record(const char *input, const char *output);
+
+/**
+ * @brief Check if output was recorded as up to date with input and neither of
+ * them changed since.
+ */
+bool mb_restat_clean(const char *input, const char *output);
+
+/**
+ * @brief Write the recorded pairs to the restat file if there are new ones,
+ * merged with the pairs other processes saved to it in the meantime.
+ * @return Success?
+ */
+bool mb_restat_save(const char *path);
+
+void mb_restat_free(void);
+
+#endif /* #ifndef RESTAT_H */
@@ -5,12 +5,17 @@
  */
 
 #define _XOPEN_SOURCE 700
-#define _POSIX_C_SOURCE 2
+#define _POSIX_C_SOURCE 200809L
 
+#include <errno.h>
 #include <stdbool.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <time.h>
+
+#include <sys/wait.h>
 
 #include "cptrlist.h"
 #include "logging.h"
@@ -26,11 +31,161 @@
 		}                                                                    \
 	} while (0)
 
+/* upper bound of jobs running at once, groups beyond it are not tracked */
+#define MAX_JOB_GROUPS 1024
+
 CPtrList tmp_files;
 bool initialised = false;
 
+/* process groups of the running jobs, 0 is a free slot. A fixed array since
+ * the signal handler may read it at any time. */
+static volatile sig_atomic_t job_groups[MAX_JOB_GROUPS];
+
+/* process groups of the target processes of a multi-target build, kept
+ * apart since they cancel jobs of their own before exiting */
+static volatile sig_atomic_t target_groups[MAX_JOB_GROUPS];
+
+static uint64_t _now_ns(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
+}
+
+/**
+ * @brief Reap exited children until none of the groups exist anymore or the
+ * deadline passed.
+ * @return true if all groups are gone
+ */
+static bool _wait_groups(volatile sig_atomic_t *groups, uint64_t deadline) {
+	const struct timespec poll_interval = {
+		.tv_sec = 0, .tv_nsec = MB_CANCEL_POLL_NS};
+
+	for (;;) {
+		while (waitpid(-1, NULL, WNOHANG) > 0) {
+		}
+
+		bool remaining = false;
+		for (size_t ix = 0; ix < MAX_JOB_GROUPS; ix++) {
+			if (groups[ix] == 0) {
+				continue;
+			}
+
+			if (kill(-groups[ix], 0) != 0 && errno == ESRCH) {
+				groups[ix] = 0;
+			} else {
+				remaining = true;
+			}
+		}
+
+		if (!remaining) {
+			return true;
+		}
+
+		if (_now_ns() >= deadline) {
+			return false;
+		}
+
+		nanosleep(&poll_interval, NULL);
+	}
+}
+
+/**
+ * @return true if any of the groups was signalled
+ */
+static bool _signal_groups(volatile sig_atomic_t *groups, int signal) {
+	bool any = false;
+	for (size_t ix = 0; ix < MAX_JOB_GROUPS; ix++) {
+		if (groups[ix] != 0) {
+			kill(-groups[ix], signal);
+			any = true;
+		}
+	}
+
+	return any;
+}
+
+/**
+ * @brief Wait for the groups to exit until the deadline, then kill the
+ * ones left and reap them.
+ */
+static void _finish_groups(volatile sig_atomic_t *groups, uint64_t deadline) {
+	if (_wait_groups(groups, deadline)) {
+		return;
+	}
+
+	_signal_groups(groups, SIGKILL);
+	_wait_groups(groups, _now_ns() + MB_CANCEL_GRACE_NS);
+}
+
+void mb_terminate_job_groups(void) {
+	uint64_t now = _now_ns();
+	bool any_jobs = _signal_groups(job_groups, SIGTERM);
+	bool any_targets = _signal_groups(target_groups, SIGTERM);
+
+	if (any_jobs) {
+		_finish_groups(job_groups, now + MB_CANCEL_GRACE_NS);
+	}
+
+	if (any_targets) {
+		_finish_groups(target_groups, now + MB_TARGET_CANCEL_GRACE_NS);
+	}
+}
+
+static void _register_group(volatile sig_atomic_t *groups, int pgid) {
+	for (size_t ix = 0; ix < MAX_JOB_GROUPS; ix++) {
+		if (groups[ix] == 0) {
+			groups[ix] = pgid;
+			return;
+		}
+	}
+}
+
+static void _unregister_group(volatile sig_atomic_t *groups, int pgid) {
+	for (size_t ix = 0; ix < MAX_JOB_GROUPS; ix++) {
+		if (groups[ix] == pgid) {
+			groups[ix] = 0;
+			return;
+		}
+	}
+}
+
+void mb_register_job_group(int pgid) {
+	_register_group(job_groups, pgid);
+}
+
+void mb_unregister_job_group(int pgid) {
+	_unregister_group(job_groups, pgid);
+}
+
+void mb_register_target_group(int pgid) {
+	_register_group(target_groups, pgid);
+}
+
+void mb_unregister_target_group(int pgid) {
+	_unregister_group(target_groups, pgid);
+}
+
 void mb_signal_generic_handler(int signal) {
-	mb_logf(LOG_ERROR, "signal %d received, quitting...\n", signal);
+	/* formatted by hand, snprintf is not async-signal-safe */
+	static const char quitting[] = " received, quitting...\n";
+	char msg[64] = "signal ";
+	size_t len = strlen(msg);
+
+	char digits[12];
+	size_t digit_count = 0;
+	do {
+		digits[digit_count++] = '0' + signal % 10;
+		signal /= 10;
+	} while (signal > 0 && digit_count < sizeof(digits));
+
+	while (digit_count > 0) {
+		msg[len++] = digits[--digit_count];
+	}
+	memcpy(msg + len, quitting, sizeof(quitting));
+
+	mb_log_error_signal_safe(msg);
+	mb_terminate_job_groups();
+
 	for (size_t ix = 0; ix < tmp_files.size; ix++) {
 		char *item = tmp_files.items[ix];
 		if (item == NULL) {
@@ -40,6 +195,7 @@ void mb_signal_generic_handler(int signal) {
 		remove(item);
 	}
 
+	mb_log_flush();
 	exit(-1);
 }
 
@@ -62,6 +218,10 @@ void mb_register_tmp_file(char *path) {
 }
 
 void mb_unregister_tmp_file(char *path) {
-	size_t ix = cptrlist_find(&tmp_files, path, &string_cptrlist_search);
+	ssize_t ix = cptrlist_find(&tmp_files, path, &string_cptrlist_search);
+	if (ix < 0) {
+		return;
+	}
+
 	cptrlist_free_at(&tmp_files, ix);
 }
@@ -9,6 +9,17 @@
 
 #include <signal.h>
 
+/* time jobs get to exit after SIGTERM before they are killed */
+#define MB_CANCEL_GRACE_NS (2000ull * 1000 * 1000)
+
+/* time target processes of a multi-target build get to exit after SIGTERM,
+ * they cancel their own jobs first which takes up to two grace periods */
+#define MB_TARGET_CANCEL_GRACE_NS \
+	(2 * MB_CANCEL_GRACE_NS + 1000ull * 1000 * 1000)
+
+/* interval in which cancelled jobs are checked for having exited */
+#define MB_CANCEL_POLL_NS (10 * 1000 * 1000)
+
 void mb_signal_generic_handler(int signal);
 
 void mb_install_signal_handlers(void);
@@ -17,4 +28,28 @@ void mb_register_tmp_file(char *path);
 
 void mb_unregister_tmp_file(char *path);
 
+/**
+ * @brief Remember the process group of a running job, so it is terminated
+ * when mariebuild receives a signal.
+ */
+void mb_register_job_group(int pgid);
+
+void mb_unregister_job_group(int pgid);
+
+/**
+ * @brief Remember the process group of a target process, so it is terminated
+ * when mariebuild receives a signal.
+ */
+void mb_register_target_group(int pgid);
+
+void mb_unregister_target_group(int pgid);
+
+/**
+ * @brief Send SIGTERM to the process groups of all running jobs and target
+ * processes, SIGKILL to jobs still running after MB_CANCEL_GRACE_NS and to
+ * target processes still running after MB_TARGET_CANCEL_GRACE_NS, and reap
+ * them. Safe to call from a signal handler.
+ */
+void mb_terminate_job_groups(void);
+
 #endif
@@ -0,0 +1,149 @@
+/* stats.c ; mariebuild internal overhead statistics
+ *
+ * Copyright (c) 2025, Marie Eckert
+ * Licensend under the BSD 3-Clause License.
+ */
+
+#define _XOPEN_SOURCE 700
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <time.h>
+
+#include <sys/resource.h>
+
+#include "logging.h"
+#include "stats.h"
+
+/* one bucket per power of two nanoseconds */
+#define HISTOGRAM_BUCKETS 64
+
+typedef struct stat_entry {
+	uint64_t count;
+	uint64_t total;
+	uint64_t max;
+	uint64_t histogram[HISTOGRAM_BUCKETS];
+} stat_entry_t;
+
+bool mb_stats_enabled = false;
+uint64_t mb_stats_allocs = 0;
+
+static stat_entry_t entries[__STAT_UPPER_BOUND];
+
+static const char *stat_names[__STAT_UPPER_BOUND] = {
+	[STAT_PARSE] = "mcfg_parse_from_file",
+	[STAT_FORMAT] = "mcfg_format_field_embeds",
+	[STAT_FILE_NEWER] = "is_file_newer",
+	[STAT_PREPARE_EXEC] = "_prepare_exec",
+	[STAT_FORK] = "fork",
+	[STAT_FIND_SLOT] = "_find_process_slot",
+	[STAT_RESTAT] = "mb_restat_snapshot",
+	[STAT_ACTION] = "mb_action_run",
+};
+
+uint64_t mb_stats_now(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
+}
+
+uint64_t mb_stats_begin(void) {
+	if (!mb_stats_enabled) {
+		return 0;
+	}
+
+	return mb_stats_now();
+}
+
+static size_t _bucket_of(uint64_t ns) {
+	size_t bucket = 0;
+	while (ns > 1 && bucket < HISTOGRAM_BUCKETS - 1) {
+		ns >>= 1;
+		bucket++;
+	}
+
+	return bucket;
+}
+
+void mb_stats_end(mb_stat_t stat, uint64_t begin) {
+	if (begin == 0 || stat >= __STAT_UPPER_BOUND) {
+		return;
+	}
+
+	uint64_t elapsed = mb_stats_now() - begin;
+	stat_entry_t *entry = &entries[stat];
+
+	entry->count++;
+	entry->total += elapsed;
+	if (elapsed > entry->max) {
+		entry->max = elapsed;
+	}
+
+	entry->histogram[_bucket_of(elapsed)]++;
+}
+
+/**
+ * @brief Estimate a percentile from the histogram of an entry. The result is
+ * the upper bound of the bucket the percentile falls into.
+ */
+static uint64_t _percentile(const stat_entry_t *entry, double pct) {
+	uint64_t wanted = (uint64_t)((double)entry->count * pct);
+	uint64_t seen = 0;
+
+	for (size_t bucket = 0; bucket < HISTOGRAM_BUCKETS; bucket++) {
+		seen += entry->histogram[bucket];
+		if (seen > wanted) {
+			uint64_t upper = (uint64_t)1 << (bucket + 1);
+			return upper < entry->max ? upper : entry->max;
+		}
+	}
+
+	return entry->max;
+}
+
+int64_t mb_rusage_maxrss_kb(const struct rusage *usage) {
+#ifdef __APPLE__
+	return usage->ru_maxrss / 1024;
+#else
+	return usage->ru_maxrss;
+#endif
+}
+
+static double _to_us(uint64_t ns) {
+	return (double)ns / 1000.0;
+}
+
+void mb_stats_print(void) {
+	mb_log_flush();
+
+	fprintf(stderr, "mariebuild overhead statistics:\n");
+	fprintf(
+		stderr, "  %-26s %9s %12s %10s %10s %10s %10s\n", "path", "count",
+		"total (ms)", "mean (us)", "p50 (us)", "p99 (us)", "max (us)");
+
+	for (size_t ix = 0; ix < __STAT_UPPER_BOUND; ix++) {
+		const stat_entry_t *entry = &entries[ix];
+		if (entry->count == 0) {
+			continue;
+		}
+
+		fprintf(
+			stderr, "  %-26s %9lu %12.3f %10.2f %10.2f %10.2f %10.2f\n",
+			stat_names[ix], (unsigned long)entry->count,
+			(double)entry->total / 1000000.0,
+			_to_us(entry->total / entry->count),
+			_to_us(_percentile(entry, 0.5)), _to_us(_percentile(entry, 0.99)),
+			_to_us(entry->max));
+	}
+
+	struct rusage usage;
+	if (getrusage(RUSAGE_SELF, &usage) == 0) {
+		fprintf(
+			stderr, "  peak rss: %lld KiB\n",
+			(long long)mb_rusage_maxrss_kb(&usage));
+	}
+
+	fprintf(stderr, "  allocations: %lu\n", (unsigned long)mb_stats_allocs);
+}
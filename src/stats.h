@@ -0,0 +1,69 @@
+/* stats.h ; mariebuild internal overhead statistics header
+ *
+ * Copyright (c) 2025, Marie Eckert
+ * Licensend under the BSD 3-Clause License.
+ */
+
+#ifndef STATS_H
+#define STATS_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include <sys/resource.h>
+
+typedef enum mb_stat {
+	STAT_PARSE = 0,
+	STAT_FORMAT,
+	STAT_FILE_NEWER,
+	STAT_PREPARE_EXEC,
+	STAT_FORK,
+	STAT_FIND_SLOT,
+	STAT_RESTAT,
+	STAT_ACTION,
+	__STAT_UPPER_BOUND
+} mb_stat_t;
+
+extern bool mb_stats_enabled;
+
+/* incremented by the XMALLOC family and strdup, always counted since it is
+ * only a single increment. */
+extern uint64_t mb_stats_allocs;
+
+/**
+ * @brief Get the current time of the monotonic clock in nanoseconds.
+ */
+uint64_t mb_stats_now(void);
+
+/**
+ * @brief Start timing a hot-path. Returns 0 if statistics are disabled, which
+ * makes the matching mb_stats_end call a no-op.
+ */
+uint64_t mb_stats_begin(void);
+
+/**
+ * @brief Record the time passed since begin for the given statistic.
+ */
+void mb_stats_end(mb_stat_t stat, uint64_t begin);
+
+/**
+ * @brief Get the maximum resident set size of a rusage in KiB, regardless of
+ * the unit used by the OS.
+ */
+int64_t mb_rusage_maxrss_kb(const struct rusage *usage);
+
+/**
+ * @brief Print a summary of all statistics collected so far.
+ */
+void mb_stats_print(void);
+
+/* Time a single expression, evaluates to the result of the expression. */
+#define STATS_TIMED(stat, expr)                   \
+	({                                            \
+		uint64_t _stats_begin = mb_stats_begin(); \
+		__typeof__(expr) _stats_ret = (expr);     \
+		mb_stats_end(stat, _stats_begin);         \
+		_stats_ret;                               \
+	})
+
+#endif /* #ifndef STATS_H */
@@ -7,6 +7,7 @@
 #include <stdlib.h>
 #include <string.h>
 
+#include "stats.h"
 #include "stringutil.h"
 
 bool string_cptrlist_search(void *a, void *b) {
@@ -33,6 +34,7 @@ char *strdup(const char *in) {
 		return NULL;
 	}
 
+	mb_stats_allocs++;
 	memcpy(out, in, strlen(in) + 1);
 	return out;
 }
@@ -9,18 +9,31 @@
 
 #include <string.h>
 
+#include "accounting.h"
+#include "actions.h"
 #include "c_rule.h"
 #include "cptrlist.h"
+#include "events.h"
 #include "executor.h"
 #include "logging.h"
 #include "mcfg.h"
 #include "mcfg_format.h"
 #include "mcfg_util.h"
+#include "stats.h"
 #include "stringutil.h"
 #include "target.h"
 #include "types.h"
 #include "xmem.h"
 
+/* targets which already ran in this build, no matter if they succeeded */
+static CPtrList built_targets = {.capacity = 0};
+
+static bool _target_built(const char *name) {
+	return built_targets.capacity != 0 &&
+		   cptrlist_find(
+			   &built_targets, (void *)name, &string_cptrlist_search) != -1;
+}
+
 bool remove_dynfield(mcfg_file_t *file, char *name) {
 	ssize_t field_ix = -1;
 
@@ -159,6 +172,12 @@ int mb_run_target(
 		return 1;
 	}
 
+	/* a target required by several others only runs once */
+	if (_target_built(target->name)) {
+		mb_logf(LOG_DEBUG, "target \"%s\" already ran\n", target->name);
+		return 0;
+	}
+
 	if (cptrlist_find(target_history, target->name, &string_cptrlist_search) !=
 		-1) {
 		mb_logf(
@@ -177,11 +196,14 @@ int mb_run_target(
 	CPtrList linked_fields = link_target_fields(file, target);
 
 	mb_logf(LOG_INFO, "building target \"%s\"\n", target->name);
+	mb_event_target_start(target->name);
+	mb_accounting_enter_target(target->name);
 
 	/* Target Execution Order
 	 * 1. required targets
 	 * 2. compilation rules
-	 * 3. "exec" field
+	 * 3. "actions" field
+	 * 4. "exec" field
 	 */
 
 	int ret = 0;
@@ -197,20 +219,31 @@ int mb_run_target(
 		goto exit;
 	}
 
+	mcfg_path_t pathrel = {
+		.absolute = true,
+		.dynfield_path = false,
+
+		.sector = "targets",
+		.section = target->name,
+		.field = ""};
+
+	/* builtin actions run after the compilation rules, before exec */
+	mcfg_field_t *field_actions = mcfg_get_field(target, "actions");
+	if (field_actions != NULL &&
+		!mb_actions_run(file, field_actions, pathrel, target->name)) {
+		ret = 1;
+		if (!cfg.ignore_failures) {
+			goto exit;
+		}
+	}
+
 	mcfg_field_t *field_exec = mcfg_get_field(target, "exec");
 	char *exec = NULL;
 	if (field_exec != NULL) {
 		char *raw_exec = mcfg_data_to_string(*field_exec);
-		mcfg_path_t pathrel = {
-			.absolute = true,
-			.dynfield_path = false,
-
-			.sector = "targets",
-			.section = target->name,
-			.field = ""};
-
-		mcfg_fmt_res_t fmt_res =
-			mcfg_format_field_embeds_str(raw_exec, *file, pathrel);
+		mcfg_fmt_res_t fmt_res = STATS_TIMED(
+			STAT_FORMAT,
+			mcfg_format_field_embeds_str(raw_exec, *file, pathrel));
 		if (fmt_res.err != MCFG_FMT_OK) {
 			mb_logf(
 				LOG_ERROR,
@@ -224,7 +257,13 @@ int mb_run_target(
 	}
 
 	if (exec != NULL) {
-		tmp_ret = mb_exec(exec, target->name);
+		mb_event_job_queued(target->name, NULL);
+		exec_options_t exec_options;
+		if (mb_exec_options_load(target, &exec_options)) {
+			tmp_ret = mb_exec(exec, target->name, NULL, &exec_options);
+		} else {
+			tmp_ret = 1;
+		}
 		ret = ret > tmp_ret ? ret : tmp_ret;
 		XFREE(exec);
 		if (ret != 0 && !cfg.ignore_failures) {
@@ -237,6 +276,9 @@ int mb_run_target(
 	}
 
 exit:;
+	mb_accounting_leave_target();
+	mb_event_target_end(target->name, ret);
+
 	int ix =
 		cptrlist_find(target_history, target->name, &string_cptrlist_search);
 	if (ix > -1) {
@@ -246,6 +288,56 @@ exit:;
 	unlink_target_fields(file, linked_fields);
 	cptrlist_destroy(&linked_fields);
 
+	if (built_targets.capacity == 0) {
+		cptrlist_init(&built_targets, 4, 4);
+	}
+	cptrlist_append(&built_targets, strdup(target->name));
+
 	target_history->size--;
 	return ret;
 }
+
+void mb_collect_required_targets(
+	mcfg_file_t *file,
+	mcfg_section_t *target,
+	CPtrList *required) {
+	if (cptrlist_find(required, target->name, &string_cptrlist_search) != -1) {
+		return;
+	}
+
+	/* appended before its requirements to stop circles, moved behind them
+	 * below */
+	cptrlist_append(required, strdup(target->name));
+	size_t own_ix = required->size - 1;
+
+	mcfg_field_t *field_required_targets =
+		mcfg_get_field(target, "required_targets");
+	mcfg_sector_t *targets = mcfg_get_sector(file, "targets");
+	if (field_required_targets != NULL) {
+		mcfg_list_t *list = mcfg_data_as_list(*field_required_targets);
+		for (size_t ix = 0; ix < list->field_count; ix++) {
+			char *name = mcfg_data_to_string(list->fields[ix]);
+			mcfg_section_t *curr_target =
+				name == NULL ? NULL : mcfg_get_section(targets, name);
+			if (curr_target != NULL) {
+				mb_collect_required_targets(file, curr_target, required);
+			}
+			XFREE(name);
+		}
+	}
+
+	char *own = required->items[own_ix];
+	for (size_t ix = own_ix; ix + 1 < required->size; ix++) {
+		required->items[ix] = required->items[ix + 1];
+	}
+	required->items[required->size - 1] = own;
+}
+
+void mb_targets_free(void) {
+	if (built_targets.capacity == 0) {
+		return;
+	}
+
+	cptrlist_destroy(&built_targets);
+	built_targets = (CPtrList){.capacity = 0};
+}
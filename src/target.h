@@ -11,10 +11,27 @@
 #include "mcfg.h"
 #include "types.h"
 
+/**
+ * @brief Run a target after the targets it requires. A target which already
+ * ran in this build, e.g. because several targets require it, is skipped.
+ * @return The highest exit status of the target and its requirements
+ */
 int mb_run_target(
 	mcfg_file_t *file,
 	mcfg_section_t *target,
 	CPtrList *target_history,
 	const config_t cfg);
 
+/**
+ * @brief Collect a target and all targets it requires, directly or not, in
+ * the order they run in. Targets already in the list are not added again.
+ * @param required List of heap allocated target names
+ */
+void mb_collect_required_targets(
+	mcfg_file_t *file,
+	mcfg_section_t *target,
+	CPtrList *required);
+
+void mb_targets_free(void);
+
 #endif /* #ifndef TARGET_H */
@@ -0,0 +1,375 @@
+/* topology.c ; mariebuild cpu topology and default parallelism
+ *
+ * The default number of parallel jobs follows the CPUs mariebuild may
+ * actually use: the CPU affinity mask of the process, capped by the CPU
+ * bandwidth quota (cpu.max, or cpu.cfs_quota_us on cgroup v1) of every
+ * cgroup it is nested in. A container limited to 4 CPUs on a large host thus
+ * runs 4 jobs and not one per host CPU.
+ *
+ * If pinning is enabled every process slot of a parallel rule is bound to a
+ * CPU. The CPUs are ordered so that consecutive slots alternate between NUMA
+ * nodes and take one thread of every physical core before any SMT sibling.
+ *
+ * Copyright (c) 2025, Marie Eckert
+ * Licensend under the BSD 3-Clause License.
+ */
+
+#define _GNU_SOURCE
+
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <dirent.h>
+#include <sched.h>
+
+#include "logging.h"
+#include "mcfg.h"
+#include "mcfg_util.h"
+#include "topology.h"
+#include "xmem.h"
+
+#define TOPOLOGY_PATH_SIZE 512
+
+#define CGROUP_ROOT "/sys/fs/cgroup"
+
+typedef struct cpu_info {
+	int cpu;
+	long node;
+	long package;
+	long core;
+
+	/* position of the thread within its core, the core within its node */
+	size_t thread_rank;
+	size_t core_rank;
+} cpu_info_t;
+
+static size_t default_jobs = 0;
+
+/* CPUs in pinning order, NULL if jobs are not pinned */
+static int *pin_order = NULL;
+static size_t pin_count = 0;
+
+/**
+ * @brief Read a file containing a single integer.
+ * @return Success?
+ */
+static bool _read_long(const char *path, long *value) {
+	FILE *file = fopen(path, "r");
+	if (file == NULL) {
+		return false;
+	}
+
+	bool ok = fscanf(file, "%ld", value) == 1;
+	fclose(file);
+	return ok;
+}
+
+bool mb_cgroup_dir(char *dir, size_t size) {
+	FILE *file = fopen("/proc/self/cgroup", "r");
+	if (file == NULL) {
+		return false;
+	}
+
+	char line[TOPOLOGY_PATH_SIZE];
+	bool found = false;
+	while (fgets(line, sizeof(line), file) != NULL) {
+		/* the v2 hierarchy is the one with id 0 and no controllers */
+		if (strncmp(line, "0::", 3) != 0) {
+			continue;
+		}
+
+		line[strcspn(line, "\n")] = 0;
+		snprintf(dir, size, CGROUP_ROOT "%s", line + 3);
+		found = true;
+		break;
+	}
+
+	fclose(file);
+	return found;
+}
+
+/**
+ * @brief Convert a CPU bandwidth quota into a number of CPUs, rounded up.
+ * @return The number of CPUs or 0 if there is no quota
+ */
+static size_t _quota_cpus(long quota, long period) {
+	if (quota <= 0 || period <= 0) {
+		return 0;
+	}
+
+	return (size_t)((quota + period - 1) / period);
+}
+
+static size_t _min_limit(size_t a, size_t b) {
+	if (a == 0) {
+		return b;
+	}
+
+	if (b == 0) {
+		return a;
+	}
+
+	return a < b ? a : b;
+}
+
+/**
+ * @brief Find the smallest CPU quota of the cgroups this process is in. A
+ * quota set on any ancestor applies as well, so the whole path up to the
+ * root is checked.
+ * @return The quota in CPUs or 0 if there is none
+ */
+static size_t _cgroup_cpus(void) {
+	size_t limit = 0;
+
+	char dir[TOPOLOGY_PATH_SIZE - 16];
+	if (mb_cgroup_dir(dir, sizeof(dir))) {
+		for (;;) {
+			char path[TOPOLOGY_PATH_SIZE];
+			snprintf(path, sizeof(path), "%s/cpu.max", dir);
+
+			/* "max 100000" if unlimited, fscanf then fails on the quota */
+			FILE *file = fopen(path, "r");
+			if (file != NULL) {
+				long quota, period;
+				if (fscanf(file, "%ld %ld", &quota, &period) == 2) {
+					limit = _min_limit(limit, _quota_cpus(quota, period));
+				}
+				fclose(file);
+			}
+
+			char *slash = strrchr(dir, '/');
+			if (strcmp(dir, CGROUP_ROOT) == 0 || slash == NULL) {
+				break;
+			}
+			*slash = 0;
+		}
+	}
+
+	/* cgroup v1, mounted as seen from inside the cgroup namespace */
+	static const char *v1_dirs[] = {
+		CGROUP_ROOT "/cpu",
+		CGROUP_ROOT "/cpu,cpuacct",
+	};
+
+	for (size_t ix = 0; ix < sizeof(v1_dirs) / sizeof(v1_dirs[0]); ix++) {
+		char path[TOPOLOGY_PATH_SIZE];
+		long quota, period;
+
+		snprintf(path, sizeof(path), "%s/cpu.cfs_quota_us", v1_dirs[ix]);
+		if (!_read_long(path, &quota)) {
+			continue;
+		}
+
+		snprintf(path, sizeof(path), "%s/cpu.cfs_period_us", v1_dirs[ix]);
+		if (!_read_long(path, &period)) {
+			continue;
+		}
+
+		limit = _min_limit(limit, _quota_cpus(quota, period));
+	}
+
+	return limit;
+}
+
+size_t mb_default_jobs(void) {
+	if (default_jobs != 0) {
+		return default_jobs;
+	}
+
+	cpu_set_t set;
+	size_t cpus = 0;
+	if (sched_getaffinity(0, sizeof(set), &set) == 0) {
+		cpus = CPU_COUNT(&set);
+	}
+
+	size_t quota = _cgroup_cpus();
+	default_jobs = _min_limit(cpus, quota);
+	if (default_jobs == 0) {
+		default_jobs = 1;
+	}
+
+	mb_logf(
+		LOG_DEBUG, "default jobs: %zu (%zu usable cpus, cgroup quota %zu)\n",
+		default_jobs, cpus, quota);
+
+	return default_jobs;
+}
+
+/**
+ * @brief Find the NUMA node of a CPU from the nodeN link in its sysfs
+ * directory.
+ * @return The node, 0 if the system has no NUMA information
+ */
+static long _cpu_node(int cpu) {
+	char path[TOPOLOGY_PATH_SIZE];
+	snprintf(path, sizeof(path), "/sys/devices/system/cpu/cpu%d", cpu);
+
+	DIR *dir = opendir(path);
+	if (dir == NULL) {
+		return 0;
+	}
+
+	long node = 0;
+	struct dirent *entry;
+	while ((entry = readdir(dir)) != NULL) {
+		if (sscanf(entry->d_name, "node%ld", &node) == 1) {
+			break;
+		}
+	}
+
+	closedir(dir);
+	return node;
+}
+
+static long _cpu_topology_value(int cpu, const char *name, long fallback) {
+	char path[TOPOLOGY_PATH_SIZE];
+	snprintf(
+		path, sizeof(path), "/sys/devices/system/cpu/cpu%d/topology/%s", cpu,
+		name);
+
+	long value;
+	return _read_long(path, &value) ? value : fallback;
+}
+
+static int _compare_cpus(const void *a, const void *b) {
+	const cpu_info_t *x = a;
+	const cpu_info_t *y = b;
+
+	if (x->thread_rank != y->thread_rank) {
+		return x->thread_rank < y->thread_rank ? -1 : 1;
+	}
+
+	if (x->core_rank != y->core_rank) {
+		return x->core_rank < y->core_rank ? -1 : 1;
+	}
+
+	if (x->node != y->node) {
+		return x->node < y->node ? -1 : 1;
+	}
+
+	return x->cpu - y->cpu;
+}
+
+/**
+ * @brief Order the CPUs of the affinity mask for pinning.
+ * @return Success?
+ */
+static bool _load_pin_order(void) {
+	cpu_set_t set;
+	if (sched_getaffinity(0, sizeof(set), &set) != 0) {
+		mb_log(LOG_ERROR, "pin_jobs: could not get the cpu affinity mask\n");
+		return false;
+	}
+
+	size_t count = CPU_COUNT(&set);
+	if (count == 0) {
+		return false;
+	}
+
+	cpu_info_t *cpus = XCALLOC(count, sizeof(cpu_info_t));
+
+	size_t n = 0;
+	for (int cpu = 0; cpu < CPU_SETSIZE && n < count; cpu++) {
+		if (!CPU_ISSET(cpu, &set)) {
+			continue;
+		}
+
+		cpu_info_t *info = &cpus[n++];
+		*info = (cpu_info_t){
+			.cpu = cpu,
+			.node = _cpu_node(cpu),
+			.package = _cpu_topology_value(cpu, "physical_package_id", 0),
+			.core = _cpu_topology_value(cpu, "core_id", cpu),
+		};
+
+		/* CPUs are visited in ascending order, so the first thread of a
+		 * core has already been seen when its siblings come up */
+		size_t sibling = n - 1;
+		for (size_t ix = 0; ix < n - 1; ix++) {
+			if (cpus[ix].package != info->package ||
+				cpus[ix].core != info->core) {
+				continue;
+			}
+
+			if (info->thread_rank++ == 0) {
+				sibling = ix;
+			}
+		}
+
+		if (sibling != n - 1) {
+			info->core_rank = cpus[sibling].core_rank;
+			continue;
+		}
+
+		for (size_t ix = 0; ix < n - 1; ix++) {
+			if (cpus[ix].node == info->node && cpus[ix].thread_rank == 0) {
+				info->core_rank++;
+			}
+		}
+	}
+
+	qsort(cpus, n, sizeof(cpu_info_t), _compare_cpus);
+
+	pin_order = XMALLOC(n * sizeof(int));
+	pin_count = n;
+	for (size_t ix = 0; ix < n; ix++) {
+		pin_order[ix] = cpus[ix].cpu;
+		mb_logf(
+			LOG_DEBUG, "pin slot %zu: cpu %d (node %ld, core %ld)\n", ix,
+			cpus[ix].cpu, cpus[ix].node, cpus[ix].core);
+	}
+
+	XFREE(cpus);
+	return pin_count > 0;
+}
+
+bool mb_topology_load(mcfg_file_t *file) {
+	mcfg_section_t *section =
+		mcfg_get_section(mcfg_get_sector(file, "config"), "mariebuild");
+	if (section == NULL) {
+		return true;
+	}
+
+	mcfg_field_t *field_pin_jobs = mcfg_get_field(section, "pin_jobs");
+	if (field_pin_jobs == NULL) {
+		return true;
+	}
+
+	if (field_pin_jobs->type != TYPE_BOOL) {
+		mb_log(LOG_ERROR, "field \"pin_jobs\" should be of type bool\n");
+		return false;
+	}
+
+	if (!mcfg_data_as_bool(*field_pin_jobs)) {
+		return true;
+	}
+
+	return _load_pin_order();
+}
+
+void mb_topology_free(void) {
+	if (pin_order != NULL) {
+		XFREE(pin_order);
+	}
+
+	pin_order = NULL;
+	pin_count = 0;
+}
+
+int mb_topology_cpu(size_t slot) {
+	if (pin_order == NULL) {
+		return -1;
+	}
+
+	return pin_order[slot % pin_count];
+}
+
+bool mb_topology_pin(int pid, int cpu) {
+	cpu_set_t set;
+	CPU_ZERO(&set);
+	CPU_SET(cpu, &set);
+
+	return sched_setaffinity(pid, sizeof(set), &set) == 0;
+}
@@ -0,0 +1,52 @@
+/* topology.h ; mariebuild cpu topology and default parallelism header
+ *
+ * Copyright (c) 2025, Marie Eckert
+ * Licensend under the BSD 3-Clause License.
+ */
+
+#ifndef TOPOLOGY_H
+#define TOPOLOGY_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+#include "mcfg.h"
+
+/**
+ * @brief Read the pin_jobs field of the /config/mariebuild section and
+ * determine the order in which jobs are pinned to CPUs if it is set.
+ * @return Success?
+ */
+bool mb_topology_load(mcfg_file_t *file);
+
+void mb_topology_free(void);
+
+/**
+ * @brief The number of jobs to run in parallel if a rule does not set
+ * max_procs: the number of CPUs this process may run on, capped by the CPU
+ * quota of its cgroup.
+ * @return The number of jobs, at least 1
+ */
+size_t mb_default_jobs(void);
+
+/**
+ * @brief Get the CPU the job in a process slot is pinned to. Slots are
+ * spread across NUMA nodes and physical cores before SMT siblings are used.
+ * @return The CPU or -1 if jobs are not pinned
+ */
+int mb_topology_cpu(size_t slot);
+
+/**
+ * @brief Pin a process to a single CPU.
+ * @param pid The process to pin, 0 for the calling process
+ * @return Success?
+ */
+bool mb_topology_pin(int pid, int cpu);
+
+/**
+ * @brief Find the cgroup v2 directory of this process.
+ * @return Success?
+ */
+bool mb_cgroup_dir(char *dir, size_t size);
+
+#endif /* #ifndef TOPOLOGY_H */
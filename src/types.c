@@ -18,7 +18,8 @@ struct build_type_id build_type_lookup[] = {
 	{.name = "incremental", .value = BUILD_TYPE_INCREMENTAL},
 	{.name = "full", .value = BUILD_TYPE_FULL}};
 
-const size_t BUILD_TYPE_LOOKUP_SIZE = sizeof(build_type_lookup);
+const size_t BUILD_TYPE_LOOKUP_SIZE =
+	sizeof(build_type_lookup) / sizeof(build_type_lookup[0]);
 
 build_type_t str_to_build_type(char *src, build_type_t fallback) {
 	if (src == NULL) {
@@ -41,9 +42,12 @@ struct exec_mode_id {
 
 struct exec_mode_id exec_mode_lookup[] = {
 	{.name = "singular", .value = EXEC_MODE_SINGULAR},
-	{.name = "unify", .value = EXEC_MODE_UNIFY}};
+	{.name = "unify", .value = EXEC_MODE_UNIFY},
+	{.name = "chunked", .value = EXEC_MODE_CHUNKED},
+	{.name = "unity", .value = EXEC_MODE_UNITY}};
 
-const size_t EXEC_MODE_LOOKUP_SIZE = sizeof(exec_mode_lookup);
+const size_t EXEC_MODE_LOOKUP_SIZE =
+	sizeof(exec_mode_lookup) / sizeof(exec_mode_lookup[0]);
 
 exec_mode_t str_to_exec_mode(char *src, exec_mode_t fallback) {
 	if (src == NULL) {
@@ -58,3 +62,67 @@ exec_mode_t str_to_exec_mode(char *src, exec_mode_t fallback) {
 
 	return fallback;
 }
+
+char *exec_mode_to_str(exec_mode_t mode) {
+	for (size_t ix = 0; ix < EXEC_MODE_LOOKUP_SIZE; ix++) {
+		if (exec_mode_lookup[ix].value == mode) {
+			return exec_mode_lookup[ix].name;
+		}
+	}
+
+	return "unknown";
+}
+
+struct output_mode_id {
+	char *name;
+	output_mode_t value;
+};
+
+struct output_mode_id output_mode_lookup[] = {
+	{.name = "all", .value = OUTPUT_MODE_ALL},
+	{.name = "failed", .value = OUTPUT_MODE_FAILED},
+	{.name = "live", .value = OUTPUT_MODE_LIVE}};
+
+const size_t OUTPUT_MODE_LOOKUP_SIZE =
+	sizeof(output_mode_lookup) / sizeof(output_mode_lookup[0]);
+
+output_mode_t str_to_output_mode(char *src, output_mode_t fallback) {
+	if (src == NULL) {
+		return fallback;
+	}
+
+	for (size_t ix = 0; ix < OUTPUT_MODE_LOOKUP_SIZE; ix++) {
+		if (strcmp(src, output_mode_lookup[ix].name) == 0) {
+			return output_mode_lookup[ix].value;
+		}
+	}
+
+	return fallback;
+}
+
+struct progress_mode_id {
+	char *name;
+	progress_mode_t value;
+};
+
+struct progress_mode_id progress_mode_lookup[] = {
+	{.name = "auto", .value = PROGRESS_MODE_AUTO},
+	{.name = "line", .value = PROGRESS_MODE_LINE},
+	{.name = "plain", .value = PROGRESS_MODE_PLAIN}};
+
+const size_t PROGRESS_MODE_LOOKUP_SIZE =
+	sizeof(progress_mode_lookup) / sizeof(progress_mode_lookup[0]);
+
+progress_mode_t str_to_progress_mode(char *src, progress_mode_t fallback) {
+	if (src == NULL) {
+		return fallback;
+	}
+
+	for (size_t ix = 0; ix < PROGRESS_MODE_LOOKUP_SIZE; ix++) {
+		if (strcmp(src, progress_mode_lookup[ix].name) == 0) {
+			return progress_mode_lookup[ix].value;
+		}
+	}
+
+	return fallback;
+}
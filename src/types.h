@@ -29,10 +29,46 @@ typedef struct config {
 typedef enum exec_mode {
 	EXEC_MODE_SINGULAR = 0,
 	EXEC_MODE_UNIFY,
+	EXEC_MODE_CHUNKED,
+	EXEC_MODE_UNITY,
 } exec_mode_t;
 
+/* What happens to the output of jobs */
+typedef enum output_mode {
+	OUTPUT_MODE_INVALID = -1,
+
+	/* capture the output of parallel jobs and print it once they finish */
+	OUTPUT_MODE_ALL = 0,
+
+	/* capture the output of every job, only print it if the job failed */
+	OUTPUT_MODE_FAILED,
+
+	/* let jobs write to the terminal directly */
+	OUTPUT_MODE_LIVE,
+} output_mode_t;
+
+/* How the progress of a build is shown on the terminal */
+typedef enum progress_mode {
+	PROGRESS_MODE_INVALID = -1,
+
+	/* a status line if stderr is a terminal, otherwise the full log */
+	PROGRESS_MODE_AUTO = 0,
+
+	/* a status line, messages below LOG_INFO only go to the log file */
+	PROGRESS_MODE_LINE,
+
+	/* the full log */
+	PROGRESS_MODE_PLAIN,
+} progress_mode_t;
+
 build_type_t str_to_build_type(char *src, build_type_t fallback);
 
 exec_mode_t str_to_exec_mode(char *src, exec_mode_t fallback);
 
+char *exec_mode_to_str(exec_mode_t mode);
+
+output_mode_t str_to_output_mode(char *src, output_mode_t fallback);
+
+progress_mode_t str_to_progress_mode(char *src, progress_mode_t fallback);
+
 #endif /* #ifndef TYPES_H */
@@ -0,0 +1,824 @@
+/* workers.c ; mariebuild long-lived workers
+ *
+ * Starting a process for every job costs a fork, an exec and the startup of
+ * whatever is started. Workers stay alive for all jobs of a rule instead.
+ *
+ * Shell workers are started for rules with shell_workers set. They get one
+ * command per job over their stdin:
+ *
+ *   ( . 'SCRIPT' ) <&4 3>&- 4>&-; echo "JOB $?" >&3
+ *
+ * The subshell isolates the working directory and the environment of every
+ * job. Its stdin is the stdin of mariebuild, which the worker keeps on fd 4,
+ * and once it exits the worker reports the job id and the exit status as a
+ * line on fd 3, a pipe read by mariebuild.
+ *
+ * Persistent workers are tools started from the worker field of a rule, which
+ * speak a protocol modelled after the JSON persistent workers of Bazel over
+ * their stdin and stdout. Every message is a JSON object preceded by its
+ * length in bytes as a decimal number and a newline:
+ *
+ *   52
+ *   {"arguments":["-o","out/a.h","a.schema"],"requestId":1}
+ *
+ * The response has to carry the same requestId, an exitCode and optionally
+ * the output of the request in output. A worker exiting is started again for
+ * the next job.
+ *
+ * Copyright (c) 2025, Marie Eckert
+ * Licensend under the BSD 3-Clause License.
+ */
+
+#define _XOPEN_SOURCE 700
+#define _POSIX_C_SOURCE 200809L
+
+#include <errno.h>
+#include <limits.h>
+#include <signal.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "c_rule.h"
+#include "cptrlist.h"
+#include "logging.h"
+#include "signals.h"
+#include "stats.h"
+#include "topology.h"
+#include "workers.h"
+#include "xmem.h"
+
+/* fds of a shell worker for the stdin of the jobs and the completion lines */
+#define WORKER_STDIN_FD 4
+#define WORKER_STATUS_FD 3
+
+#define WORKER_READ_SIZE 4096
+
+/* responses of persistent workers larger than this are a protocol error */
+#define WORKER_MAX_MESSAGE (64 * 1024 * 1024)
+
+struct worker {
+	int pid;
+	worker_kind_t kind;
+	char *rule;
+
+	/* the shell or the command line the worker was started with */
+	char *command;
+
+	/* write end of the stdin of the worker, read end of its status pipe or
+	 * stdout */
+	int commands_fd;
+	int status_fd;
+
+	bool busy;
+	unsigned long long job;
+
+	/* file the output of the current job of a persistent worker is written
+	 * to, -1 for stdout */
+	int output_fd;
+
+	/* output of the worker which was not consumed yet */
+	char *buffer;
+	size_t buffer_len;
+	size_t buffer_size;
+};
+
+static CPtrList workers;
+static bool initialised = false;
+
+static unsigned long long job_counter = 0;
+
+static const char *kind_names[] = {"shell", "persistent"};
+
+/**
+ * @brief Replace the forked child with the worker.
+ */
+static _Noreturn void _worker_child(
+	worker_kind_t kind,
+	const char *command,
+	int commands_fd,
+	int status_fd,
+	uint64_t memory_limit) {
+	signal(SIGPIPE, SIG_DFL);
+
+	/* the jobs of the worker can be cancelled as a group */
+	setpgid(0, 0);
+
+	/* move the pipes out of the way of the fds they are duplicated to */
+	int commands = fcntl(commands_fd, F_DUPFD, 10);
+	int status = fcntl(status_fd, F_DUPFD, 10);
+	if (commands < 0 || status < 0) {
+		perror("fcntl");
+		_exit(127);
+	}
+
+	bool ok;
+	if (kind == WORKER_KIND_SHELL) {
+		int stdin_fd = STDIN_FILENO;
+		if (fcntl(stdin_fd, F_GETFD) < 0) {
+			stdin_fd = open("/dev/null", O_RDONLY);
+		}
+
+		ok = dup2(stdin_fd, WORKER_STDIN_FD) >= 0 &&
+			 dup2(commands, STDIN_FILENO) >= 0 &&
+			 dup2(status, WORKER_STATUS_FD) >= 0;
+	} else {
+		ok = dup2(commands, STDIN_FILENO) >= 0 &&
+			 dup2(status, STDOUT_FILENO) >= 0;
+	}
+
+	if (!ok) {
+		perror("dup2");
+		_exit(127);
+	}
+
+	close(commands);
+	close(status);
+
+	if (memory_limit != 0) {
+		struct rlimit limit = {
+			.rlim_cur = memory_limit,
+			.rlim_max = memory_limit,
+		};
+
+		if (setrlimit(RLIMIT_AS, &limit) != 0) {
+			perror("setrlimit(RLIMIT_AS)");
+			_exit(127);
+		}
+	}
+
+	if (kind == WORKER_KIND_SHELL) {
+		execl(command, command, (char *)NULL);
+	} else {
+		execl("/bin/sh", "sh", "-c", command, (char *)NULL);
+	}
+
+	perror("execl");
+	_exit(127);
+}
+
+/**
+ * @brief Free a worker whose process was waited for.
+ */
+static void _release_worker(worker_t *worker) {
+	mb_logf(
+		LOG_DEBUG, "stopped %s worker %d of \"%s\"\n", kind_names[worker->kind],
+		worker->pid, worker->rule);
+
+	XFREE(worker->rule);
+	XFREE(worker->command);
+	XFREE(worker->buffer);
+
+	cptrlist_free(&workers, worker);
+}
+
+/**
+ * @brief Close the pipes of a worker, wait for it to exit and free it.
+ * Persistent workers are terminated, a tool might not exit at the end of its
+ * input.
+ * @return The wait status of the worker
+ */
+static int _stop_worker(worker_t *worker) {
+	close(worker->commands_fd);
+	close(worker->status_fd);
+
+	if (worker->kind == WORKER_KIND_PERSISTENT) {
+		kill(worker->pid, SIGTERM);
+	}
+
+	int stat = 0;
+	while (waitpid(worker->pid, &stat, 0) < 0 && errno == EINTR) {
+	}
+
+	_release_worker(worker);
+	return stat;
+}
+
+static worker_t *_start_worker(
+	const char *rule,
+	worker_kind_t kind,
+	const char *command,
+	uint64_t memory_limit) {
+	int commands[2];
+	int status[2];
+
+	if (pipe(commands) != 0) {
+		mb_logf(LOG_ERROR, "pipe failed: %s\n", strerror(errno));
+		return NULL;
+	}
+
+	if (pipe(status) != 0) {
+		mb_logf(LOG_ERROR, "pipe failed: %s\n", strerror(errno));
+		close(commands[0]);
+		close(commands[1]);
+		return NULL;
+	}
+
+	/* other children must not hold the pipes, or the worker would never see
+	 * the end of its input */
+	int fds[] = {commands[0], commands[1], status[0], status[1]};
+	for (size_t ix = 0; ix < sizeof(fds) / sizeof(fds[0]); ix++) {
+		fcntl(fds[ix], F_SETFD, FD_CLOEXEC);
+	}
+
+	/* a worker going away should fail its job, not kill the build. Children
+	 * get the default disposition back. */
+	signal(SIGPIPE, SIG_IGN);
+
+	int pid = fork();
+	if (pid == 0) {
+		_worker_child(kind, command, commands[0], status[1], memory_limit);
+	}
+
+	close(commands[0]);
+	close(status[1]);
+
+	if (pid < 0) {
+		mb_logf(LOG_ERROR, "fork failed: %s\n", strerror(errno));
+		close(commands[1]);
+		close(status[0]);
+		return NULL;
+	}
+
+	setpgid(pid, pid);
+	fcntl(status[0], F_SETFL, fcntl(status[0], F_GETFL) | O_NONBLOCK);
+
+	worker_t *worker = XMALLOC(sizeof(worker_t));
+	*worker = (worker_t){
+		.pid = pid,
+		.kind = kind,
+		.rule = strdup(rule),
+		.command = strdup(command),
+		.commands_fd = commands[1],
+		.status_fd = status[0],
+		.busy = false,
+		.output_fd = -1,
+		.buffer = XMALLOC(WORKER_READ_SIZE),
+		.buffer_len = 0,
+		.buffer_size = WORKER_READ_SIZE,
+	};
+
+	cptrlist_insert_or_append(&workers, worker);
+
+	mb_logf(
+		LOG_DEBUG, "started %s worker %d (%s) for \"%s\"\n", kind_names[kind],
+		pid, command, rule);
+	return worker;
+}
+
+worker_t *mb_worker_get(
+	const char *rule,
+	worker_kind_t kind,
+	const char *command,
+	uint64_t memory_limit) {
+	if (!initialised) {
+		cptrlist_init(&workers, 8, 8);
+		initialised = true;
+	}
+
+	for (size_t ix = 0; ix < workers.size; ix++) {
+		worker_t *worker = workers.items[ix];
+		if (worker != NULL && !worker->busy && worker->kind == kind &&
+			strcmp(worker->rule, rule) == 0 &&
+			strcmp(worker->command, command) == 0) {
+			return worker;
+		}
+	}
+
+	return _start_worker(rule, kind, command, memory_limit);
+}
+
+/**
+ * @brief Hand a job to a worker.
+ * @return Success? The worker is stopped if it is gone
+ */
+static bool
+_send_job(worker_t *worker, const char *message, size_t len, int cpu) {
+	/* not being able to pin only costs performance */
+	if (cpu >= 0 && !mb_topology_pin(worker->pid, cpu)) {
+		mb_logf(
+			LOG_DEBUG, "failed to pin worker %d to cpu %d\n", worker->pid,
+			cpu);
+	}
+
+	size_t written = 0;
+	while (written < len) {
+		ssize_t res =
+			write(worker->commands_fd, message + written, len - written);
+		if (res < 0 && errno == EINTR) {
+			continue;
+		}
+
+		if (res <= 0) {
+			mb_logf(
+				LOG_WARNING, "%s worker %d of \"%s\" is gone: %s\n",
+				kind_names[worker->kind], worker->pid, worker->rule,
+				strerror(errno));
+			_stop_worker(worker);
+			return false;
+		}
+
+		written += res;
+	}
+
+	worker->busy = true;
+	return true;
+}
+
+bool mb_worker_run(
+	worker_t *worker,
+	const char *location,
+	const char *output,
+	int cpu) {
+	/* the paths are quoted for the shell */
+	if (strchr(location, '\'') != NULL ||
+		(output != NULL && strchr(output, '\'') != NULL)) {
+		return false;
+	}
+
+	worker->job = ++job_counter;
+
+	char redirect[PATH_MAX + 16] = "";
+	if (output != NULL) {
+		snprintf(redirect, sizeof(redirect), " >'%s' 2>&1", output);
+	}
+
+	char command[2 * PATH_MAX + 128];
+	int len = snprintf(
+		command, sizeof(command),
+		"( . '%s' ) <&%d%s %d>&- %d>&-; echo \"%llu $?\" >&%d\n", location,
+		WORKER_STDIN_FD, redirect, WORKER_STATUS_FD, WORKER_STDIN_FD,
+		worker->job, WORKER_STATUS_FD);
+
+	if (len < 0 || (size_t)len >= sizeof(command)) {
+		return false;
+	}
+
+	return _send_job(worker, command, len, cpu);
+}
+
+/******** persistent worker protocol ********/
+
+static void _append_json_string(
+	char **dest,
+	size_t *wix,
+	size_t *dest_size,
+	const char *str) {
+	_append_char(dest, (*wix)++, dest_size, '"');
+
+	for (const char *chr = str; *chr != 0; chr++) {
+		unsigned char c = (unsigned char)*chr;
+		if (c == '"' || c == '\\') {
+			_append_char(dest, (*wix)++, dest_size, '\\');
+			_append_char(dest, (*wix)++, dest_size, c);
+		} else if (c < 0x20) {
+			char escaped[8];
+			snprintf(escaped, sizeof(escaped), "\\u%04x", c);
+			*wix = _append_str(dest, *wix, dest_size, escaped);
+		} else {
+			_append_char(dest, (*wix)++, dest_size, c);
+		}
+	}
+
+	_append_char(dest, (*wix)++, dest_size, '"');
+}
+
+bool mb_worker_request(
+	worker_t *worker,
+	char **arguments,
+	int output_fd,
+	int cpu) {
+	worker->job = ++job_counter;
+	worker->output_fd = output_fd;
+
+	size_t json_size = 128;
+	size_t json_wix = 0;
+	char *json = XMALLOC(json_size);
+
+	json_wix = _append_str(&json, json_wix, &json_size, "{\"arguments\":[");
+	for (size_t ix = 0; arguments[ix] != NULL; ix++) {
+		if (ix > 0) {
+			_append_char(&json, json_wix++, &json_size, ',');
+		}
+		_append_json_string(&json, &json_wix, &json_size, arguments[ix]);
+	}
+
+	char tail[48];
+	snprintf(tail, sizeof(tail), "],\"requestId\":%llu}", worker->job);
+	json_wix = _append_str(&json, json_wix, &json_size, tail);
+
+	char header[24];
+	int header_len = snprintf(header, sizeof(header), "%zu\n", json_wix);
+
+	size_t message_size = header_len + json_wix;
+	char *message = XMALLOC(message_size);
+	memcpy(message, header, header_len);
+	memcpy(message + header_len, json, json_wix);
+	XFREE(json);
+
+	bool ok = _send_job(worker, message, message_size, cpu);
+	XFREE(message);
+	return ok;
+}
+
+static const char *_json_ws(const char *chr) {
+	return chr + strspn(chr, " \t\r\n");
+}
+
+/**
+ * @brief Parse a JSON string.
+ * @param decoded Output for the heap allocated content of the string, NULL to
+ * only skip it
+ * @return The character after the string or NULL if it is malformed
+ */
+static const char *_json_string(const char *chr, char **decoded) {
+	if (*chr != '"') {
+		return NULL;
+	}
+
+	size_t size = 16;
+	size_t wix = 0;
+	char *out = decoded == NULL ? NULL : XMALLOC(size);
+
+	for (chr++; *chr != '"'; chr++) {
+		char c = *chr;
+		if (c == 0) {
+			goto fail;
+		}
+
+		if (c == '\\') {
+			chr++;
+			switch (*chr) {
+				case 'b':
+					c = '\b';
+					break;
+				case 'f':
+					c = '\f';
+					break;
+				case 'n':
+					c = '\n';
+					break;
+				case 'r':
+					c = '\r';
+					break;
+				case 't':
+					c = '\t';
+					break;
+				case 'u': {
+					unsigned int code;
+					if (sscanf(chr + 1, "%4x", &code) != 1) {
+						goto fail;
+					}
+					chr += 4;
+
+					/* only what fits into a single UTF-8 sequence without
+					 * combining surrogate pairs */
+					if (code >= 0xd800 && code < 0xe000) {
+						c = '?';
+					} else if (code >= 0x800) {
+						if (out != NULL) {
+							_append_char(&out, wix++, &size, 0xe0 | code >> 12);
+							_append_char(
+								&out, wix++, &size, 0x80 | (code >> 6 & 0x3f));
+						}
+						c = 0x80 | (code & 0x3f);
+					} else if (code >= 0x80) {
+						if (out != NULL) {
+							_append_char(&out, wix++, &size, 0xc0 | code >> 6);
+						}
+						c = 0x80 | (code & 0x3f);
+					} else {
+						c = code;
+					}
+					break;
+				}
+				case 0:
+					goto fail;
+				default:
+					c = *chr;
+			}
+		}
+
+		if (out != NULL) {
+			_append_char(&out, wix++, &size, c);
+		}
+	}
+
+	if (out != NULL) {
+		_append_char(&out, wix, &size, 0);
+		*decoded = out;
+	}
+
+	return chr + 1;
+
+fail:
+	if (out != NULL) {
+		XFREE(out);
+	}
+	return NULL;
+}
+
+/**
+ * @brief Skip a JSON value.
+ * @return The character after the value or NULL if it is malformed
+ */
+static const char *_json_skip(const char *chr) {
+	if (*chr == '"') {
+		return _json_string(chr, NULL);
+	}
+
+	if (*chr != '{' && *chr != '[') {
+		size_t len = strspn(chr, "+-.0123456789eEtruefalsn");
+		return len == 0 ? NULL : chr + len;
+	}
+
+	size_t depth = 0;
+	do {
+		if (*chr == '"') {
+			chr = _json_string(chr, NULL);
+			if (chr == NULL) {
+				return NULL;
+			}
+			continue;
+		}
+
+		if (*chr == '{' || *chr == '[') {
+			depth++;
+		} else if (*chr == '}' || *chr == ']') {
+			depth--;
+		} else if (*chr == 0) {
+			return NULL;
+		}
+
+		chr++;
+	} while (depth > 0);
+
+	return chr;
+}
+
+/**
+ * @brief Parse a work response, fields which are not present keep the values
+ * they had.
+ * @return Success?
+ */
+static bool _parse_response(
+	const char *json,
+	long long *exit_code,
+	long long *request_id,
+	char **output) {
+	const char *chr = _json_ws(json);
+	if (*chr++ != '{') {
+		return false;
+	}
+
+	chr = _json_ws(chr);
+	while (*chr != '}') {
+		char *key = NULL;
+		chr = _json_string(chr, &key);
+		if (chr == NULL) {
+			return false;
+		}
+
+		chr = _json_ws(chr);
+		if (*chr++ != ':') {
+			XFREE(key);
+			return false;
+		}
+		chr = _json_ws(chr);
+
+		if (strcmp(key, "exitCode") == 0 || strcmp(key, "requestId") == 0) {
+			char *end;
+			long long value = strtoll(chr, &end, 10);
+			*(strcmp(key, "exitCode") == 0 ? exit_code : request_id) = value;
+			chr = end == chr ? NULL : end;
+		} else if (strcmp(key, "output") == 0 && *output == NULL) {
+			chr = _json_string(chr, output);
+		} else {
+			chr = _json_skip(chr);
+		}
+
+		XFREE(key);
+		if (chr == NULL) {
+			return false;
+		}
+
+		chr = _json_ws(chr);
+		if (*chr == ',') {
+			chr = _json_ws(chr + 1);
+		} else if (*chr != '}') {
+			return false;
+		}
+	}
+
+	return true;
+}
+
+/**
+ * @brief Write the output of a request to the file capturing it. Losing the
+ * output does not fail the job.
+ */
+static void _write_output(int fd, const char *output) {
+	size_t len = strlen(output);
+	size_t written = 0;
+	while (written < len) {
+		ssize_t res = write(fd, output + written, len - written);
+		if (res < 0 && errno == EINTR) {
+			continue;
+		}
+
+		if (res <= 0) {
+			return;
+		}
+
+		written += res;
+	}
+}
+
+/**
+ * @brief Take a complete message from the output buffer of a worker.
+ * @return 1 if a message was taken, 0 if there is none yet and -1 if the
+ * worker broke the protocol
+ */
+static int _take_message(worker_t *worker, int *exit_status) {
+	char *newline = memchr(worker->buffer, '\n', worker->buffer_len);
+	if (newline == NULL) {
+		return worker->buffer_len > 24 ? -1 : 0;
+	}
+
+	size_t header_len = (size_t)(newline + 1 - worker->buffer);
+	size_t consumed = header_len;
+	long long status = 1;
+	long long job = 0;
+
+	if (worker->kind == WORKER_KIND_SHELL) {
+		*newline = 0;
+		unsigned long long line_job;
+		int line_status;
+		if (sscanf(worker->buffer, "%llu %d", &line_job, &line_status) != 2) {
+			return -1;
+		}
+
+		job = line_job;
+		status = line_status;
+	} else {
+		char *end;
+		unsigned long long len = strtoull(worker->buffer, &end, 10);
+		if (end == worker->buffer || end != newline ||
+			len > WORKER_MAX_MESSAGE) {
+			return -1;
+		}
+
+		if (worker->buffer_len - header_len < len) {
+			return 0;
+		}
+
+		consumed += len;
+		char *json = XMALLOC(len + 1);
+		memcpy(json, newline + 1, len);
+		json[len] = 0;
+
+		char *output = NULL;
+		bool ok = _parse_response(json, &status, &job, &output);
+		XFREE(json);
+
+		if (output != NULL && worker->output_fd >= 0) {
+			_write_output(worker->output_fd, output);
+			XFREE(output);
+		} else if (output != NULL) {
+			/* keep our own output in front of the output of the tool */
+			mb_log_flush();
+			fputs(output, stdout);
+			fflush(stdout);
+			XFREE(output);
+		}
+
+		if (!ok) {
+			return -1;
+		}
+	}
+
+	if ((unsigned long long)job != worker->job) {
+		mb_logf(
+			LOG_ERROR, "%s worker %d answered job %lld instead of %llu\n",
+			kind_names[worker->kind], worker->pid, job, worker->job);
+		return -1;
+	}
+
+	worker->buffer_len -= consumed;
+	memmove(worker->buffer, worker->buffer + consumed, worker->buffer_len);
+
+	worker->busy = false;
+	*exit_status = status < 0 || status > 255 ? 1 : (int)status;
+	return 1;
+}
+
+int mb_worker_pid(const worker_t *worker) {
+	return worker->pid;
+}
+
+bool mb_worker_poll(worker_t *worker, bool block, int *exit_status) {
+	for (;;) {
+		int taken = _take_message(worker, exit_status);
+		if (taken > 0) {
+			return true;
+		}
+
+		if (taken < 0) {
+			break;
+		}
+
+		if (block) {
+			struct pollfd pfd = {.fd = worker->status_fd, .events = POLLIN};
+			poll(&pfd, 1, -1);
+		}
+
+		if (worker->buffer_size - worker->buffer_len < WORKER_READ_SIZE) {
+			worker->buffer_size *= 2;
+			worker->buffer = XREALLOC(worker->buffer, worker->buffer_size);
+		}
+
+		ssize_t res = read(
+			worker->status_fd, worker->buffer + worker->buffer_len,
+			worker->buffer_size - worker->buffer_len - 1);
+
+		if (res > 0) {
+			worker->buffer_len += res;
+			continue;
+		}
+
+		if (res < 0 && (errno == EAGAIN || errno == EINTR)) {
+			if (!block) {
+				return false;
+			}
+			continue;
+		}
+
+		break;
+	}
+
+	/* the worker exited or broke the protocol while running the job, the
+	 * next job of the rule starts a new one */
+	int pid = worker->pid;
+	const char *kind = kind_names[worker->kind];
+	int stat = _stop_worker(worker);
+	mb_logf(
+		LOG_ERROR, "%s worker %d exited or sent garbage, restarting it\n",
+		kind, pid);
+
+	*exit_status = WIFEXITED(stat) && WEXITSTATUS(stat) != 0
+					   ? WEXITSTATUS(stat)
+					   : 127;
+	return true;
+}
+
+void mb_worker_cancel(worker_t *worker, uint64_t deadline) {
+	const struct timespec poll_interval = {
+		.tv_sec = 0, .tv_nsec = MB_CANCEL_POLL_NS};
+
+	close(worker->commands_fd);
+	close(worker->status_fd);
+
+	/* the group of the worker holds its job as well */
+	int pid = worker->pid;
+	kill(-pid, SIGTERM);
+
+	int stat;
+	pid_t res;
+	while ((res = waitpid(pid, &stat, WNOHANG)) == 0 &&
+		   mb_stats_now() < deadline) {
+		nanosleep(&poll_interval, NULL);
+	}
+
+	/* the job may outlive the worker, whatever is left goes as well */
+	kill(-pid, SIGKILL);
+	if (res == 0) {
+		while (waitpid(pid, &stat, 0) < 0 && errno == EINTR) {
+		}
+	}
+
+	_release_worker(worker);
+}
+
+void mb_workers_stop(void) {
+	if (!initialised) {
+		return;
+	}
+
+	for (size_t ix = 0; ix < workers.size; ix++) {
+		if (workers.items[ix] != NULL) {
+			_stop_worker(workers.items[ix]);
+		}
+	}
+
+	cptrlist_destroy(&workers);
+	initialised = false;
+}
@@ -0,0 +1,92 @@
+/* workers.h ; mariebuild pre-forked shell workers header
+ *
+ * Copyright (c) 2025, Marie Eckert
+ * Licensend under the BSD 3-Clause License.
+ */
+
+#ifndef WORKERS_H
+#define WORKERS_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/* A long-lived process running the jobs of a rule one after another */
+typedef struct worker worker_t;
+
+typedef enum worker_kind {
+	/* a shell running the scripts of the jobs in subshells */
+	WORKER_KIND_SHELL = 0,
+
+	/* a tool speaking the persistent worker protocol */
+	WORKER_KIND_PERSISTENT,
+} worker_kind_t;
+
+/**
+ * @brief Get an idle worker of a rule, a new one is started if all of them
+ * are busy.
+ * @param command The path of the shell for shell workers, the command line
+ * starting the tool for persistent workers
+ * @param memory_limit The address space limit of a new worker in bytes, 0
+ * for no limit
+ * @return The worker or NULL if it could not be started
+ */
+worker_t *mb_worker_get(
+	const char *rule,
+	worker_kind_t kind,
+	const char *command,
+	uint64_t memory_limit);
+
+/**
+ * @brief Start running a script file in an idle worker. The script is run in
+ * a subshell, so changes to the working directory or the environment do not
+ * carry over to later jobs of the worker.
+ * @param output File stdout and stderr of the script are redirected to, NULL
+ * to keep those of the worker
+ * @param cpu CPU to pin the worker to, -1 to leave its affinity alone
+ * @return Success? If not the script was not run
+ */
+bool mb_worker_run(
+	worker_t *worker,
+	const char *location,
+	const char *output,
+	int cpu);
+
+/**
+ * @brief Send a work request to an idle persistent worker.
+ * @param arguments NULL terminated arguments of the request
+ * @param output_fd File the output of the response is written to, -1 for
+ * stdout
+ * @param cpu CPU to pin the worker to, -1 to leave its affinity alone
+ * @return Success? If not the request was not sent
+ */
+bool mb_worker_request(
+	worker_t *worker,
+	char **arguments,
+	int output_fd,
+	int cpu);
+
+int mb_worker_pid(const worker_t *worker);
+
+/**
+ * @brief Check if the job of a worker finished. A worker which exits or
+ * breaks the protocol while running a job is stopped, the job fails.
+ * @param block Wait for the job to finish
+ * @param exit_status Output for the exit status of the job
+ * @return true if the job finished
+ */
+bool mb_worker_poll(worker_t *worker, bool block, int *exit_status);
+
+/**
+ * @brief Cancel the job of a busy worker by stopping the worker, the next job
+ * of the rule starts a new one. The worker and its job get SIGTERM and, if the
+ * worker is still running at the deadline, SIGKILL. The worker is freed.
+ * @param deadline mb_stats_now() time to wait for the worker until
+ */
+void mb_worker_cancel(worker_t *worker, uint64_t deadline);
+
+/**
+ * @brief Stop all workers, waiting for them to exit.
+ */
+void mb_workers_stop(void);
+
+#endif /* #ifndef WORKERS_H */
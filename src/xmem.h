@@ -11,12 +11,14 @@
 #include <stdlib.h>
 
 #include "logging.h"
+#include "stats.h"
 
 #define _STR(x) #x
 #define STR(x) _STR(x)
 
 #define PANIC(s)                    \
 	do {                            \
+		mb_log_flush();             \
 		fprintf(stderr, "%s\n", s); \
 		abort();                    \
 	} while (0)
@@ -28,6 +30,7 @@
 		if (ret == NULL) {                   \
 			PANIC("XMALLOC returned NULL!"); \
 		}                                    \
+		mb_stats_allocs++;                   \
 		ret;                                 \
 	})
 
@@ -38,6 +41,7 @@
 		if (ret == NULL) {                   \
 			PANIC("XCALLOC returned NULL!"); \
 		}                                    \
+		mb_stats_allocs++;                   \
 		ret;                                 \
 	})
 
@@ -48,6 +52,7 @@
 		if (ret == NULL) {                    \
 			PANIC("XREALLOC returned NULL!"); \
 		}                                     \
+		mb_stats_allocs++;                    \
 		ret;                                  \
 	})
 